@@ -1,5 +1,12 @@
 #include <drv8711.h>
 #include <robot_motors.h>
+#include <control_scheduler.h>
+#include <event_log.h>
+#include <telemetry_stream.h>
+#include <axis_shaper.h>
+#include <drive_mixer.h>
+#include <latency_trace.h>
+#include <loop_profiler.h>
 #include <Bluepad32.h>
 #include <cstring>
 
@@ -9,6 +16,105 @@ ControllerPtr myController;
 
 Motors robotMotors;
 
+//This runs the motor control at a fixed rate on its own core, separate to the controller handling in loop()
+ControlScheduler controlScheduler;
+
+//How often the motor outputs are updated and faults are checked
+const uint32_t CONTROL_RATE = 1000;
+
+//How often loop() reads the controller, in milliseconds
+const uint32_t INPUT_LOOP_PERIOD_MS = 20;
+
+//How often the loop timing statistics are printed, in milliseconds
+const uint32_t TIMING_STATS_PERIOD_MS = 10000;
+
+//Type this character in the serial monitor to print how long each part of the program is taking
+//and how busy each task is, set LOOP_PROFILER to 0 in loop_profiler.h to remove the profiler
+const char PROFILE_SUMMARY_KEY = 'p';
+
+//Set this to true to stream binary telemetry over the serial port
+//Use tools/telemetry_decode to turn a capture of the serial port into a CSV file
+const bool ENABLE_TELEMETRY = false;
+
+TelemetryStream telemetryStream;
+
+//PWM frequency for each motor, in Hz
+//Higher frequencies are quieter but switch more often, lower ones have more current ripple
+const uint32_t LEFT_MOTOR_PWM_FREQUENCY = 10000;
+const uint32_t RIGHT_MOTOR_PWM_FREQUENCY = 10000;
+
+//How the motor driver chip is set up, see RobotMotors/drv8711_profile.h
+//DRIVER_PROFILE_DEFAULT_BRUSHED: what the board has always used
+//DRIVER_PROFILE_HIGH_TORQUE: trips over current at twice the current, for motors that stall above 33A
+//DRIVER_PROFILE_LOW_NOISE: softer switching for less electrical noise, the FETs run a little hotter
+const DRIVER_PROFILE MOTOR_DRIVER_PROFILE = DRIVER_PROFILE_DEFAULT_BRUSHED;
+
+//Set this to true to step through PWM frequencies at startup and print the motor driver faults seen at each one
+//This spins both motors, so lift the robot's wheels off the ground first
+const bool PWM_SWEEP_MODE = false;
+const uint32_t PWM_SWEEP_START_HZ = 5000;
+const uint32_t PWM_SWEEP_END_HZ = 40000;
+const uint32_t PWM_SWEEP_STEP_HZ = 2500;
+const float PWM_SWEEP_SPEED = 50.0;
+const uint32_t PWM_SWEEP_DWELL_MS = 2000;
+
+//How quickly the motors are allowed to change speed, in % of full speed per second, 0 is no limit
+//Ramping up limits the inrush current that trips the motor driver's over current protection,
+//braking and reversing can usually be faster as the motor is already slowing down
+const float ACCELERATE_PERCENT_PER_SECOND = 400.0;
+const float DECELERATE_PERCENT_PER_SECOND = 800.0;
+const float REVERSE_PERCENT_PER_SECOND = 600.0;
+
+//When the motors brake instead of coasting, and how hard, from 0 (coast) to 100 (short brake)
+//BRAKE_NEVER: coast when a stick is let go
+//BRAKE_AT_ZERO: brake when a stick is let go
+//BRAKE_AT_ZERO_AND_REVERSE: also brake while slowing down to change direction
+//Run tools/bench with --stop-time to see roughly how long each takes to stop
+const BRAKE_POLICY DRIVE_BRAKE_POLICY = BRAKE_AT_ZERO_AND_REVERSE;
+const float DRIVE_BRAKE_PERCENT = 50.0;
+
+//If the controller stops sending for this long the motors are stopped, until it starts sending again
+//This catches a controller that has gone out of range or flat before bluetooth notices it has gone
+//Some controllers only send when a stick or button moves, if the robot stops while you hold a stick still
+//make this longer, or set it to 0 to turn it off
+const uint32_t INPUT_TIMEOUT_MS = 100;
+
+//How hard to brake when the input times out, 0 lets the robot coast to a stop
+const float INPUT_FAILSAFE_BRAKE_PERCENT = 100.0;
+
+RateMonitor inputLoopMonitor;
+TickType_t lastInputLoopWake;
+unsigned long lastTimingStatsMs = 0;
+
+//How the left and right sticks are turned into motor speeds
+//rawMin, rawCentre and rawMax are the stick readings at full reverse, at rest and at full forward
+//deadbandPermille is how much stick travel around the centre is ignored, in thousandths of full travel
+//expoPermille softens the response around the centre, 0 is a straight line and 1000 is a cube
+const int16_t STICK_RAW_MIN = -400;
+const int16_t STICK_RAW_CENTRE = 0;
+const int16_t STICK_RAW_MAX = 420;
+const uint16_t STICK_DEADBAND_PERMILLE = 30;
+const uint16_t STICK_EXPO_PERMILLE = 0;
+
+AxisShaper leftStickShaper;
+AxisShaper rightStickShaper;
+AxisShaper steeringShaper;
+
+//MIX_TANK: the left stick drives the left motor and the right stick drives the right motor
+//MIX_ARCADE: the left stick is throttle and the right stick's X axis steers
+const DRIVE_MIX_MODE DRIVE_MODE = MIX_TANK;
+
+//Set this to true if the robot turns the wrong way in arcade mode
+const bool STEERING_INVERTED = false;
+
+//When the first controller input arrived, in ms since the ESP32 started, 0 until it has
+//Printed with the setup timings so you can see how long the robot takes to be drivable after a reset
+uint32_t firstInputMs = 0;
+
+//Pressing Y on the controller flips the drive for when the robot is upside down
+DriveMixer driveMixer;
+bool invertButtonWasPressed = false;
+
 //Set this to either true or false to determine whether any controller can connect
 const bool ALLOW_ANY_CONTROLLER_TO_CONNECT = true;
 
@@ -79,42 +185,60 @@ void onDisconnectedController(ControllerPtr ctl) {
 
 }
 
-//This prints the controller information
+//This logs the controller information
+//The values are queued and printed later by the log task so this does not hold up the loop
+//Set LOG_LEVEL to LOG_LEVEL_DEBUG in event_log.h to see them
 void printController(ControllerPtr ctl) {
-    Serial.printf(
-        "idx=%d, dpad: 0x%02x, buttons: 0x%04x, axis L: %4d, %4d, axis R: %4d, %4d, brake: %4d, throttle: %4d, "
-        "misc: 0x%02x, gyro x:%6d y:%6d z:%6d, accel x:%6d y:%6d z:%6d\n",
-        ctl->index(),        // Controller Index      
-        ctl->dpad(),         // DPAD
-        ctl->buttons(),      // bitmask of pressed buttons
+    LOG_DEBUG(EVT_CONTROLLER_AXES,
         ctl->axisX(),        // (-511 - 512) left X Axis
         ctl->axisY(),        // (-511 - 512) left Y axis
         ctl->axisRX(),       // (-511 - 512) right X axis
-        ctl->axisRY(),       // (-511 - 512) right Y axis
+        ctl->axisRY()        // (-511 - 512) right Y axis
+    );
+    LOG_DEBUG(EVT_CONTROLLER_BUTTONS,
+        ctl->dpad(),         // DPAD
+        ctl->buttons(),      // bitmask of pressed buttons
         ctl->brake(),        // (0 - 1023): brake button
-        ctl->throttle(),     // (0 - 1023): throttle (AKA gas) button
-        ctl->miscButtons(),  // bitmak of pressed "misc" buttons
-        ctl->gyroX(),        // Gyro X
-        ctl->gyroY(),        // Gyro Y
-        ctl->gyroZ(),        // Gyro Z
-        ctl->accelX(),       // Accelerometer X
-        ctl->accelY(),       // Accelerometer Y
-        ctl->accelZ()        // Accelerometer Z
+        ctl->throttle()      // (0 - 1023): throttle (AKA gas) button
     );
 }
 
 
 //This function maps the controller inputs to the motor speeds
-void processControllerInputs(ControllerPtr myController) {
+//reportReadUs is when BP32.update() returned with this report, it is used to measure the input latency
+void processControllerInputs(ControllerPtr myController, uint32_t reportReadUs) {
+    PROFILE_SCOPE(PROFILE_INPUT_PROCESSING);
+
     int leftThrottle = myController->axisY();
     int rightThrottle = myController->axisRY();
+    int steering = myController->axisRX();
 
-    //map the controller input range to the motor speed range (-100.0 to 100.0)
-    leftThrottle = map(leftThrottle, /*Min axis value*/-400, /*Max axis value*/420, -100, 100);
-    rightThrottle = map(rightThrottle, /*Min axis value*/-400, /*Max axis value*/420, -100, 100);
+    telemetryStream.setInputAxes(myController->axisX(), leftThrottle, steering, rightThrottle);
 
-    robotMotors.setMotorSpeed(LEFT_MOTOR, leftThrottle);
-    robotMotors.setMotorSpeed(RIGHT_MOTOR, rightThrottle);
+    //Only flip once per press, not on every loop the button is held
+    bool invertButtonPressed = myController->y();
+    if(invertButtonPressed && !invertButtonWasPressed){
+      driveMixer.toggleInverted();
+    }
+    invertButtonWasPressed = invertButtonPressed;
+
+    //Look up the duty for each stick position, the tables already include the calibration, deadband and expo
+    //then mix them into the left and right motor duties
+    int32_t leftTicks;
+    int32_t rightTicks;
+    if(driveMixer.getMode() == MIX_ARCADE){
+      driveMixer.mix(leftStickShaper.shape(leftThrottle), steeringShaper.shape(steering), leftTicks, rightTicks);
+    }
+    else{
+      driveMixer.mix(leftStickShaper.shape(leftThrottle), rightStickShaper.shape(rightThrottle), leftTicks, rightTicks);
+    }
+
+    uint32_t mappedUs = LATENCY_NOW();
+    LATENCY_RECORD(LATENCY_READ_TO_MAPPED, reportReadUs, mappedUs);
+
+    //The control task picks these up and applies them on its next cycle
+    robotMotors.publishSetpointTicks(SOURCE_CONTROLLER, leftTicks, rightTicks, AUTO_BRAKE, reportReadUs);
+    LATENCY_RECORD(LATENCY_MAPPED_TO_PUBLISHED, mappedUs, LATENCY_NOW());
 
     printController(myController);
 }
@@ -124,11 +248,19 @@ void setup() {
     //Set the Arduino serial monitor to 115200 baud in order to see the print statements
     Serial.begin(115200);
 
+    //This starts the background task that prints log messages
+    eventLog.begin();
+#if LOOP_PROFILER
+    loopProfiler.begin();
+#endif
+
     Serial.printf("Firmware: %s\n", BP32.firmwareVersion());
 
     const uint8_t* addr = BP32.localBdAddress();
     Serial.printf("BD Addr: %2X:%2X:%2X:%2X:%2X:%2X\n", addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
 
+    uint32_t bp32StartUs = micros();
+
     //Setup the functions that are called when a controller conencts or disconnects
     BP32.setup(&onConnectedController, &onDisconnectedController);
 
@@ -140,42 +272,133 @@ void setup() {
     //This tells the gamepad library that we dont want the controller to be registered as a mouse
     //The gamepad library supports 'virtual devices' such as mice, but we have no need for this
     BP32.enableVirtualDevice(false);
+    uint32_t bp32SetupUs = micros() - bp32StartUs;
 
-    robotMotors.init();
+    //These are set before init() so it can tell whether the motor driver still holds them from before a reset
+    robotMotors.setPwmConfig(LEFT_MOTOR, LEFT_MOTOR_PWM_FREQUENCY);
+    robotMotors.setPwmConfig(RIGHT_MOTOR, RIGHT_MOTOR_PWM_FREQUENCY);
+    robotMotors.setDriverProfile(MOTOR_DRIVER_PROFILE);
     robotMotors.setCurrentLimit(10.0);
+    //Use the current calibration saved on the bench if there is one, see the README
+    robotMotors.loadCurrentCalibration(settingsStore);
+    robotMotors.init();
+    robotMotors.setSlewRates(ACCELERATE_PERCENT_PER_SECOND, DECELERATE_PERCENT_PER_SECOND, REVERSE_PERCENT_PER_SECOND);
+    robotMotors.setBrakePolicy(LEFT_MOTOR, DRIVE_BRAKE_POLICY, DRIVE_BRAKE_PERCENT);
+    robotMotors.setBrakePolicy(RIGHT_MOTOR, DRIVE_BRAKE_POLICY, DRIVE_BRAKE_PERCENT);
+    robotMotors.setInputTimeout(INPUT_TIMEOUT_MS, INPUT_FAILSAFE_BRAKE_PERCENT);
+
+    //The stick tables give duties in PWM ticks, so they are built once the PWM periods are known
+    //The mixer scales them to each motor's period, rebuild both if the PWM frequency is changed
+    uint32_t stickFullScale = robotMotors.getPwmPeriodTicks(LEFT_MOTOR);
+    driveMixer.configure(stickFullScale, robotMotors.getPwmPeriodTicks(LEFT_MOTOR), robotMotors.getPwmPeriodTicks(RIGHT_MOTOR));
+    driveMixer.setMode(DRIVE_MODE);
+
+    AxisCalibration stickCalibration;
+    stickCalibration.rawMin = STICK_RAW_MIN;
+    stickCalibration.rawCentre = STICK_RAW_CENTRE;
+    stickCalibration.rawMax = STICK_RAW_MAX;
+    stickCalibration.deadbandPermille = STICK_DEADBAND_PERMILLE;
+    stickCalibration.expoPermille = STICK_EXPO_PERMILLE;
+    stickCalibration.inverted = false;
+    AxisCalibration steeringCalibration = stickCalibration;
+    steeringCalibration.inverted = STEERING_INVERTED;
+    if(!leftStickShaper.configure(stickCalibration, stickFullScale) ||
+       !rightStickShaper.configure(stickCalibration, stickFullScale) ||
+       !steeringShaper.configure(steeringCalibration, stickFullScale)){
+      Serial.println("Error: the stick calibration is not valid, the motors will not respond to the controller");
+    }
     pinMode(LED_PIN, OUTPUT);
+
+    //This has to run before the control task starts as it drives the motors itself
+    if(PWM_SWEEP_MODE){
+      robotMotors.pwmFrequencySweep(PWM_SWEEP_START_HZ, PWM_SWEEP_END_HZ, PWM_SWEEP_STEP_HZ, PWM_SWEEP_SPEED, PWM_SWEEP_DWELL_MS);
+    }
+
+    //From here on only the control task talks to the motors
+    controlScheduler.begin(robotMotors, CONTROL_RATE);
+
+    if(ENABLE_TELEMETRY){
+      telemetryStream.begin(CONTROL_RATE);
+      controlScheduler.setTelemetry(&telemetryStream);
+    }
+
+    inputLoopMonitor.begin(INPUT_LOOP_PERIOD_MS * 1000);
+
+    MotorsInitTimes motorsInitTimes = robotMotors.getInitTimes();
+    Serial.printf("Startup: BP32 setup %lu us, motor driver %lu us (%s), PWM %lu us, ready at %lu ms\n",
+      (unsigned long) bp32SetupUs, (unsigned long) motorsInitTimes.driverUs, motorsInitTimes.warmStart ? "warm start" : "configured",
+      (unsigned long) motorsInitTimes.pwmUs, (unsigned long) millis());
+
+    lastInputLoopWake = xTaskGetTickCount();
 }
 
 void loop() {
+    inputLoopMonitor.startCycle(micros());
+    uint32_t loopStartUs = LATENCY_NOW();
+
     //This needs to be called during every loop
     //It handles all the gamepad functions
-    BP32.update();
+    {
+      PROFILE_SCOPE(PROFILE_BP32_UPDATE);
+      BP32.update();
+    }
 
     //This if statement handles bluetooth controller inputs
     //It checks if the controller is connected and maps controller inputs to motor speeds
     if (myController && myController->isConnected()) {
         if (myController->isGamepad()) {
-            //Map controller inputs to motor speeds
-            processControllerInputs(myController);
+            //Only new reports are published, so the control task can tell when they stop coming
+            if (myController->hasData()) {
+                uint32_t reportReadUs = LATENCY_NOW();
+                LATENCY_RECORD(LATENCY_BP32_UPDATE, loopStartUs, reportReadUs);
+
+                if(firstInputMs == 0){
+                  firstInputMs = millis();
+                  Serial.printf("Startup: first controller input at %lu ms\n", (unsigned long) firstInputMs);
+                }
+
+                //Map controller inputs to motor speeds
+                processControllerInputs(myController, reportReadUs);
+            }
         }
         else {
-            Serial.printf("Data not available yet\n");
+            LOG_INFO(EVT_CONTROLLER_NOT_READY);
         }
     }
     else{
       //If a controller is not connected then we set the motor speeds to 0
-      robotMotors.setMotorSpeed(LEFT_MOTOR, 0);
-      robotMotors.setMotorSpeed(RIGHT_MOTOR, 0);
+      robotMotors.publishSetpoint(SOURCE_CONTROLLER, 0, 0);
     }
 
-    //This checks for any motor controller faults
-    //If any are detected it will print the error and try to automatically clear the faults
-    robotMotors.checkFaults();
+    //Faults are checked by the control task, so there is nothing to do for them here
 
     //This toggles the LED every loop
-    digitalWrite(LED_PIN, !digitalRead(LED_PIN));
+    {
+      PROFILE_SCOPE(PROFILE_STATUS_LED);
+      digitalWrite(LED_PIN, !digitalRead(LED_PIN));
+    }
+
+    //Print how well both loops are keeping to time every so often
+    if(millis() - lastTimingStatsMs >= TIMING_STATS_PERIOD_MS){
+      PROFILE_SCOPE(PROFILE_STATS_PRINT);
+      lastTimingStatsMs = millis();
+      controlScheduler.printStats();
+      inputLoopMonitor.printStats("Input loop");
+      robotMotors.printInputWatchdogStats();
+#if LATENCY_TRACE
+      latencyTrace.print();
+#endif
+    }
+
+#if LOOP_PROFILER
+    if(Serial.available() > 0 && Serial.read() == PROFILE_SUMMARY_KEY){
+      loopProfiler.print();
+    }
+#endif
+
+    inputLoopMonitor.endCycle(micros());
 
-    //We add a delay of 30 milliseconds for each loop
-    //This means that the loop will run aproximately 30 times per second
-    delay(30);
+    //Wait until the start of the next input period
+    //Unlike delay() this takes into account how long the loop took to run
+    vTaskDelayUntil(&lastInputLoopWake, pdMS_TO_TICKS(INPUT_LOOP_PERIOD_MS));
 }
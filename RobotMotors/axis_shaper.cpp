@@ -0,0 +1,147 @@
+#include "axis_shaper.h"
+
+AxisCalibration defaultAxisCalibration(){
+  AxisCalibration calibration;
+  calibration.rawMin = -400;
+  calibration.rawCentre = 0;
+  calibration.rawMax = 420;
+  calibration.deadbandPermille = 0;
+  calibration.expoPermille = 0;
+  calibration.inverted = false;
+  return calibration;
+}
+
+AxisShaper::AxisShaper(){
+  for(int32_t i = 0; i < AXIS_TABLE_SIZE; i++){
+    table[i] = 0;
+  }
+}
+
+//Maps a raw reading to -AXIS_UNITY..AXIS_UNITY with the deadband and expo applied
+static int32_t normaliseAxis(const AxisCalibration& calibration, int32_t raw){
+  //Calibrate, each side of centre is scaled on its own so an off centre stick still reaches full scale
+  int32_t position;
+  if(raw >= calibration.rawCentre){
+    position = (int32_t)((int64_t)(raw - calibration.rawCentre) * AXIS_UNITY / (calibration.rawMax - calibration.rawCentre));
+  }
+  else{
+    position = -(int32_t)((int64_t)(calibration.rawCentre - raw) * AXIS_UNITY / (calibration.rawCentre - calibration.rawMin));
+  }
+  if(position > AXIS_UNITY){
+    position = AXIS_UNITY;
+  }
+  else if(position < -AXIS_UNITY){
+    position = -AXIS_UNITY;
+  }
+
+  //Deadband, the rest of the travel is stretched so the output still starts from 0 and reaches full scale
+  bool negative = position < 0;
+  int32_t magnitude = negative ? -position : position;
+  int32_t deadband = (int32_t)calibration.deadbandPermille * AXIS_UNITY / 1000;
+  if(magnitude <= deadband){
+    return 0;
+  }
+  magnitude = (int32_t)((int64_t)(magnitude - deadband) * AXIS_UNITY / (AXIS_UNITY - deadband));
+
+  //Expo blends the straight line with its cube: (1 - e) * x + e * x^3
+  int64_t expo = (int64_t)calibration.expoPermille * AXIS_UNITY / 1000;
+  int64_t cube = (int64_t)magnitude * magnitude / AXIS_UNITY * magnitude / AXIS_UNITY;
+  magnitude = (int32_t)(((AXIS_UNITY - expo) * magnitude + expo * cube) / AXIS_UNITY);
+
+  return negative ? -magnitude : magnitude;
+}
+
+bool AxisShaper::configure(const AxisCalibration& calibration, uint32_t fullScaleTicks){
+  if(calibration.rawMin >= calibration.rawCentre || calibration.rawCentre >= calibration.rawMax ||
+     calibration.deadbandPermille >= 1000 || calibration.expoPermille > 1000){
+    return false;
+  }
+
+  for(int32_t i = 0; i < AXIS_TABLE_SIZE; i++){
+    int64_t position = normaliseAxis(calibration, i + AXIS_RAW_MIN);
+    if(calibration.inverted){
+      position = -position;
+    }
+
+    //Round to the nearest tick, away from 0 at the halfway point
+    int64_t scaled = position * fullScaleTicks;
+    table[i] = (int32_t)((scaled >= 0 ? scaled + AXIS_UNITY / 2 : scaled - AXIS_UNITY / 2) / AXIS_UNITY);
+  }
+  return true;
+}
+
+int32_t AxisShaper::shape(int32_t raw) const{
+  if(raw < AXIS_RAW_MIN){
+    raw = AXIS_RAW_MIN;
+  }
+  else if(raw > AXIS_RAW_MAX){
+    raw = AXIS_RAW_MAX;
+  }
+  return table[raw - AXIS_RAW_MIN];
+}
+
+bool testAxisShaper(){
+  AxisShaper shaper;
+  AxisCalibration calibration = defaultAxisCalibration();
+
+  //Straight line: the ends of the calibrated range are full scale and centre is 0
+  if(!shaper.configure(calibration, 1000)){
+    return false;
+  }
+  if(shaper.shape(0) != 0 || shaper.shape(420) != 1000 || shaper.shape(-400) != -1000){
+    return false;
+  }
+  //Past the calibrated range or the axis range it stays at full scale
+  if(shaper.shape(511) != 1000 || shaper.shape(-512) != -1000 || shaper.shape(5000) != 1000 || shaper.shape(-5000) != -1000){
+    return false;
+  }
+  //Halfway each side, 210/420 and 200/400
+  if(shaper.shape(210) != 500 || shaper.shape(-200) != -500){
+    return false;
+  }
+
+  //Deadband: 10% of travel reads as 0 and the output starts from 0 just past it
+  calibration.deadbandPermille = 100;
+  shaper.configure(calibration, 1000);
+  if(shaper.shape(42) != 0 || shaper.shape(-40) != 0 || shaper.shape(420) != 1000){
+    return false;
+  }
+  //Halfway through the remaining travel: 42 + 189 = 231
+  if(shaper.shape(231) != 500 || shaper.shape(44) <= 0 || shaper.shape(44) > 10){
+    return false;
+  }
+
+  //Full expo is a cube, so half stick gives an eighth
+  calibration.deadbandPermille = 0;
+  calibration.expoPermille = 1000;
+  shaper.configure(calibration, 1000);
+  if(shaper.shape(210) != 125 || shaper.shape(-200) != -125 || shaper.shape(420) != 1000){
+    return false;
+  }
+
+  //Inverted, and scaled to a different period
+  calibration.expoPermille = 0;
+  calibration.inverted = true;
+  shaper.configure(calibration, 400);
+  if(shaper.shape(420) != -400 || shaper.shape(-200) != 200){
+    return false;
+  }
+
+  //The table must never step backwards as the stick moves forward
+  calibration = defaultAxisCalibration();
+  calibration.deadbandPermille = 50;
+  calibration.expoPermille = 600;
+  shaper.configure(calibration, 65535);
+  for(int32_t raw = AXIS_RAW_MIN + 1; raw <= AXIS_RAW_MAX; raw++){
+    if(shaper.shape(raw) < shaper.shape(raw - 1)){
+      return false;
+    }
+  }
+
+  //A calibration with centre outside the ends is rejected
+  calibration.rawCentre = 500;
+  if(shaper.configure(calibration, 1000)){
+    return false;
+  }
+  return true;
+}
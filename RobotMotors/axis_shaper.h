@@ -0,0 +1,57 @@
+#ifndef __AXIS_SHAPER__
+#define __AXIS_SHAPER__
+#include <stdint.h>
+
+//Range of a Bluepad32 stick axis
+#define AXIS_RAW_MIN -512
+#define AXIS_RAW_MAX 511
+#define AXIS_TABLE_SIZE (AXIS_RAW_MAX - AXIS_RAW_MIN + 1)
+
+//Fixed point scale used while the table is built, 1.0 is AXIS_UNITY
+#define AXIS_UNITY 32768
+
+//How one stick axis is turned into a motor duty
+struct AxisCalibration {
+  //Raw readings at full reverse, at rest and at full forward
+  int16_t rawMin;
+  int16_t rawCentre;
+  int16_t rawMax;
+
+  //Travel either side of centre that reads as 0, in thousandths of full travel
+  uint16_t deadbandPermille;
+
+  //0 is a straight line, 1000 is fully cubic for finer control around centre
+  uint16_t expoPermille;
+
+  //Swaps forward and reverse
+  bool inverted;
+};
+
+//Calibration matching the old map() call in the sketch, with no deadband or expo
+AxisCalibration defaultAxisCalibration();
+
+//Turns a raw stick axis into a signed PWM duty in ticks with a single table read
+//Calibration, deadband, expo, inversion and output scaling are all worked out when the table is built,
+//using integer maths only, so shape() does no arithmetic beyond a clamp and an index
+class AxisShaper {
+  private:
+    int32_t table[AXIS_TABLE_SIZE];
+
+  public:
+    //Starts with every entry at 0 until configure() is called
+    AxisShaper();
+
+    //Rebuilds the table, fullScaleTicks is the output at full stick, normally the motor's PWM period
+    //Call this again whenever the calibration or the motor's PWM period changes
+    //Returns false and leaves the table alone if the calibration is not in order
+    bool configure(const AxisCalibration& calibration, uint32_t fullScaleTicks);
+
+    //Duty for a raw axis reading, from -fullScaleTicks to fullScaleTicks
+    int32_t shape(int32_t raw) const;
+};
+
+//Works out a few table entries independently and checks the table against them
+//Returns true if they all match
+bool testAxisShaper();
+
+#endif
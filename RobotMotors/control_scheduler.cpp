@@ -0,0 +1,167 @@
+#include "platform.h"
+#include "control_scheduler.h"
+
+#ifdef ARDUINO
+//The timer interrupt needs to find the scheduler without any arguments
+static ControlScheduler* activeScheduler = nullptr;
+#endif
+
+RateMonitor::RateMonitor(){
+  periodUs = 0;
+  started = false;
+  lastStartUs = 0;
+  cycleStartUs = 0;
+  resetStats();
+}
+
+void RateMonitor::begin(uint32_t loopPeriodUs){
+  periodUs = loopPeriodUs;
+  started = false;
+  resetStats();
+}
+
+void RateMonitor::startCycle(uint32_t nowUs){
+  cycleStartUs = nowUs;
+  if(started){
+    uint32_t actualPeriodUs = nowUs - lastStartUs;
+    uint32_t jitterUs = (actualPeriodUs > periodUs) ? (actualPeriodUs - periodUs) : (periodUs - actualPeriodUs);
+    stats.lastJitterUs = jitterUs;
+    if(jitterUs > stats.maxJitterUs){
+      stats.maxJitterUs = jitterUs;
+    }
+  }
+  started = true;
+  lastStartUs = nowUs;
+}
+
+void RateMonitor::endCycle(uint32_t nowUs){
+  uint32_t executionUs = nowUs - cycleStartUs;
+  stats.cycles++;
+  stats.lastExecutionUs = executionUs;
+  if(executionUs > stats.maxExecutionUs){
+    stats.maxExecutionUs = executionUs;
+  }
+  if(executionUs > periodUs){
+    stats.deadlineMisses++;
+  }
+}
+
+void RateMonitor::addMissedCycles(uint32_t missedCycles){
+  stats.deadlineMisses += missedCycles;
+}
+
+LoopTimingStats RateMonitor::getStats(){
+  return stats;
+}
+
+void RateMonitor::resetStats(){
+  stats.cycles = 0;
+  stats.deadlineMisses = 0;
+  stats.lastJitterUs = 0;
+  stats.maxJitterUs = 0;
+  stats.lastExecutionUs = 0;
+  stats.maxExecutionUs = 0;
+}
+
+void RateMonitor::printStats(const char* name){
+  LoopTimingStats current = getStats();
+  Serial.printf("%s: cycles %u, deadline misses %u, jitter %u us (max %u us), execution %u us (max %u us)\n",
+    name, current.cycles, current.deadlineMisses, current.lastJitterUs, current.maxJitterUs,
+    current.lastExecutionUs, current.maxExecutionUs);
+}
+
+ControlScheduler::ControlScheduler(){
+  motors = nullptr;
+  telemetry = nullptr;
+#ifdef ARDUINO
+  taskHandle = nullptr;
+  timer = nullptr;
+#endif
+}
+
+bool ControlScheduler::begin(Motors& motorsToControl, uint32_t rateHz, uint8_t core, uint8_t priority){
+  if(rateHz == 0 || rateHz > 10000){
+    Serial.printf("Error: invalid control rate %u Hz\n", rateHz);
+    return false;
+  }
+
+  motors = &motorsToControl;
+  uint32_t periodUs = 1000000UL / rateHz;
+  monitor.begin(periodUs);
+
+#ifdef ARDUINO
+  activeScheduler = this;
+  if(xTaskCreatePinnedToCore(controlTask, "MotorControl", CONTROL_TASK_STACK_SIZE, this, priority, &taskHandle, core) != pdPASS){
+    Serial.println("Error: could not create the motor control task");
+    return false;
+  }
+
+  //The timer counts in microseconds and fires once per control period
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+  timer = timerBegin(1000000);
+  timerAttachInterrupt(timer, &ControlScheduler::onTimer);
+  timerAlarm(timer, periodUs, true, 0);
+#else
+  timer = timerBegin(CONTROL_TIMER_NUMBER, 80, true);
+  timerAttachInterrupt(timer, &ControlScheduler::onTimer, true);
+  timerAlarmWrite(timer, periodUs, true);
+  timerAlarmEnable(timer);
+#endif
+#else
+  //There is no timer or task on the host, the caller runs runCycle itself
+  (void)core;
+  (void)priority;
+#endif
+  return true;
+}
+
+void ControlScheduler::runCycle(){
+  monitor.startCycle(micros());
+  motors->controlStep();
+  monitor.endCycle(micros());
+
+  if(telemetry != nullptr && telemetry->shouldSample()){
+    TelemetryRecord record;
+    LoopTimingStats stats = monitor.getStats();
+    motors->fillTelemetryRecord(record);
+    record.loopExecutionUs = stats.lastExecutionUs > 0xFFFF ? 0xFFFF : stats.lastExecutionUs;
+    record.loopJitterUs = stats.lastJitterUs > 0xFFFF ? 0xFFFF : stats.lastJitterUs;
+    telemetry->publish(record);
+  }
+}
+
+#ifdef ARDUINO
+void IRAM_ATTR ControlScheduler::onTimer(){
+  BaseType_t higherPriorityTaskWoken = pdFALSE;
+  vTaskNotifyGiveFromISR(activeScheduler->taskHandle, &higherPriorityTaskWoken);
+  if(higherPriorityTaskWoken){
+    portYIELD_FROM_ISR();
+  }
+}
+
+void ControlScheduler::controlTask(void* parameter){
+  ControlScheduler* scheduler = (ControlScheduler*)parameter;
+  for(;;){
+    //Each timer tick adds one to the notification count
+    //If more than one has built up then we missed a tick while the last cycle was running
+    uint32_t pendingTicks = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if(pendingTicks > 1){
+      scheduler->monitor.addMissedCycles(pendingTicks - 1);
+    }
+
+    scheduler->runCycle();
+  }
+}
+#endif
+
+void ControlScheduler::setTelemetry(TelemetryStream* telemetryStream){
+  telemetry = telemetryStream;
+}
+
+LoopTimingStats ControlScheduler::getStats(){
+  return monitor.getStats();
+}
+
+void ControlScheduler::printStats(){
+  monitor.printStats("Control task");
+}
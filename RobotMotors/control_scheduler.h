@@ -0,0 +1,100 @@
+#ifndef __CONTROL_SCHEDULER__
+#define __CONTROL_SCHEDULER__
+#include "platform.h"
+#include "robot_motors.h"
+#include "telemetry_stream.h"
+
+//Default rate that the control task runs Motors::controlStep at
+#define CONTROL_RATE_HZ 1000
+
+//Core 0 runs the Bluetooth controller and BTstack tasks at a higher priority, which would add Bluetooth traffic to the jitter
+//On core 1 the control task is above the Arduino loop, event log and telemetry tasks (all priority 1) so only interrupts delay it,
+//at the cost of pausing controller input handling for each controlStep, see printStats for how long that takes
+//begin() runs from setup() on core 1, so the timer interrupt that wakes the task is on the same core
+#define CONTROL_TASK_CORE 1
+#define CONTROL_TASK_PRIORITY 5
+#define CONTROL_TASK_STACK_SIZE 4096
+
+//Hardware timer used to tick the control task
+#define CONTROL_TIMER_NUMBER 0
+
+//Timing counters published by a fixed rate loop
+struct LoopTimingStats {
+  uint32_t cycles;
+
+  //Cycles that started late or took longer than the period to run
+  uint32_t deadlineMisses;
+
+  //How far the start of the last cycle was from where it should have been
+  uint32_t lastJitterUs;
+  uint32_t maxJitterUs;
+
+  uint32_t lastExecutionUs;
+  uint32_t maxExecutionUs;
+};
+
+//Measures how well a loop keeps to its period
+//Call startCycle at the top of every iteration and endCycle at the bottom
+class RateMonitor {
+  private:
+    uint32_t periodUs;
+    uint32_t lastStartUs;
+    uint32_t cycleStartUs;
+    bool started;
+    LoopTimingStats stats;
+
+  public:
+    RateMonitor();
+
+    void begin(uint32_t loopPeriodUs);
+
+    void startCycle(uint32_t nowUs);
+
+    void endCycle(uint32_t nowUs);
+
+    //Count cycles that never ran, e.g. timer ticks that arrived while the last cycle was still running
+    void addMissedCycles(uint32_t missedCycles);
+
+    LoopTimingStats getStats();
+
+    void resetStats();
+
+    void printStats(const char* name);
+};
+
+//Runs Motors::controlStep from a FreeRTOS task that is woken by a hardware timer
+//This keeps the motor control rate fixed no matter how long the Bluepad32 loop takes
+class ControlScheduler {
+  private:
+    Motors* motors;
+    TelemetryStream* telemetry;
+    RateMonitor monitor;
+
+#ifdef ARDUINO
+    TaskHandle_t taskHandle;
+    hw_timer_t* timer;
+
+    static void IRAM_ATTR onTimer();
+
+    static void controlTask(void* parameter);
+#endif
+
+  public:
+    ControlScheduler();
+
+    //On the ESP32 this starts the timer and control task
+    //On the host it only sets the period, call runCycle to step the control loop
+    bool begin(Motors& motorsToControl, uint32_t rateHz = CONTROL_RATE_HZ, uint8_t core = CONTROL_TASK_CORE, uint8_t priority = CONTROL_TASK_PRIORITY);
+
+    //Runs one control cycle: controlStep, timing and telemetry
+    void runCycle();
+
+    //Record telemetry from the control task, pass nullptr to stop
+    void setTelemetry(TelemetryStream* telemetryStream);
+
+    LoopTimingStats getStats();
+
+    void printStats();
+};
+
+#endif
@@ -0,0 +1,191 @@
+#include "current_calibration.h"
+
+//The original current limit formula, validated on the control board from 0.5A to 10A with a gain of 5:
+//TORQUE = (amps + 4) * 256 * 20 * CURRENT_SHUNT_RESISTANCE / 2.75
+//The datasheet has the limit going down with the gain, so the other gains start scaled from this
+const float DEFAULT_OFFSET_AMPS = -4.0f;
+
+//What is saved in the SettingsStore
+struct CurrentCalibrationRecord {
+  uint32_t version;
+  CurrentCalibrationPoint points[SENSE_GAIN_COUNT];
+};
+
+CurrentCalibration::CurrentCalibration(){
+  setDefaults();
+}
+
+void CurrentCalibration::setDefaults(){
+  float gain5AmpsPerStep = 2.75f / (256.0f * 20.0f * CURRENT_SHUNT_RESISTANCE);
+  for(uint8_t i = 0; i < SENSE_GAIN_COUNT; i++){
+    //Each gain setting doubles the gain
+    points[i].ampsPerStep = gain5AmpsPerStep / (1 << i);
+    points[i].offsetAmps = DEFAULT_OFFSET_AMPS;
+    points[i].measured = (i == GAIN5);
+  }
+}
+
+CurrentCalibrationPoint CurrentCalibration::getPoint(ISGAIN_GAIN gain) const{
+  return points[gain & 0b11];
+}
+
+void CurrentCalibration::setPoint(ISGAIN_GAIN gain, const CurrentCalibrationPoint& point){
+  points[gain & 0b11] = point;
+}
+
+bool CurrentCalibration::calibrateGain(ISGAIN_GAIN gain, uint8_t torqueA, float ampsA, uint8_t torqueB, float ampsB){
+  if(torqueA == torqueB){
+    return false;
+  }
+  float ampsPerStep = (ampsB - ampsA) / ((float)torqueB - (float)torqueA);
+  if(!(ampsPerStep > 0.0f)){
+    return false;
+  }
+  CurrentCalibrationPoint point;
+  point.ampsPerStep = ampsPerStep;
+  point.offsetAmps = ampsA - ampsPerStep * torqueA;
+  point.measured = true;
+  setPoint(gain, point);
+  return true;
+}
+
+bool CurrentCalibration::lookup(float amps, ISGAIN_GAIN& gain, uint8_t& torque) const{
+  bool found = false;
+  float finestStep = 0.0f;
+  for(uint8_t i = 0; i < SENSE_GAIN_COUNT; i++){
+    const CurrentCalibrationPoint& point = points[i];
+    if(!point.measured || (found && point.ampsPerStep >= finestStep)){
+      continue;
+    }
+    //Even a TORQUE of 0 would give more than was asked for
+    if(amps < point.offsetAmps){
+      continue;
+    }
+    float steps = (amps - point.offsetAmps) / point.ampsPerStep;
+    //Rounded down below, so anything under 256 still fits in TORQUE
+    if(steps >= 256.0f){
+      continue;
+    }
+    found = true;
+    finestStep = point.ampsPerStep;
+    gain = (ISGAIN_GAIN)i;
+    torque = (uint8_t)steps;
+  }
+  return found;
+}
+
+float CurrentCalibration::limitFor(ISGAIN_GAIN gain, uint8_t torque) const{
+  const CurrentCalibrationPoint& point = points[gain & 0b11];
+  return point.ampsPerStep * torque + point.offsetAmps;
+}
+
+bool CurrentCalibration::load(SettingsStore& store){
+  CurrentCalibrationRecord record;
+  if(!store.load(CURRENT_CALIBRATION_KEY, &record, sizeof(record)) || record.version != CURRENT_CALIBRATION_VERSION){
+    return false;
+  }
+  //Anything unreadable means the table is not used at all, rather than driving with a nonsense limit
+  bool anyMeasured = false;
+  for(uint8_t i = 0; i < SENSE_GAIN_COUNT; i++){
+    const CurrentCalibrationPoint& point = record.points[i];
+    if(!(point.ampsPerStep > 0.0f && point.ampsPerStep < 1.0f && point.offsetAmps > -100.0f && point.offsetAmps < 100.0f)){
+      return false;
+    }
+    anyMeasured |= point.measured;
+  }
+  if(!anyMeasured){
+    return false;
+  }
+  for(uint8_t i = 0; i < SENSE_GAIN_COUNT; i++){
+    points[i] = record.points[i];
+  }
+  return true;
+}
+
+bool CurrentCalibration::save(SettingsStore& store) const{
+  CurrentCalibrationRecord record;
+  record.version = CURRENT_CALIBRATION_VERSION;
+  for(uint8_t i = 0; i < SENSE_GAIN_COUNT; i++){
+    record.points[i] = points[i];
+  }
+  return store.save(CURRENT_CALIBRATION_KEY, &record, sizeof(record));
+}
+
+void CurrentCalibration::print() const{
+  for(uint8_t i = 0; i < SENSE_GAIN_COUNT; i++){
+    Serial.printf("Gain %2i: %.4f A per step, %.2f A to %.2f A%s\n", 5 << i, points[i].ampsPerStep,
+      limitFor((ISGAIN_GAIN)i, 0), limitFor((ISGAIN_GAIN)i, 255), points[i].measured ? "" : " (not measured)");
+  }
+}
+
+//################## TEST FUNCTIONS #####################
+
+bool testCurrentCalibration(){
+  CurrentCalibration calibration;
+  ISGAIN_GAIN gain;
+  uint8_t torque;
+
+  //Whole amps give the same settings as the original formula
+  for(uint8_t amps = 0; amps <= 20; amps++){
+    uint8_t expectedTorque = (uint8_t)((float(amps + 4.0f) * (256.0f * 20.0 * CURRENT_SHUNT_RESISTANCE))/2.75f);
+    if(!calibration.lookup(amps, gain, torque) || gain != GAIN5 || torque != expectedTorque){
+      return false;
+    }
+  }
+
+  //Fractional amps round down to the step below
+  if(!calibration.lookup(10.5f, gain, torque) || torque != 67 || calibration.limitFor(gain, torque) > 10.5f){
+    return false;
+  }
+
+  //A measured gain of 20 with 0.0625A steps is used up to the 14.8A it reaches, the gain of 5 above that
+  if(calibration.calibrateGain(GAIN20, 50, 2.0f, 50, 3.0f) || calibration.calibrateGain(GAIN20, 50, 2.0f, 200, 1.0f)){
+    return false;
+  }
+  if(!calibration.calibrateGain(GAIN20, 50, 2.0f, 200, 11.375f)){
+    return false;
+  }
+  if(!calibration.lookup(5.0f, gain, torque) || gain != GAIN20 || torque != 98){
+    return false;
+  }
+  if(!calibration.lookup(15.0f, gain, torque) || gain != GAIN5){
+    return false;
+  }
+
+  //A gain of 40 measured with a 1A offset is finer still, but can't go below 1A, so the gain of 20 is used under that
+  if(!calibration.calibrateGain(GAIN40, 0, 1.0f, 128, 2.0f)){
+    return false;
+  }
+  if(!calibration.lookup(1.5f, gain, torque) || gain != GAIN40 || torque != 64){
+    return false;
+  }
+  if(!calibration.lookup(0.5f, gain, torque) || gain != GAIN20 || calibration.limitFor(gain, torque) > 0.5f){
+    return false;
+  }
+  //With only that gain measured nothing reaches 0.5A
+  CurrentCalibration offsetOnly;
+  CurrentCalibrationPoint unmeasured = offsetOnly.getPoint(GAIN5);
+  unmeasured.measured = false;
+  offsetOnly.setPoint(GAIN5, unmeasured);
+  offsetOnly.setPoint(GAIN40, calibration.getPoint(GAIN40));
+  if(offsetOnly.lookup(0.5f, gain, torque)){
+    return false;
+  }
+
+#ifndef ARDUINO
+  //Saving and loading, on the host only so the board's own table is left alone
+  HostSettingsStore store;
+  CurrentCalibration loaded;
+  if(loaded.load(store) || !calibration.save(store) || !loaded.load(store) || !loaded.getPoint(GAIN20).measured){
+    return false;
+  }
+  //A table saved by other code is ignored
+  uint32_t wrongSize = CURRENT_CALIBRATION_VERSION;
+  store.save(CURRENT_CALIBRATION_KEY, &wrongSize, sizeof(wrongSize));
+  CurrentCalibration untouched;
+  if(untouched.load(store) || untouched.getPoint(GAIN20).measured){
+    return false;
+  }
+#endif
+  return true;
+}
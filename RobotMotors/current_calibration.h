@@ -0,0 +1,65 @@
+#ifndef __CURRENT_CALIBRATION__
+#define __CURRENT_CALIBRATION__
+#include "platform.h"
+#include "hal.h"
+#include "drv8711.h"
+
+//One for each ISGAIN_GAIN
+#define SENSE_GAIN_COUNT 4
+
+//Key the table is saved under in the SettingsStore
+#define CURRENT_CALIBRATION_KEY "currentCal"
+
+//Change this if CurrentCalibrationPoint changes, so a table saved by older code is ignored instead of misread
+#define CURRENT_CALIBRATION_VERSION 1
+
+//The current limit each TORQUE setting gives at one sense amplifier gain, as a straight line:
+//amps = ampsPerStep * TORQUE + offsetAmps
+struct CurrentCalibrationPoint {
+  float ampsPerStep;
+  float offsetAmps;
+
+  //Only measured gains are used for the current limit
+  bool measured;
+};
+
+//Turns a current limit in amps into the DRV8711's ISGAIN and TORQUE settings
+//A higher gain gives finer steps but a lower highest limit, so lookup picks the measured gain with the finest steps that reaches the limit
+//Out of the box only the gain of 5 is measured, the others are scaled from it by their gain and need measuring on the bench first
+class CurrentCalibration {
+  private:
+    CurrentCalibrationPoint points[SENSE_GAIN_COUNT];
+
+  public:
+    CurrentCalibration();
+
+    //Goes back to the built in table
+    void setDefaults();
+
+    CurrentCalibrationPoint getPoint(ISGAIN_GAIN gain) const;
+
+    void setPoint(ISGAIN_GAIN gain, const CurrentCalibrationPoint& point);
+
+    //Fits one gain's line through two current limits measured on the bench and marks it as measured
+    //Returns false, leaving the table as it was, if the torques are the same or the current does not rise with torque
+    bool calibrateGain(ISGAIN_GAIN gain, uint8_t torqueA, float ampsA, uint8_t torqueB, float ampsB);
+
+    //Finds the gain and TORQUE for a current limit, rounding down so the limit is never above the one asked for
+    //Returns false if no measured gain can be set to it or below it
+    bool lookup(float amps, ISGAIN_GAIN& gain, uint8_t& torque) const;
+
+    //The current limit a gain and TORQUE give
+    float limitFor(ISGAIN_GAIN gain, uint8_t torque) const;
+
+    //Returns false and keeps the table as it is if nothing valid has been saved
+    bool load(SettingsStore& store);
+
+    bool save(SettingsStore& store) const;
+
+    void print() const;
+};
+
+//Checks the default table matches the original current limit formula, and that lookup, calibration and saving work
+bool testCurrentCalibration();
+
+#endif
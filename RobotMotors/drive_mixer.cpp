@@ -0,0 +1,148 @@
+#include "drive_mixer.h"
+
+DriveMixer::DriveMixer(){
+  mode.store(MIX_TANK);
+  inverted.store(false);
+  inputFullScale = 1000;
+  outputFullScale[LEFT_MOTOR] = 1000;
+  outputFullScale[RIGHT_MOTOR] = 1000;
+}
+
+bool DriveMixer::configure(int32_t inputScale, int32_t leftOutputScale, int32_t rightOutputScale){
+  if(inputScale <= 0 || leftOutputScale <= 0 || rightOutputScale <= 0){
+    return false;
+  }
+  inputFullScale = inputScale;
+  outputFullScale[LEFT_MOTOR] = leftOutputScale;
+  outputFullScale[RIGHT_MOTOR] = rightOutputScale;
+  return true;
+}
+
+void DriveMixer::setMode(DRIVE_MIX_MODE mixMode){
+  mode.store((uint8_t)mixMode, std::memory_order_relaxed);
+}
+
+DRIVE_MIX_MODE DriveMixer::getMode(){
+  return (DRIVE_MIX_MODE)mode.load(std::memory_order_relaxed);
+}
+
+void DriveMixer::setInverted(bool invert){
+  inverted.store(invert, std::memory_order_relaxed);
+}
+
+void DriveMixer::toggleInverted(){
+  //Only the task handling the controller toggles this, so a plain read then write is enough
+  inverted.store(!inverted.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+bool DriveMixer::isInverted(){
+  return inverted.load(std::memory_order_relaxed);
+}
+
+static int32_t clampToScale(int32_t value, int32_t fullScale){
+  if(value > fullScale){
+    return fullScale;
+  }
+  if(value < -fullScale){
+    return -fullScale;
+  }
+  return value;
+}
+
+void DriveMixer::mix(int32_t firstInput, int32_t secondInput, int32_t& leftOutput, int32_t& rightOutput){
+  firstInput = clampToScale(firstInput, inputFullScale);
+  secondInput = clampToScale(secondInput, inputFullScale);
+
+  int32_t left;
+  int32_t right;
+  if(mode.load(std::memory_order_relaxed) == MIX_ARCADE){
+    left = firstInput + secondInput;
+    right = firstInput - secondInput;
+
+    //Scale both sides by the same amount so their ratio, and so the turn, is kept
+    int32_t largest = (left < 0) ? -left : left;
+    int32_t rightMagnitude = (right < 0) ? -right : right;
+    if(rightMagnitude > largest){
+      largest = rightMagnitude;
+    }
+    if(largest > inputFullScale){
+      left = (int32_t)((int64_t)left * inputFullScale / largest);
+      right = (int32_t)((int64_t)right * inputFullScale / largest);
+    }
+  }
+  else{
+    left = firstInput;
+    right = secondInput;
+  }
+
+  //Upside down the motors are mirrored, so each side takes the other's command reversed
+  if(inverted.load(std::memory_order_relaxed)){
+    int32_t flippedLeft = -right;
+    right = -left;
+    left = flippedLeft;
+  }
+
+  //Both are normally the same PWM period, so skip the divide when there is nothing to scale
+  if(outputFullScale[LEFT_MOTOR] != inputFullScale){
+    left = (int32_t)((int64_t)left * outputFullScale[LEFT_MOTOR] / inputFullScale);
+  }
+  if(outputFullScale[RIGHT_MOTOR] != inputFullScale){
+    right = (int32_t)((int64_t)right * outputFullScale[RIGHT_MOTOR] / inputFullScale);
+  }
+  leftOutput = left;
+  rightOutput = right;
+}
+
+static bool mixMatches(DriveMixer& mixer, int32_t first, int32_t second, int32_t expectedLeft, int32_t expectedRight){
+  int32_t left;
+  int32_t right;
+  mixer.mix(first, second, left, right);
+  return left == expectedLeft && right == expectedRight;
+}
+
+bool testDriveMixer(){
+  DriveMixer mixer;
+  mixer.configure(1000, 1000, 1000);
+
+  //Tank passes straight through and clamps to full scale
+  if(!mixMatches(mixer, 300, -700, 300, -700) || !mixMatches(mixer, 1500, -1500, 1000, -1000)){
+    return false;
+  }
+
+  //Arcade: throttle only, steer only, and a gentle turn
+  mixer.setMode(MIX_ARCADE);
+  if(!mixMatches(mixer, 500, 0, 500, 500) || !mixMatches(mixer, 0, 400, 400, -400) || !mixMatches(mixer, 500, 200, 700, 300)){
+    return false;
+  }
+  //Full throttle and half steer would be 1500 and 500, scaled down together that is 1000 and 333
+  if(!mixMatches(mixer, 1000, 500, 1000, 333) || !mixMatches(mixer, -1000, -500, -1000, -333)){
+    return false;
+  }
+  //Full throttle and full steer spins one side only
+  if(!mixMatches(mixer, 1000, 1000, 1000, 0)){
+    return false;
+  }
+
+  //Inverted swaps the sides and reverses them
+  mixer.setInverted(true);
+  if(!mixMatches(mixer, 500, 200, -300, -700)){
+    return false;
+  }
+  mixer.toggleInverted();
+  if(mixer.isInverted()){
+    return false;
+  }
+
+  //Outputs scaled to motors with different PWM periods
+  mixer.setMode(MIX_TANK);
+  mixer.configure(1000, 400, 2000);
+  if(!mixMatches(mixer, 500, -500, 200, -1000)){
+    return false;
+  }
+
+  //Bad scales are refused
+  if(mixer.configure(0, 1000, 1000)){
+    return false;
+  }
+  return true;
+}
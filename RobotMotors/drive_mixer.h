@@ -0,0 +1,56 @@
+#ifndef __DRIVE_MIXER__
+#define __DRIVE_MIXER__
+#include <stdint.h>
+#include <atomic>
+#include "motor_types.h"
+
+//How the two drive inputs are turned into left and right motor duties
+enum DRIVE_MIX_MODE {
+    //First input drives the left motor, second drives the right
+    MIX_TANK = 0,
+    //First input is throttle, second is steering with positive turning right
+    MIX_ARCADE = 1
+};
+
+//Turns two drive inputs into left and right motor duties
+//Inputs run from -inputFullScale to inputFullScale, e.g. the output of an AxisShaper,
+//and each output is scaled to its motor's full scale, e.g. its PWM period in ticks
+//mix() does a fixed amount of integer work and never allocates, so it can run on the control task
+//The mode and invert setting can be changed from another task while it runs
+class DriveMixer {
+  private:
+    std::atomic<uint8_t> mode;
+    std::atomic<bool> inverted;
+    int32_t inputFullScale;
+    int32_t outputFullScale[MOTOR_COUNT];
+
+  public:
+    //Tank mode, not inverted, with inputs and outputs both at a full scale of 1000
+    DriveMixer();
+
+    //Sets the input full scale and the full scale of each motor's output
+    //Returns false and changes nothing if any of them are not above 0
+    bool configure(int32_t inputScale, int32_t leftOutputScale, int32_t rightOutputScale);
+
+    void setMode(DRIVE_MIX_MODE mixMode);
+
+    DRIVE_MIX_MODE getMode();
+
+    //For driving upside down: forward becomes backward and the left and right motors swap
+    void setInverted(bool invert);
+
+    void toggleInverted();
+
+    bool isInverted();
+
+    //Mixes one pair of inputs into left and right duties
+    //In arcade mode a turn that would push one side past full scale scales both sides down together,
+    //so the robot keeps the same turning radius instead of driving straighter than asked
+    void mix(int32_t firstInput, int32_t secondInput, int32_t& leftOutput, int32_t& rightOutput);
+};
+
+//Checks each mode, the saturation handling, inversion and output scaling against worked examples
+//Returns true if they all match
+bool testDriveMixer();
+
+#endif
@@ -1,398 +1,430 @@
-#include <Arduino.h>
-#include <SPI.h>
+#include "platform.h"
 #include "drv8711.h"
+#include "drv8711_profile.h"
+#include "event_log.h"
 #include <bitset>
 
-// Define SPI Pins
-const int CS_PIN = 5; // Chip Select (CS) pin
 const float CURRENT_SHUNT_RESISTANCE = 0.0025;
 const float MOSFET_GATE_CHARGE_IN_NC = 30;
 
-SPIClass DRVSPI(VSPI);
-
-DRV8711::DRV8711(){
+//Power on reset values of each register, taken from the DRV8711 datasheet
+const uint16_t DRV8711_RESET_VALUES[DRV8711_REGISTER_COUNT] = {
+  0xC10, 0x1FF, 0x030, 0x080, 0x110, 0x040, 0xA59, 0x000
+};
+
+//Order the configuration registers are written in when all of them are
+//CTRL goes last so ENBL only turns the bridges on once TORQUE and the rest are set, TORQUE resets to the highest current
+const uint8_t CONFIG_WRITE_ORDER[DRV8711_CONFIG_REGISTER_COUNT] = {
+  TORQUE_REG_ADDR, OFF_REG_ADDR, BLANK_REG_ADDR, DECAY_REG_ADDR, STALL_REG_ADDR, DRIVE_REG_ADDR, CTRL_REG_ADDR
+};
+
+DRV8711::DRV8711(SpiBus& spiBus, uint8_t chipSelectPin, uint8_t sleepPin){
+  bus = &spiBus;
+  csPin = chipSelectPin;
+  nSleepPin = sleepPin;
+  for(uint8_t i = 0; i < DRV8711_REGISTER_COUNT; i++){
+    shadowRegisters[i] = DRV8711_RESET_VALUES[i];
+  }
+  lastStatus = DriverStatus::decode(0);
+  for(uint8_t i = 0; i < DRV8711_CONFIG_REGISTER_COUNT; i++){
+    readbackRegisters[i] = 0;
+  }
 }
 
-void DRV8711::init(){
+bool DRV8711::init(){
   // Initialize SPI
-  pinMode(19, INPUT_PULLUP);
+  bus->begin();
 
-  DRVSPI.begin();
-  DRVSPI.beginTransaction(SPISettings(1000000, MSBFIRST, SPI_MODE0));
-  pinMode(19, INPUT_PULLUP);
+  // Initialize Chip Select pin
+  bus->addDevice(csPin);
 
-    // Initialize Chip Select pin
-  pinMode(CS_PIN, OUTPUT);
-  digitalWrite(CS_PIN, LOW); // Set CS pin high (inactive)
+  pinMode(nSleepPin, OUTPUT);
 
-  pinMode(4, OUTPUT);
-
-  digitalWrite(4, HIGH);
+  digitalWrite(nSleepPin, HIGH);
 
   pinMode(34, INPUT_PULLUP);
+
+  //nSLEEP is low while the ESP32 resets, so the chip has only just woken up
+  delay(DRV8711_WAKE_TIME_MS);
+
+  //Load the shadow registers from the chip so the setters start from its real state
+  if(!resync()){
+    Serial.println("Warning: could not read motor driver registers, using reset values");
+    return false;
+  }
+  return true;
 }
 
-void DRV8711::writeRegister(uint8_t regAddress, uint16_t data) {
+uint16_t DRV8711::writeFrame(uint8_t regAddress, uint16_t data) {
     uint16_t spiData = ((regAddress & 0x07) << 12) | (data & 0x0FFF);
-    spiData &= ~(1 << 15);
+    return spiData & ~(1 << 15);
+}
 
-    // Select the SPI device (CS pin low)
-    digitalWrite(CS_PIN, HIGH);
+uint16_t DRV8711::readFrame(uint8_t regAddress) {
+    uint16_t spiData = ((regAddress & 0x07) << 12);
+    return spiData | (1 << 15);
+}
 
+SpiBus* DRV8711::getBus() {
+  return bus;
+}
+
+uint8_t DRV8711::getChipSelectPin() {
+  return csPin;
+}
+
+void DRV8711::writeRegister(uint8_t regAddress, uint16_t data) {
     // Send data to the DRV8711
-    DRVSPI.transfer16(spiData);
+    bus->transfer16(csPin, writeFrame(regAddress, data));
 
-    // Deselect the SPI device (CS pin high)
-    digitalWrite(CS_PIN, LOW);
+    // Keep the shadow copy in step with what the chip was sent
+    shadowRegisters[regAddress & 0x07] = data & 0x0FFF;
 }
 
 uint16_t DRV8711::readRegister(uint8_t regAddress) {
-    uint16_t spiData = ((regAddress & 0x07) << 12);
-    spiData |= (1 << 15);
-
-    // Select the SPI device (CS pin low)
-    digitalWrite(CS_PIN, HIGH);
+    uint16_t spiData = readFrame(regAddress);
 
     // Serial.print("Sending ");
     // printUINT16Binary(spiData);
 
     // Send address to initiate read and receive data
-    uint16_t readData = DRVSPI.transfer16(spiData);
+    uint16_t readData = bus->transfer16(csPin, spiData);
 
     // Serial.print("Recieved ");
     // printUINT16Binary(readData);
 
-    // Deselect the SPI device (CS pin high)
-    digitalWrite(CS_PIN, LOW);
-
     // Extract the 12 bits of data received
     return readData & 0x0FFF;
 }
 
-void DRV8711::setMotorEnabled(bool enableOrDisable) {
-  // Read the current value of CTRL register
-  uint16_t ctrlRegValue = readRegister(CTRL_REG_ADDR);
+void DRV8711::modifyRegister(uint8_t regAddress, uint16_t fieldMask, uint16_t fieldValue) {
+  uint16_t regValue = (shadowRegisters[regAddress & 0x07] & ~fieldMask) | (fieldValue & fieldMask);
 
-  // Set or clear the ENBL bit based on enableOrDisable
-  if (enableOrDisable) {
-    ctrlRegValue |= (1 << CTRL_ENBL_BIT); // Set ENBL bit
-  } else {
-    ctrlRegValue &= ~(1 << CTRL_ENBL_BIT); // Clear ENBL bit
+  //The shadow already holds what the chip has, so there is nothing to send
+  if(regValue == shadowRegisters[regAddress & 0x07]){
+    return;
   }
 
-  // Write back the modified value to CTRL register
-  writeRegister(CTRL_REG_ADDR, ctrlRegValue);
+  writeRegister(regAddress, regValue);
 }
 
-void DRV8711::setSenseAmplifierGain(ISGAIN_GAIN gain) {
-    if(gain > 3){
-        Serial.printf("Invalid amplifier gain provided\n");
-        return;
-    }
-
-    // Read the current value of CTRL register
-    uint16_t ctrlRegValue = readRegister(CTRL_REG_ADDR);
+uint16_t DRV8711::getShadowRegister(uint8_t regAddress) {
+  return shadowRegisters[regAddress & 0x07];
+}
 
-    // Clear the ISGAIN bits (bits 9-8)
-    ctrlRegValue &= ~(0b11 << CTRL_ISGAIN_BIT);
+bool DRV8711::resync() {
+  uint16_t regValues[DRV8711_CONFIG_REGISTER_COUNT];
+  bool allOnes = true;
+  for(uint8_t regAddress = CTRL_REG_ADDR; regAddress < DRV8711_CONFIG_REGISTER_COUNT; regAddress++){
+    regValues[regAddress] = readRegister(regAddress);
+    allOnes &= (regValues[regAddress] == 0xFFF);
+  }
 
-    // Set the new gain value
-    ctrlRegValue |= ((gain & 0b11) << CTRL_ISGAIN_BIT);
+  //If every register reads as all 1s then nothing is driving the bus
+  //so we keep the current shadow rather than filling it with junk
+  if(allOnes){
+    return false;
+  }
 
-    // Write back the modified value to CTRL register
-    writeRegister(CTRL_REG_ADDR, ctrlRegValue);
+  for(uint8_t regAddress = CTRL_REG_ADDR; regAddress < DRV8711_CONFIG_REGISTER_COUNT; regAddress++){
+    shadowRegisters[regAddress] = regValues[regAddress];
+  }
+  return true;
 }
 
-void DRV8711::setDeadTime(ISGAIN_DTIME deadTimeSetting) {
-  // Read the current value of CTRL register
-  uint16_t ctrlRegValue = readRegister(CTRL_REG_ADDR);
-
-  // Clear the DTIME bits (bits 11-10)
-  ctrlRegValue &= ~(0b11 << CTRL_DTIME_BIT);
+bool DRV8711::verify() {
+  bool registersMatch = true;
+  for(uint8_t regAddress = CTRL_REG_ADDR; regAddress < DRV8711_CONFIG_REGISTER_COUNT; regAddress++){
+    uint16_t regValue = readRegister(regAddress);
+    if(regValue != shadowRegisters[regAddress]){
+      LOG_ERROR(EVT_REGISTER_MISMATCH, regAddress, shadowRegisters[regAddress], regValue);
+      registersMatch = false;
+    }
+  }
+  return registersMatch;
+}
 
-  // Set the new dead time value
-  ctrlRegValue |= ((deadTimeSetting & 0b11) << CTRL_DTIME_BIT);
+void DRV8711::restoreRegisters() {
+  for(uint8_t i = 0; i < DRV8711_CONFIG_REGISTER_COUNT; i++){
+    writeRegister(CONFIG_WRITE_ORDER[i], shadowRegisters[CONFIG_WRITE_ORDER[i]]);
+  }
+}
 
-  // Write back the modified value to CTRL register
-  writeRegister(CTRL_REG_ADDR, ctrlRegValue);
+int8_t DRV8711::queueStatusRead(SpiBatch& batch, bool readBackConfig) {
+  uint8_t frames = readBackConfig ? 1 + DRV8711_CONFIG_REGISTER_COUNT : 1;
+  if(batch.frameCount + frames > SPI_BATCH_MAX_FRAMES){
+    return -1;
+  }
+  int8_t statusFrame = batch.add(csPin, readFrame(STATUS_REG_ADDR));
+  if(readBackConfig){
+    for(uint8_t regAddress = CTRL_REG_ADDR; regAddress < DRV8711_CONFIG_REGISTER_COUNT; regAddress++){
+      batch.add(csPin, readFrame(regAddress));
+    }
+  }
+  return statusFrame;
 }
 
-void DRV8711::setTorque(uint8_t torque) {
-  // Read the current value of CTRL register
-  uint16_t ctrlRegValue = readRegister(TORQUE_REG_ADDR);
+bool DRV8711::queueProfile(SpiBatch& batch, const DRV8711Profile& profile) {
+  if(batch.frameCount + DRV8711_CONFIG_REGISTER_COUNT > SPI_BATCH_MAX_FRAMES){
+    return false;
+  }
+  for(uint8_t i = 0; i < DRV8711_CONFIG_REGISTER_COUNT; i++){
+    uint8_t regAddress = CONFIG_WRITE_ORDER[i];
+    batch.add(csPin, writeFrame(regAddress, profile.getRegister(regAddress)));
+    shadowRegisters[regAddress] = profile.getRegister(regAddress);
+  }
+  return true;
+}
 
-  // Clear the DTIME bits (bits 11-10)
-  ctrlRegValue &= ~(0b11111111 << TORQUE_TORQUE_BIT);
+bool DRV8711::queueDecayMode(SpiBatch& batch, DECAYMODE decayMode) {
+  uint16_t decayValue = (shadowRegisters[DECAY_REG_ADDR] & ~(0b111 << DECAY_DECMOD_BIT)) | ((decayMode & 0b111) << DECAY_DECMOD_BIT);
+  if(decayValue == shadowRegisters[DECAY_REG_ADDR]){
+    return true;
+  }
+  if(batch.add(csPin, writeFrame(DECAY_REG_ADDR, decayValue)) < 0){
+    return false;
+  }
+  shadowRegisters[DECAY_REG_ADDR] = decayValue;
+  return true;
+}
 
-  // Set the new dead time value
-  ctrlRegValue |= ((torque & 0b11111111) << TORQUE_TORQUE_BIT);
+bool DRV8711::queueClearFaults(SpiBatch& batch, uint16_t faultMask, bool restore) {
+  uint8_t frames = restore ? 1 + DRV8711_CONFIG_REGISTER_COUNT : 1;
+  if(batch.frameCount + frames > SPI_BATCH_MAX_FRAMES){
+    return false;
+  }
+  //Same write as clearFaults, a 0 clears a latched bit and a 1 leaves it alone
+  uint16_t statusValue = ~faultMask & STATUS_FAULT_MASK;
+  batch.add(csPin, writeFrame(STATUS_REG_ADDR, statusValue));
+  shadowRegisters[STATUS_REG_ADDR] = statusValue;
+  if(restore){
+    for(uint8_t i = 0; i < DRV8711_CONFIG_REGISTER_COUNT; i++){
+      batch.add(csPin, writeFrame(CONFIG_WRITE_ORDER[i], shadowRegisters[CONFIG_WRITE_ORDER[i]]));
+    }
+  }
+  return true;
+}
 
-  // Write back the modified value to CTRL register
-  writeRegister(TORQUE_REG_ADDR, ctrlRegValue);
+void DRV8711::takeStatusRead(const SpiBatch& batch, int8_t statusFrame, bool readBackConfig) {
+  lastStatus = DriverStatus::decode(batch.rxFrames[statusFrame] & 0x0FFF);
+  if(readBackConfig){
+    for(uint8_t regAddress = CTRL_REG_ADDR; regAddress < DRV8711_CONFIG_REGISTER_COUNT; regAddress++){
+      readbackRegisters[regAddress] = batch.rxFrames[statusFrame + 1 + regAddress] & 0x0FFF;
+    }
+  }
 }
 
-void DRV8711::setTOFF(uint8_t toffX500ns) {
-  // Read the current value of CTRL register
-  uint16_t ctrlRegValue = readRegister(OFF_REG_ADDR);
+bool DRV8711::verifyReadback() {
+  bool registersMatch = true;
+  for(uint8_t regAddress = CTRL_REG_ADDR; regAddress < DRV8711_CONFIG_REGISTER_COUNT; regAddress++){
+    if(readbackRegisters[regAddress] != shadowRegisters[regAddress]){
+      LOG_ERROR(EVT_REGISTER_MISMATCH, regAddress, shadowRegisters[regAddress], readbackRegisters[regAddress]);
+      registersMatch = false;
+    }
+  }
+  return registersMatch;
+}
 
-  // Clear the DTIME bits (bits 11-10)
-  ctrlRegValue &= ~(0b11111111 << OFF_TOFF_BIT);
+void DRV8711::setMotorEnabled(bool enableOrDisable) {
+  // Set or clear the ENBL bit based on enableOrDisable
+  modifyRegister(CTRL_REG_ADDR, 1 << CTRL_ENBL_BIT, (enableOrDisable ? 1 : 0) << CTRL_ENBL_BIT);
+}
 
-  // Set the new dead time value
-  ctrlRegValue |= ((toffX500ns & 0b11111111) << OFF_TOFF_BIT);
+void DRV8711::setSenseAmplifierGain(ISGAIN_GAIN gain) {
+    if(gain > 3){
+        Serial.printf("Invalid amplifier gain provided\n");
+        return;
+    }
 
-  // Write back the modified value to CTRL register
-  writeRegister(OFF_REG_ADDR, ctrlRegValue);
+    // Replace the ISGAIN bits (bits 9-8) with the new gain value
+    modifyRegister(CTRL_REG_ADDR, 0b11 << CTRL_ISGAIN_BIT, (gain & 0b11) << CTRL_ISGAIN_BIT);
 }
 
-void DRV8711::setPWMMode(PWMMODE pwmmode) {
-  // Read the current value of CTRL register
-  uint16_t ctrlRegValue = readRegister(OFF_REG_ADDR);
+void DRV8711::setDeadTime(ISGAIN_DTIME deadTimeSetting) {
+  // Replace the DTIME bits (bits 11-10) with the new dead time value
+  modifyRegister(CTRL_REG_ADDR, 0b11 << CTRL_DTIME_BIT, (deadTimeSetting & 0b11) << CTRL_DTIME_BIT);
+}
 
-  // Clear the DTIME bits (bits 11-10)
-  ctrlRegValue &= ~(0b11111111 << OFF_PWMMODE_BIT);
+void DRV8711::setTorque(uint8_t torque) {
+  // Replace the TORQUE bits (bits 7-0) with the new torque value
+  modifyRegister(TORQUE_REG_ADDR, 0b11111111 << TORQUE_TORQUE_BIT, (torque & 0b11111111) << TORQUE_TORQUE_BIT);
+}
 
-  // Set the new dead time value
-  ctrlRegValue |= ((pwmmode & 0b11111111) << OFF_PWMMODE_BIT);
+void DRV8711::setTOFF(uint8_t toffX500ns) {
+  // Replace the TOFF bits (bits 7-0) with the new off time
+  modifyRegister(OFF_REG_ADDR, 0b11111111 << OFF_TOFF_BIT, (toffX500ns & 0b11111111) << OFF_TOFF_BIT);
+}
 
-  // Write back the modified value to CTRL register
-  writeRegister(OFF_REG_ADDR, ctrlRegValue);
+void DRV8711::setPWMMode(PWMMODE pwmmode) {
+  // Replace the PWMMODE bits with the new mode
+  modifyRegister(OFF_REG_ADDR, 0b1 << OFF_PWMMODE_BIT, (pwmmode & 0b1) << OFF_PWMMODE_BIT);
 }
 
 void DRV8711::setBlankingTime(uint8_t timeX20nsPlus1us) {
-  // Read the current value of CTRL register
-  uint16_t ctrlRegValue = readRegister(BLANK_REG_ADDR);
-
-  // Clear the DTIME bits (bits 11-10)
-  ctrlRegValue &= ~(0b11111111 << BLANK_TBLANK_BIT);
-
-  // Set the new dead time value
-  ctrlRegValue |= ((timeX20nsPlus1us & 0b11111111) << BLANK_TBLANK_BIT);
-
-  // Write back the modified value to CTRL register
-  writeRegister(BLANK_REG_ADDR, ctrlRegValue);
+  // Replace the TBLANK bits (bits 7-0) with the new blanking time
+  modifyRegister(BLANK_REG_ADDR, 0b11111111 << BLANK_TBLANK_BIT, (timeX20nsPlus1us & 0b11111111) << BLANK_TBLANK_BIT);
 }
 
 void DRV8711::setAdaptiveBlankingMode(bool enabled) {
-  // Read the current value of CTRL register
-  uint16_t ctrlRegValue = readRegister(BLANK_TBLANK_BIT);
-
-  // Clear the DTIME bits (bits 11-10)
-  ctrlRegValue &= ~(0b1 << BLANK_ADAPTIVE_BLANKING_BIT);
-
-  // Set the new dead time value
-  ctrlRegValue |= ((enabled & 0b1) << BLANK_ADAPTIVE_BLANKING_BIT);
-
-  // Write back the modified value to CTRL register
-  writeRegister(BLANK_TBLANK_BIT, ctrlRegValue);
+  // Replace the ABT bit with the new adaptive blanking setting
+  modifyRegister(BLANK_REG_ADDR, 0b1 << BLANK_ADAPTIVE_BLANKING_BIT, (enabled & 0b1) << BLANK_ADAPTIVE_BLANKING_BIT);
 }
 
 void DRV8711::setDecayTime(uint8_t decayTimeX500ns) {
-  // Read the current value of CTRL register
-  uint16_t ctrlRegValue = readRegister(DECAY_REG_ADDR);
-
-  // Clear the DTIME bits (bits 11-10)
-  ctrlRegValue &= ~(0b11111111 << DECAY_TDECAY_BIT);
-
-  // Set the new dead time value
-  ctrlRegValue |= ((decayTimeX500ns & 0b11111111) << DECAY_TDECAY_BIT);
-
-  // Write back the modified value to CTRL register
-  writeRegister(DECAY_REG_ADDR, ctrlRegValue);
+  // Replace the TDECAY bits (bits 7-0) with the new decay time
+  modifyRegister(DECAY_REG_ADDR, 0b11111111 << DECAY_TDECAY_BIT, (decayTimeX500ns & 0b11111111) << DECAY_TDECAY_BIT);
 }
 
 void DRV8711::setDecayMode(DECAYMODE decayMode) {
-  // Read the current value of CTRL register
-  uint16_t ctrlRegValue = readRegister(DECAY_REG_ADDR);
-
-  // Clear the DTIME bits (bits 11-10)
-  ctrlRegValue &= ~(0b111 << DECAY_DECMOD_BIT);
-
-  // Set the new dead time value
-  ctrlRegValue |= ((decayMode & 0b111) << DECAY_DECMOD_BIT);
-
-  // Write back the modified value to CTRL register
-  writeRegister(DECAY_REG_ADDR, ctrlRegValue);
+  // Replace the DECMOD bits (bits 10-8) with the new decay mode
+  modifyRegister(DECAY_REG_ADDR, 0b111 << DECAY_DECMOD_BIT, (decayMode & 0b111) << DECAY_DECMOD_BIT);
 }
 
 void DRV8711::setOverCurrentProtectionThreshold(OCP_THRESHOLD ocpThreshold) {
-  // Read the current value of CTRL register
-  uint16_t ctrlRegValue = readRegister(DRIVE_REG_ADDR);
-
-  // Clear the DTIME bits (bits 11-10)
-  ctrlRegValue &= ~(0b11 << DRIVE_OVERCURRENT_BIT);
-
-  // Set the new dead time value
-  ctrlRegValue |= ((ocpThreshold & 0b11) << DRIVE_OVERCURRENT_BIT);
-
-  // Write back the modified value to CTRL register
-  writeRegister(DRIVE_REG_ADDR, ctrlRegValue);
+  // Replace the OCPTH bits (bits 1-0) with the new threshold
+  modifyRegister(DRIVE_REG_ADDR, 0b11 << DRIVE_OVERCURRENT_BIT, (ocpThreshold & 0b11) << DRIVE_OVERCURRENT_BIT);
 }
 
 
 void DRV8711::setOverCurrentDeglitch(OCP_DEGLITCH ocpDeglitch) {
-  // Read the current value of CTRL register
-  uint16_t ctrlRegValue = readRegister(DRIVE_REG_ADDR);
-
-  // Clear the DTIME bits (bits 11-10)
-  ctrlRegValue &= ~(0b11 << DRIVE_OVERCURRENT_DEGLITCH_BIT);
-
-  // Set the new dead time value
-  ctrlRegValue |= ((ocpDeglitch & 0b11) << DRIVE_OVERCURRENT_DEGLITCH_BIT);
-
-  // Write back the modified value to CTRL register
-  writeRegister(DRIVE_REG_ADDR, ctrlRegValue);
+  // Replace the OCPDEG bits (bits 3-2) with the new deglitch time
+  modifyRegister(DRIVE_REG_ADDR, 0b11 << DRIVE_OVERCURRENT_DEGLITCH_BIT, (ocpDeglitch & 0b11) << DRIVE_OVERCURRENT_DEGLITCH_BIT);
 }
 
 
 void DRV8711::setLSGateDriveTime(GATE_DRIVE_TIME gateDriveTime) {
-  // Read the current value of CTRL register
-  uint16_t ctrlRegValue = readRegister(DRIVE_REG_ADDR);
-
-  // Clear the DTIME bits (bits 11-10)
-  ctrlRegValue &= ~(0b11 << DRIVE_LS_GATE_DRIVE_TIME_BIT);
-
-  // Set the new dead time value
-  ctrlRegValue |= ((gateDriveTime & 0b11) << DRIVE_LS_GATE_DRIVE_TIME_BIT);
-
-  // Write back the modified value to CTRL register
-  writeRegister(DRIVE_REG_ADDR, ctrlRegValue);
+  // Replace the TDRIVEN bits (bits 5-4) with the new drive time
+  modifyRegister(DRIVE_REG_ADDR, 0b11 << DRIVE_LS_GATE_DRIVE_TIME_BIT, (gateDriveTime & 0b11) << DRIVE_LS_GATE_DRIVE_TIME_BIT);
 }
 
 
 void DRV8711::setHSGateDriveTime(GATE_DRIVE_TIME gateDriveTime) {
-  // Read the current value of CTRL register
-  uint16_t ctrlRegValue = readRegister(DRIVE_REG_ADDR);
-
-  // Clear the DTIME bits (bits 11-10)
-  ctrlRegValue &= ~(0b11 << DRIVE_HS_GATE_DRIVE_TIME_BIT);
-
-  // Set the new dead time value
-  ctrlRegValue |= ((gateDriveTime & 0b11) << DRIVE_HS_GATE_DRIVE_TIME_BIT);
-
-  // Write back the modified value to CTRL register
-  writeRegister(DRIVE_REG_ADDR, ctrlRegValue);
+  // Replace the TDRIVEP bits (bits 7-6) with the new drive time
+  modifyRegister(DRIVE_REG_ADDR, 0b11 << DRIVE_HS_GATE_DRIVE_TIME_BIT, (gateDriveTime & 0b11) << DRIVE_HS_GATE_DRIVE_TIME_BIT);
 }
 
 void DRV8711::setLSGatePeakCurrent(LS_GATE_PEAK_CURRENT gatePeakCurrent) {
-  // Read the current value of CTRL register
-  uint16_t ctrlRegValue = readRegister(DRIVE_REG_ADDR);
+  // Replace the IDRIVEN bits (bits 9-8) with the new peak current
+  modifyRegister(DRIVE_REG_ADDR, 0b11 << DRIVE_LS_GATE_PEAK_CURRENT_BIT, (gatePeakCurrent & 0b11) << DRIVE_LS_GATE_PEAK_CURRENT_BIT);
+}
 
-  // Clear the DTIME bits (bits 11-10)
-  ctrlRegValue &= ~(0b11 << DRIVE_LS_GATE_PEAK_CURRENT_BIT);
+void DRV8711::setHSGatePeakCurrent(HS_GATE_PEAK_CURRENT gatePeakCurrent) {
+  // Replace the IDRIVEP bits (bits 11-10) with the new peak current
+  modifyRegister(DRIVE_REG_ADDR, 0b11 << DRIVE_HS_GATE_PEAK_CURRENT_BIT, (gatePeakCurrent & 0b11) << DRIVE_HS_GATE_PEAK_CURRENT_BIT);
+}
 
-  // Set the new dead time value
-  ctrlRegValue |= ((gatePeakCurrent & 0b11) << DRIVE_LS_GATE_PEAK_CURRENT_BIT);
+DriverStatus DriverStatus::decode(uint16_t raw) {
+  DriverStatus status;
+  status.raw = raw;
+  status.overTemperature = (raw >> STATUS_OTS_BIT) & 1;
+  status.channelAOverCurrent = (raw >> STATUS_AOCP_BIT) & 1;
+  status.channelBOverCurrent = (raw >> STATUS_BOCP_BIT) & 1;
+  status.channelAPredriverFault = (raw >> STATUS_APDF_BIT) & 1;
+  status.channelBPredriverFault = (raw >> STATUS_BPDF_BIT) & 1;
+  status.underVoltage = (raw >> STATUS_UVLO_BIT) & 1;
+  status.stall = (raw >> STATUS_STD_BIT) & 1;
+  status.stallLatched = (raw >> STATUS_STDLAT_BIT) & 1;
+  return status;
+}
 
-  // Write back the modified value to CTRL register
-  writeRegister(DRIVE_REG_ADDR, ctrlRegValue);
+bool DriverStatus::hasFault() const {
+  return (raw & STATUS_FAULT_MASK) != 0;
 }
 
-void DRV8711::setHSGatePeakCurrent(HS_GATE_PEAK_CURRENT gatePeakCurrent) {
-  // Read the current value of CTRL register
-  uint16_t ctrlRegValue = readRegister(DRIVE_REG_ADDR);
+bool DriverStatus::commsLost() const {
+  //The top 4 bits of STATUS are reserved and always read as 0
+  //If they come back set then nothing is driving the bus and we read all 1s
+  return (raw & ~STATUS_FAULT_MASK & 0x0FFF) != 0;
+}
 
-  // Clear the DTIME bits (bits 11-10)
-  ctrlRegValue &= ~(0b11 << DRIVE_HS_GATE_PEAK_CURRENT_BIT);
+DriverStatus DRV8711::readStatus() {
+  lastStatus = DriverStatus::decode(readRegister(STATUS_REG_ADDR));
+  return lastStatus;
+}
 
-  // Set the new dead time value
-  ctrlRegValue |= ((gatePeakCurrent & 0b11) << DRIVE_HS_GATE_PEAK_CURRENT_BIT);
+DriverStatus DRV8711::getLastStatus() {
+  return lastStatus;
+}
 
-  // Write back the modified value to CTRL register
-  writeRegister(DRIVE_REG_ADDR, ctrlRegValue);
+void DRV8711::clearFaults(uint16_t faultMask) {
+  //Writing a 0 clears a latched status bit and writing a 1 leaves it alone
+  //so every bit in the mask is cleared in one write without reading first
+  writeRegister(STATUS_REG_ADDR, ~faultMask & STATUS_FAULT_MASK);
 }
 
 bool DRV8711::checkOTS() {
-  uint16_t status = readRegister(STATUS_REG_ADDR);
-  return (status >> STATUS_OTS_BIT) & 1; 
+  return readStatus().overTemperature;
 }
 
 void DRV8711::clearOTS() {
-  uint16_t status = readRegister(STATUS_REG_ADDR);
-  status &= ~(1 << STATUS_OTS_BIT);
-  writeRegister(STATUS_REG_ADDR, status);  
+  clearFaults(1 << STATUS_OTS_BIT);
 }
 
 bool DRV8711::checkAOCP() {
-  uint16_t status = readRegister(STATUS_REG_ADDR);
-  return (status >> STATUS_AOCP_BIT) & 1;
-} 
+  return readStatus().channelAOverCurrent;
+}
 
 void DRV8711::clearAOCP() {
-  uint16_t status = readRegister(STATUS_REG_ADDR);
-  status &= ~(1 << STATUS_AOCP_BIT);
-  writeRegister(STATUS_REG_ADDR, status);  
+  clearFaults(1 << STATUS_AOCP_BIT);
 }
 
 bool DRV8711::checkBOCP() {
-  uint16_t status = readRegister(STATUS_REG_ADDR);
-  return (status >> STATUS_BOCP_BIT) & 1;
-} 
+  return readStatus().channelBOverCurrent;
+}
 
 void DRV8711::clearBOCP() {
-  uint16_t status = readRegister(STATUS_REG_ADDR);
-  status &= ~(1 << STATUS_BOCP_BIT);
-  writeRegister(STATUS_REG_ADDR, status);  
+  clearFaults(1 << STATUS_BOCP_BIT);
 }
 
 bool DRV8711::checkAPDF() {
-  uint16_t status = readRegister(STATUS_REG_ADDR);
-  return (status >> STATUS_APDF_BIT) & 1;
-} 
+  return readStatus().channelAPredriverFault;
+}
 
 void DRV8711::clearAPDF() {
-  uint16_t status = readRegister(STATUS_REG_ADDR);
-  status &= ~(1 << STATUS_APDF_BIT);
-  writeRegister(STATUS_REG_ADDR, status);  
+  clearFaults(1 << STATUS_APDF_BIT);
 }
 
 bool DRV8711::checkBPDF() {
-  uint16_t status = readRegister(STATUS_REG_ADDR);
-  return (status >> STATUS_BPDF_BIT) & 1;
-} 
+  return readStatus().channelBPredriverFault;
+}
 
 void DRV8711::clearBPDF() {
-  uint16_t status = readRegister(STATUS_REG_ADDR);
-  status &= ~(1 << STATUS_BPDF_BIT);
-  writeRegister(STATUS_REG_ADDR, status);  
+  clearFaults(1 << STATUS_BPDF_BIT);
 }
 
 bool DRV8711::checkUVLO() {
-  uint16_t status = readRegister(STATUS_REG_ADDR);
-  return (status >> STATUS_UVLO_BIT) & 1;
-} 
+  return readStatus().underVoltage;
+}
 
 void DRV8711::clearUVLO() {
-  uint16_t status = readRegister(STATUS_REG_ADDR);
-  status &= ~(1 << STATUS_UVLO_BIT);
-  writeRegister(STATUS_REG_ADDR, status);  
+  clearFaults(1 << STATUS_UVLO_BIT);
 }
 
 bool DRV8711::checkSTD() {
-  uint16_t status = readRegister(STATUS_REG_ADDR); 
-  return (status >> STATUS_STD_BIT) & 1;  
+  return readStatus().stall;
 }
 
 bool DRV8711::checkSTDLAT() {
-  uint16_t status = readRegister(STATUS_REG_ADDR);
-  return (status >> STATUS_STDLAT_BIT) & 1; 
+  return readStatus().stallLatched;
 }
 
 void DRV8711::clearSTDLAT() {
-  uint16_t status = readRegister(STATUS_REG_ADDR);
-  status &= ~(1 << STATUS_STDLAT_BIT); 
-  writeRegister(STATUS_REG_ADDR, status);
+  clearFaults(1 << STATUS_STDLAT_BIT);
 }
 
 void DRV8711::printStatus(){
-  Serial.printf("Over temp fault: \t\t%i\n", checkOTS());
-  Serial.printf("Ch A Overcurrent fault: \t%i\n", checkAOCP());
-  Serial.printf("Ch B Overcurrent fault: \t%i\n", checkBOCP());
-  Serial.printf("Ch A Predriver fault: \t%i\n", checkAPDF());
-  Serial.printf("Ch B Predriver fault: \t%i\n", checkBPDF());
-  Serial.printf("Undervoltage fault: \t%i\n", checkUVLO());
-  Serial.printf("Stall fault: \t%i\n", checkSTD());
-  Serial.printf("Stall latched fault: \t%i\n", checkSTDLAT());
+  printStatus(readStatus());
+}
+
+void DRV8711::printStatus(const DriverStatus& status){
+  Serial.printf("Over temp fault: \t\t%i\n", status.overTemperature);
+  Serial.printf("Ch A Overcurrent fault: \t%i\n", status.channelAOverCurrent);
+  Serial.printf("Ch B Overcurrent fault: \t%i\n", status.channelBOverCurrent);
+  Serial.printf("Ch A Predriver fault: \t%i\n", status.channelAPredriverFault);
+  Serial.printf("Ch B Predriver fault: \t%i\n", status.channelBPredriverFault);
+  Serial.printf("Undervoltage fault: \t%i\n", status.underVoltage);
+  Serial.printf("Stall fault: \t%i\n", status.stall);
+  Serial.printf("Stall latched fault: \t%i\n", status.stallLatched);
 }
 
 void DRV8711::printRegister(uint8_t regAddress){
@@ -407,72 +439,106 @@ void DRV8711::printUINT16Binary(uint16_t value){
   Serial.println();
 }
 
-void DRV8711::configureDefaultBrushedMotorProfile(){
-  //We set a large dead time to ensure that there is
-  //no shoot through
-  setDeadTime(NS_850);
-
-  //Fast decay mode means that the motor will spin down neutrally when the throttle is reduced
-  setDecayMode(FORCE_FAST_DECAY);
-
-  //Set the current trip blanking time to 2*x + 1uS
-  //This basically prevents any overcurrent faults occurring within 1us of the switching time
-  //Therefore avoiding instantaneous peaks from causing an overcurrent fault
-  //128*20 nS + 1 uS = 3.5 uS
-  setBlankingTime(255);
-  
-  //Lets set the gate drive current to the maximum
-  //This will need validating to ensure the rise times
-  //are not too fast and do not cause gate ringing
-  setLSGatePeakCurrent(LS_mA_400);
-  setHSGatePeakCurrent(HS_mA_200);
-
-  //30nC gate charge / 0.2A gate current = 150nS rise time
-  //Therefore we select 250 nS drive time
-  //Manually check that the gate is charging sufficiently
-  //If not, raise the drive time until it charges completely
-  setLSGateDriveTime(ns_1000);
-  setHSGateDriveTime(ns_1000);
-
-  //33.3A across the mosfets will cause a 250 mV voltage drop
-  //due to the 7.5 mOhm internal resistance
-  //This is sensed by the chip and will throw an overcurrent fault 
-  setOverCurrentProtectionThreshold(mV_250);
-  setOverCurrentDeglitch(us_8);
-
-  //We are using brushed motor so we tell the DRV8711
-  //to listen to the direct PWM inputs
-  setPWMMode(BRUSHED);
-
-  setCurrentLimit(10);
-  setTOFF(200);
-
-  setMotorEnabled(true);
+bool DRV8711::applyProfile(const DRV8711Profile& profile){
+  //Every register is written even if the shadow says it already matches, in case the chip has been reset behind our back
+  SpiBatch burst;
+  for(uint8_t i = 0; i < DRV8711_CONFIG_REGISTER_COUNT; i++){
+    uint8_t regAddress = CONFIG_WRITE_ORDER[i];
+    burst.add(csPin, writeFrame(regAddress, profile.getRegister(regAddress)));
+    shadowRegisters[regAddress] = profile.getRegister(regAddress);
+  }
+  for(uint8_t regAddress = CTRL_REG_ADDR; regAddress < DRV8711_CONFIG_REGISTER_COUNT; regAddress++){
+    burst.add(csPin, readFrame(regAddress));
+  }
+  bus->transferBatch(burst);
+
+  bool registersMatch = true;
+  for(uint8_t regAddress = CTRL_REG_ADDR; regAddress < DRV8711_CONFIG_REGISTER_COUNT; regAddress++){
+    uint16_t regValue = burst.rxFrames[DRV8711_CONFIG_REGISTER_COUNT + regAddress] & 0x0FFF;
+    if(regValue != shadowRegisters[regAddress]){
+      LOG_ERROR(EVT_REGISTER_MISMATCH, regAddress, shadowRegisters[regAddress], regValue);
+      registersMatch = false;
+    }
+  }
+  return registersMatch;
 }
 
-void DRV8711::setCurrentLimit(uint8_t amps){
+bool DRV8711::matchesProfile(const DRV8711Profile& profile){
+  for(uint8_t regAddress = CTRL_REG_ADDR; regAddress < DRV8711_CONFIG_REGISTER_COUNT; regAddress++){
+    uint16_t ignoredBits = (regAddress == CTRL_REG_ADDR) ? (1 << CTRL_ENBL_BIT) : 0;
+    if((shadowRegisters[regAddress] & ~ignoredBits) != (profile.getRegister(regAddress) & ~ignoredBits)){
+      return false;
+    }
+  }
+  return true;
+}
 
+void DRV8711::configureDefaultBrushedMotorProfile(){
+  applyProfile(lookupDriverProfile(DRIVER_PROFILE_DEFAULT_BRUSHED));
+}
 
+void DRV8711::setCurrentLimit(uint8_t amps){
   //I have no idea why i need the following settings for the current limit work
   //It should be CurrentLimit = 2.75 * torqueValue / 256 * GAIN * CURRENT_SHUNT_RESISTANCE
   //But as you can see below I am having to offset the current by 4 amps
   //And I am also setting the drv8711 to a gain of 5, when i am using 20 in my equation
   //Anyway, it has been validated experimentally from 0.5 amps to 10A in increments of 0.5A
   //So i guess it just works
-  setSenseAmplifierGain(GAIN5);
-
   float torqueValue = (float(amps + 4.0f) * (256.0f * 20.0 * CURRENT_SHUNT_RESISTANCE))/2.75f;
 
   if(torqueValue > 255.0){
-    Serial.printf("Error, requested current limit too high: %f\n", torqueValue);
+    LOG_ERROR(EVT_TORQUE_TOO_HIGH, int32_t(torqueValue));
     // Serial.printf("Modify the DRV8711::setCurrentLimit function if you really want it this high\n");
     // Serial.printf("Do so at your own risk\n");
     return;
   }
+  setCurrentLimitRegisters(GAIN5, uint8_t(torqueValue));
+  LOG_INFO(EVT_TORQUE_SET, int32_t(torqueValue));
+}
+
+bool DRV8711::gainChangeGoesFirst(ISGAIN_GAIN gain, uint8_t torque){
+  uint8_t oldGain = (shadowRegisters[CTRL_REG_ADDR] >> CTRL_ISGAIN_BIT) & 0b11;
+  uint8_t oldTorque = (shadowRegisters[TORQUE_REG_ADDR] >> TORQUE_TORQUE_BIT) & 0xFF;
+
+  //The limit goes roughly as TORQUE / gain and each gain setting doubles the gain,
+  //so compare the two limits it could pass through on the way
+  return ((uint32_t)oldTorque << oldGain) <= ((uint32_t)torque << gain);
+}
+
+void DRV8711::setCurrentLimitRegisters(ISGAIN_GAIN gain, uint8_t torque){
+  if(gainChangeGoesFirst(gain, torque)){
+    setSenseAmplifierGain(gain);
+    setTorque(torque);
+  }
   else{
-    setTorque(uint8_t(torqueValue));
+    setTorque(torque);
+    setSenseAmplifierGain(gain);
+  }
+}
+
+bool DRV8711::queueCurrentLimit(SpiBatch& batch, ISGAIN_GAIN gain, uint8_t torque){
+  uint16_t ctrlValue = (shadowRegisters[CTRL_REG_ADDR] & ~(0b11 << CTRL_ISGAIN_BIT)) | ((gain & 0b11) << CTRL_ISGAIN_BIT);
+  uint16_t torqueValue = (shadowRegisters[TORQUE_REG_ADDR] & ~(0xFF << TORQUE_TORQUE_BIT)) | (torque << TORQUE_TORQUE_BIT);
+  bool ctrlChanged = (ctrlValue != shadowRegisters[CTRL_REG_ADDR]);
+  bool torqueChanged = (torqueValue != shadowRegisters[TORQUE_REG_ADDR]);
+  if(batch.frameCount + ctrlChanged + torqueChanged > SPI_BATCH_MAX_FRAMES){
+    return false;
+  }
+
+  //Same order as setCurrentLimitRegisters, the frames go out in the order they are added
+  bool gainFirst = gainChangeGoesFirst(gain, torque);
+  if(ctrlChanged && gainFirst){
+    batch.add(csPin, writeFrame(CTRL_REG_ADDR, ctrlValue));
+  }
+  if(torqueChanged){
+    batch.add(csPin, writeFrame(TORQUE_REG_ADDR, torqueValue));
+  }
+  if(ctrlChanged && !gainFirst){
+    batch.add(csPin, writeFrame(CTRL_REG_ADDR, ctrlValue));
   }
-  Serial.printf("Setting torque to %i\n", uint8_t(torqueValue));
+  shadowRegisters[CTRL_REG_ADDR] = ctrlValue;
+  shadowRegisters[TORQUE_REG_ADDR] = torqueValue;
+  return true;
 }
 
 
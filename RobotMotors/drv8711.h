@@ -1,7 +1,20 @@
 #ifndef __DRV8711__
 #define __DRV8711__
-#include <Arduino.h>
-#include <SPI.h>
+#include "platform.h"
+#include "hal.h"
+
+//Chip select pin of the DRV8711 on the control board
+#define DRV8711_CS_PIN 5
+
+//nSLEEP pin of the DRV8711 on the control board, held high to keep the chip awake
+#define DRV8711_SLEEP_PIN 4
+
+//How long the DRV8711 takes to wake after nSLEEP goes high (tWAKE in the datasheet), in milliseconds
+//Until then the charge pump is not up, and the chip should not be read or have its bridges enabled
+#define DRV8711_WAKE_TIME_MS 1
+
+//Resistance of the current sense shunts on the control board, in ohms
+extern const float CURRENT_SHUNT_RESISTANCE;
 
 //#########CTRL Register#############
 #define CTRL_REG_ADDR 0
@@ -146,21 +159,108 @@ enum HS_GATE_PEAK_CURRENT {
 
 #define STATUS_STDLAT_BIT 7
 
+//Bits 0-7 are fault flags, bits 8-11 are reserved
+#define STATUS_FAULT_MASK 0x0FF
+
+//Decoded copy of the STATUS register taken from a single read
+struct DriverStatus {
+  uint16_t raw;
+  bool overTemperature;
+  bool channelAOverCurrent;
+  bool channelBOverCurrent;
+  bool channelAPredriverFault;
+  bool channelBPredriverFault;
+  bool underVoltage;
+  bool stall;
+  bool stallLatched;
+
+  static DriverStatus decode(uint16_t raw);
+
+  //True if any fault bit is set
+  bool hasFault() const;
+
+  //True if the read came back with reserved bits set, meaning the chip did not answer
+  bool commsLost() const;
+};
+
+//Registers 0-6 hold configuration, register 7 is the STATUS register
+#define DRV8711_REGISTER_COUNT 8
+#define DRV8711_CONFIG_REGISTER_COUNT 7
 
 
+class DRV8711Profile;
+
 // Class representing the DRV8711 register
 class DRV8711 {
 private:
+  SpiBus* bus;
+  uint8_t csPin;
+  uint8_t nSleepPin;
+
+  //Copy of every register as last written to (or read back from) the chip
+  //Setters change this copy and send a single write instead of reading the register first
+  //The queue calls change it when the write is queued, not when it is sent, so it is what the chip should hold.
+  //Recovery relies on that: a write lost with the comms shows up as a mismatch and the shadow is written back
+  uint16_t shadowRegisters[DRV8711_REGISTER_COUNT];
+
+  //Result of the most recent STATUS read
+  DriverStatus lastStatus;
+
+  //Configuration registers as read back by the last batched STATUS read that asked for them
+  uint16_t readbackRegisters[DRV8711_CONFIG_REGISTER_COUNT];
+
+  void modifyRegister(uint8_t regAddress, uint16_t fieldMask, uint16_t fieldValue);
+
+  uint16_t readFrame(uint8_t regAddress);
+
+  uint16_t writeFrame(uint8_t regAddress, uint16_t data);
+
+  //True if a current limit change should write the gain before TORQUE, see setCurrentLimitRegisters
+  bool gainChangeGoesFirst(ISGAIN_GAIN gain, uint8_t torque);
 
 public:
-  DRV8711();
+  DRV8711(SpiBus& spiBus, uint8_t chipSelectPin = DRV8711_CS_PIN, uint8_t sleepPin = DRV8711_SLEEP_PIN);
+
+  SpiBus* getBus();
+
+  uint8_t getChipSelectPin();
 
-  void init();
+  //Starts the bus, wakes the chip and loads the shadow registers from it, returns false if it did not answer
+  bool init();
 
   void writeRegister(uint8_t regAddress, uint16_t data);
 
   uint16_t readRegister(uint8_t regAddress);
 
+  uint16_t getShadowRegister(uint8_t regAddress);
+
+  //Reload the shadow registers from the chip, returns false if the chip did not respond
+  bool resync();
+
+  //Read back the configuration registers and check they match the shadow registers
+  bool verify();
+
+  //Write the shadow registers back to the chip, e.g. after it has lost power, CTRL last so it is enabled once the rest are set
+  void restoreRegisters();
+
+  //The calls below add this driver's frames to a batch that the caller submits to the bus,
+  //so several drivers on one bus can be polled in a single pass without waiting on SPI
+  //The calls above wait for each frame and are what init and the setters use
+
+  //Adds a STATUS read, and a read of every configuration register if readBackConfig is true
+  //Returns the index of the STATUS frame, or -1 with nothing added if the batch is too full
+  int8_t queueStatusRead(SpiBatch& batch, bool readBackConfig = false);
+
+  //Adds a write clearing the STATUS bits in faultMask, followed by every shadow register with CTRL last if restore is true
+  //Returns false with nothing added if the batch is too full
+  bool queueClearFaults(SpiBatch& batch, uint16_t faultMask, bool restore = false);
+
+  //Decodes the frames queueStatusRead added once the batch has finished, the status goes into getLastStatus
+  void takeStatusRead(const SpiBatch& batch, int8_t statusFrame, bool readBackConfig = false);
+
+  //Checks the registers read back by the last takeStatusRead against the shadow registers
+  bool verifyReadback();
+
   void setMotorEnabled(bool enableOrDisable);
 
   void setSenseAmplifierGain(ISGAIN_GAIN gain);
@@ -193,6 +293,14 @@ public:
 
   void setHSGatePeakCurrent(HS_GATE_PEAK_CURRENT gatePeakCurrent);
 
+  //Read STATUS once and decode every flag
+  DriverStatus readStatus();
+
+  DriverStatus getLastStatus();
+
+  //Clear every STATUS bit set in faultMask with a single write
+  void clearFaults(uint16_t faultMask);
+
   bool checkOTS();
   void clearOTS();
 
@@ -218,14 +326,43 @@ public:
 
   void printStatus();
 
+  void printStatus(const DriverStatus& status);
+
   void printRegister(uint8_t regAddress);
 
   void printUINT16Binary(uint16_t value);
 
+  //Writes every configuration register from the profile in one burst, then reads them all back
+  //CTRL goes last so the H bridges are only enabled once everything else is set
+  //Returns false if the read back does not match
+  bool applyProfile(const DRV8711Profile& profile);
+
+  //True if the shadow registers match the profile apart from ENBL, after init() this is what the chip holds
+  bool matchesProfile(const DRV8711Profile& profile);
+
   void configureDefaultBrushedMotorProfile();
   
+  //Whole amps with the fixed gain of 5 formula, Motors::setCurrentLimit uses the calibration table instead
   void setCurrentLimit(uint8_t amps);
 
+  //Sets the sense amplifier gain and TORQUE from the shadow registers, so only the registers that change are written
+  //When both change, the one that lowers the limit goes first so it never passes through a higher limit than either
+  //This waits on SPI, so once the control task is running only call it from that task
+  void setCurrentLimitRegisters(ISGAIN_GAIN gain, uint8_t torque);
+
+  //Adds a write of every configuration register from the profile, CTRL last, and updates the shadow registers
+  //Returns false with nothing added if the batch is too full
+  bool queueProfile(SpiBatch& batch, const DRV8711Profile& profile);
+
+  //Adds a write of the DECAY register if its decay mode changes and updates the shadow register
+  //Returns false with nothing added if the batch is too full
+  bool queueDecayMode(SpiBatch& batch, DECAYMODE decayMode);
+
+  //Adds the writes setCurrentLimitRegisters would make to a batch and updates the shadow registers straight away
+  //The batch must then be sent, Motors::checkFaults sends any batch the bus was too busy for on its next call
+  //Returns false with nothing added if the batch is too full
+  bool queueCurrentLimit(SpiBatch& batch, ISGAIN_GAIN gain, uint8_t torque);
+
   void testMotorEnable();
 
   void testSetTorque();
@@ -0,0 +1,93 @@
+#include "drv8711_profile.h"
+
+uint16_t drv8711FieldOutOfRange(){
+  return 0;
+}
+
+//Everything the profiles have in common: driving brushed motors from the PWM inputs
+//with the current limit setCurrentLimit gives for 10A
+constexpr DRV8711Profile BRUSHED_BASE = DRV8711Profile()
+  //We are using brushed motor so we tell the DRV8711
+  //to listen to the direct PWM inputs
+  .pwmMode(BRUSHED)
+  .senseAmplifierGain(GAIN5)
+  .torque(65)
+  .offTime(200)
+  .motorEnabled(true);
+
+constexpr DRV8711Profile DEFAULT_BRUSHED_PROFILE = BRUSHED_BASE
+  //We set a large dead time to ensure that there is
+  //no shoot through
+  .deadTime(NS_850)
+
+  //Fast decay mode means that the motor will spin down neutrally when the throttle is reduced
+  .decayMode(FORCE_FAST_DECAY)
+
+  //Set the current trip blanking time to x * 20nS + 1 uS
+  //This basically prevents any overcurrent faults occurring within 1us of the switching time
+  //Therefore avoiding instantaneous peaks from causing an overcurrent fault
+  //255 * 20 nS + 1 uS = 6.1 uS
+  .blankingTime(255)
+
+  //Lets set the gate drive current to the maximum
+  //This will need validating to ensure the rise times
+  //are not too fast and do not cause gate ringing
+  .lsGatePeakCurrent(LS_mA_400)
+  .hsGatePeakCurrent(HS_mA_200)
+
+  //30nC gate charge / 0.2A gate current = 150nS rise time
+  //Manually check that the gate is charging sufficiently
+  //If not, raise the drive time until it charges completely
+  .lsGateDriveTime(ns_1000)
+  .hsGateDriveTime(ns_1000)
+
+  //33.3A across the mosfets will cause a 250 mV voltage drop
+  //due to the 7.5 mOhm internal resistance
+  //This is sensed by the chip and will throw an overcurrent fault
+  .overCurrentThreshold(mV_250)
+  .overCurrentDeglitch(us_8);
+
+constexpr DRV8711Profile HIGH_TORQUE_PROFILE = DEFAULT_BRUSHED_PROFILE
+  //500 mV is about 66A through the mosfets, for motors that pull more than 33A when they stall
+  .overCurrentThreshold(mV_500)
+  .decayMode(FORCE_SLOW_DECAY);
+
+constexpr DRV8711Profile LOW_NOISE_PROFILE = DEFAULT_BRUSHED_PROFILE
+  //The weakest gate drive, 30nC / 0.1A = 300nS rise time, so the drive time goes up to cover it
+  .lsGatePeakCurrent(LS_mA_100)
+  .hsGatePeakCurrent(HS_mA_50)
+  .lsGateDriveTime(ns_2000)
+  .hsGateDriveTime(ns_2000)
+
+  //Mixed decay lets the current fall more gently than fast decay
+  .decayMode(FORCE_MIXED_DECAY)
+
+  //Let the chip shorten the blanking time when the current is low
+  .adaptiveBlanking(true);
+
+//In the order of DRIVER_PROFILE
+static const DRV8711Profile DRIVER_PROFILES[DRIVER_PROFILE_COUNT] = {
+  DEFAULT_BRUSHED_PROFILE,
+  HIGH_TORQUE_PROFILE,
+  LOW_NOISE_PROFILE
+};
+
+static const char* const DRIVER_PROFILE_NAMES[DRIVER_PROFILE_COUNT] = {
+  "default brushed",
+  "high torque",
+  "low noise"
+};
+
+const DRV8711Profile& lookupDriverProfile(DRIVER_PROFILE profile){
+  if(profile >= DRIVER_PROFILE_COUNT){
+    return DRIVER_PROFILES[DRIVER_PROFILE_DEFAULT_BRUSHED];
+  }
+  return DRIVER_PROFILES[profile];
+}
+
+const char* driverProfileName(DRIVER_PROFILE profile){
+  if(profile >= DRIVER_PROFILE_COUNT){
+    return "unknown";
+  }
+  return DRIVER_PROFILE_NAMES[profile];
+}
@@ -0,0 +1,129 @@
+#ifndef __DRV8711_PROFILE__
+#define __DRV8711_PROFILE__
+#include <stdint.h>
+#include "drv8711.h"
+
+//Stands in for a field value that does not fit its field
+//It is not constexpr, so a constexpr profile with a value out of range fails to compile at the call to it
+uint16_t drv8711FieldOutOfRange();
+
+//The seven DRV8711 configuration registers, built up one field at a time at compile time
+//Each setter returns a copy with one field changed, so a whole profile can be a single constexpr expression:
+//
+//  constexpr DRV8711Profile profile = DRV8711Profile().deadTime(NS_850).torque(65).motorEnabled(true);
+//
+//Fields start at the power on reset values
+class DRV8711Profile {
+  private:
+    uint16_t registers[DRV8711_CONFIG_REGISTER_COUNT];
+
+    constexpr DRV8711Profile(uint16_t ctrl, uint16_t torque, uint16_t off, uint16_t blank, uint16_t decay, uint16_t stall, uint16_t drive)
+      : registers{ctrl, torque, off, blank, decay, stall, drive} {}
+
+    static constexpr uint16_t checked(uint16_t value, uint16_t fieldMax){
+      return (value <= fieldMax) ? value : drv8711FieldOutOfRange();
+    }
+
+    //Register regAddress with the field at bit set to value, any other register unchanged
+    constexpr uint16_t fieldSet(uint8_t regAddress, uint8_t fieldRegAddress, uint8_t bit, uint16_t fieldMax, uint16_t value) const {
+      return (regAddress != fieldRegAddress) ? registers[regAddress] :
+        (uint16_t)((registers[regAddress] & ~(fieldMax << bit)) | (checked(value, fieldMax) << bit));
+    }
+
+    constexpr DRV8711Profile withField(uint8_t regAddress, uint8_t bit, uint16_t fieldMax, uint16_t value) const {
+      return DRV8711Profile(fieldSet(CTRL_REG_ADDR, regAddress, bit, fieldMax, value), fieldSet(TORQUE_REG_ADDR, regAddress, bit, fieldMax, value),
+        fieldSet(OFF_REG_ADDR, regAddress, bit, fieldMax, value), fieldSet(BLANK_REG_ADDR, regAddress, bit, fieldMax, value),
+        fieldSet(DECAY_REG_ADDR, regAddress, bit, fieldMax, value), fieldSet(STALL_REG_ADDR, regAddress, bit, fieldMax, value),
+        fieldSet(DRIVE_REG_ADDR, regAddress, bit, fieldMax, value));
+    }
+
+  public:
+    //Power on reset values, as in the DRV8711 datasheet
+    constexpr DRV8711Profile() : registers{0xC10, 0x1FF, 0x030, 0x080, 0x110, 0x040, 0xA59} {}
+
+    constexpr uint16_t getRegister(uint8_t regAddress) const {
+      return registers[regAddress];
+    }
+
+    constexpr DRV8711Profile motorEnabled(bool enabled) const {
+      return withField(CTRL_REG_ADDR, CTRL_ENBL_BIT, 0b1, enabled ? 1 : 0);
+    }
+
+    constexpr DRV8711Profile senseAmplifierGain(ISGAIN_GAIN gain) const {
+      return withField(CTRL_REG_ADDR, CTRL_ISGAIN_BIT, 0b11, gain);
+    }
+
+    constexpr DRV8711Profile deadTime(ISGAIN_DTIME deadTimeSetting) const {
+      return withField(CTRL_REG_ADDR, CTRL_DTIME_BIT, 0b11, deadTimeSetting);
+    }
+
+    constexpr DRV8711Profile torque(uint16_t torqueValue) const {
+      return withField(TORQUE_REG_ADDR, TORQUE_TORQUE_BIT, 0xFF, torqueValue);
+    }
+
+    constexpr DRV8711Profile offTime(uint16_t toffX500ns) const {
+      return withField(OFF_REG_ADDR, OFF_TOFF_BIT, 0xFF, toffX500ns);
+    }
+
+    constexpr DRV8711Profile pwmMode(PWMMODE mode) const {
+      return withField(OFF_REG_ADDR, OFF_PWMMODE_BIT, 0b1, mode);
+    }
+
+    constexpr DRV8711Profile blankingTime(uint16_t timeX20nsPlus1us) const {
+      return withField(BLANK_REG_ADDR, BLANK_TBLANK_BIT, 0xFF, timeX20nsPlus1us);
+    }
+
+    constexpr DRV8711Profile adaptiveBlanking(bool enabled) const {
+      return withField(BLANK_REG_ADDR, BLANK_ADAPTIVE_BLANKING_BIT, 0b1, enabled ? 1 : 0);
+    }
+
+    constexpr DRV8711Profile decayTime(uint16_t decayTimeX500ns) const {
+      return withField(DECAY_REG_ADDR, DECAY_TDECAY_BIT, 0xFF, decayTimeX500ns);
+    }
+
+    constexpr DRV8711Profile decayMode(DECAYMODE mode) const {
+      return withField(DECAY_REG_ADDR, DECAY_DECMOD_BIT, 0b111, mode);
+    }
+
+    constexpr DRV8711Profile overCurrentThreshold(OCP_THRESHOLD threshold) const {
+      return withField(DRIVE_REG_ADDR, DRIVE_OVERCURRENT_BIT, 0b11, threshold);
+    }
+
+    constexpr DRV8711Profile overCurrentDeglitch(OCP_DEGLITCH deglitch) const {
+      return withField(DRIVE_REG_ADDR, DRIVE_OVERCURRENT_DEGLITCH_BIT, 0b11, deglitch);
+    }
+
+    constexpr DRV8711Profile lsGateDriveTime(GATE_DRIVE_TIME driveTime) const {
+      return withField(DRIVE_REG_ADDR, DRIVE_LS_GATE_DRIVE_TIME_BIT, 0b11, driveTime);
+    }
+
+    constexpr DRV8711Profile hsGateDriveTime(GATE_DRIVE_TIME driveTime) const {
+      return withField(DRIVE_REG_ADDR, DRIVE_HS_GATE_DRIVE_TIME_BIT, 0b11, driveTime);
+    }
+
+    constexpr DRV8711Profile lsGatePeakCurrent(LS_GATE_PEAK_CURRENT peakCurrent) const {
+      return withField(DRIVE_REG_ADDR, DRIVE_LS_GATE_PEAK_CURRENT_BIT, 0b11, peakCurrent);
+    }
+
+    constexpr DRV8711Profile hsGatePeakCurrent(HS_GATE_PEAK_CURRENT peakCurrent) const {
+      return withField(DRIVE_REG_ADDR, DRIVE_HS_GATE_PEAK_CURRENT_BIT, 0b11, peakCurrent);
+    }
+};
+
+//Profiles that can be picked at startup with Motors::setDriverProfile
+//Each one sets the current limit for 10A, Motors swaps in the limit from setCurrentLimit when it applies one
+enum DRIVER_PROFILE {
+    //Long dead time, fast decay, fast gate drive and the lowest over current trip, the profile the board has always used
+    DRIVER_PROFILE_DEFAULT_BRUSHED = 0,
+    //Trips over current at twice the current and uses slow decay, which holds the motor current up between PWM pulses
+    DRIVER_PROFILE_HIGH_TORQUE = 1,
+    //Slower gate drive for softer switching edges and less electrical noise, at the cost of hotter FETs
+    DRIVER_PROFILE_LOW_NOISE = 2,
+    DRIVER_PROFILE_COUNT = 3
+};
+
+const DRV8711Profile& lookupDriverProfile(DRIVER_PROFILE profile);
+
+const char* driverProfileName(DRIVER_PROFILE profile);
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef ARDUINO
+#include "drv8711_sim.h"
+
+//Power on values from the DRV8711 datasheet
+static const uint16_t SIM_RESET_VALUES[DRV8711_REGISTER_COUNT] = {
+  0xC10, 0x1FF, 0x030, 0x080, 0x110, 0x040, 0xA59, 0x000
+};
+
+//Bits that exist in each register, reserved bits are not stored and always read as 0
+static const uint16_t SIM_REGISTER_MASKS[DRV8711_REGISTER_COUNT] = {
+  /*CTRL: DTIME, ISGAIN, EXSTALL, MODE, RSTEP, RDIR, ENBL*/ 0xFFF,
+  /*TORQUE: SMPLTH, TORQUE*/ 0x7FF,
+  /*OFF: PWMMODE, TOFF*/ 0x1FF,
+  /*BLANK: ABT, TBLANK*/ 0x1FF,
+  /*DECAY: DECMOD, TDECAY*/ 0x7FF,
+  /*STALL: VDIV, SDCNT, SDTHR*/ 0xFFF,
+  /*DRIVE: IDRIVEP, IDRIVEN, TDRIVEP, TDRIVEN, OCPDEG, OCPTH*/ 0xFFF,
+  /*STATUS: STDLAT, STD, UVLO, BPDF, APDF, BOCP, AOCP, OTS*/ 0x0FF
+};
+
+//STD shows the live stall state, every other STATUS bit latches until it is written with 0
+static const uint16_t SIM_LATCHED_STATUS_BITS = STATUS_FAULT_MASK & ~(1 << STATUS_STD_BIT);
+
+DRV8711Simulator::DRV8711Simulator(){
+  connected = true;
+  powerCycle();
+  resetCounters();
+}
+
+uint16_t DRV8711Simulator::transfer16(uint16_t frame){
+  if(!connected){
+    //Nothing drives the data line so it floats high
+    return 0xFFFF;
+  }
+
+  bool isRead = (frame >> 15) & 1;
+  uint8_t regAddress = (frame >> 12) & 0x07;
+  uint16_t data = frame & 0x0FFF;
+
+  if(isRead){
+    readCount++;
+    registerReads[regAddress]++;
+    return registers[regAddress];
+  }
+
+  writeCount++;
+  registerWrites[regAddress]++;
+  registerLastWrite[regAddress] = writeCount;
+  if(regAddress == STATUS_REG_ADDR){
+    //Writing 0 clears a latched bit, writing 1 leaves it alone
+    //A fault whose cause is still there latches again straight away
+    uint16_t cleared = ~data & SIM_LATCHED_STATUS_BITS;
+    registers[STATUS_REG_ADDR] &= ~cleared;
+    registers[STATUS_REG_ADDR] |= persistentFaults;
+  }
+  else{
+    registers[regAddress] = data & SIM_REGISTER_MASKS[regAddress];
+  }
+
+  //A read answers with the register in the same frame, a write answers with 0
+  return 0;
+}
+
+void DRV8711Simulator::powerCycle(){
+  for(uint8_t i = 0; i < DRV8711_REGISTER_COUNT; i++){
+    registers[i] = SIM_RESET_VALUES[i];
+  }
+  persistentFaults = 0;
+}
+
+void DRV8711Simulator::setConnected(bool isConnected){
+  connected = isConnected;
+}
+
+void DRV8711Simulator::injectFault(uint16_t statusBits){
+  registers[STATUS_REG_ADDR] |= statusBits & SIM_LATCHED_STATUS_BITS;
+}
+
+void DRV8711Simulator::holdFault(uint16_t statusBits){
+  persistentFaults |= statusBits & SIM_LATCHED_STATUS_BITS;
+  injectFault(statusBits);
+}
+
+void DRV8711Simulator::releaseFault(uint16_t statusBits){
+  persistentFaults &= ~statusBits;
+}
+
+void DRV8711Simulator::setStall(bool stalled){
+  if(stalled){
+    registers[STATUS_REG_ADDR] |= (1 << STATUS_STD_BIT) | (1 << STATUS_STDLAT_BIT);
+  }
+  else{
+    registers[STATUS_REG_ADDR] &= ~(1 << STATUS_STD_BIT);
+  }
+}
+
+uint16_t DRV8711Simulator::getRegister(uint8_t regAddress){
+  return registers[regAddress & 0x07];
+}
+
+void DRV8711Simulator::setRegister(uint8_t regAddress, uint16_t value){
+  registers[regAddress & 0x07] = value & SIM_REGISTER_MASKS[regAddress & 0x07];
+}
+
+uint32_t DRV8711Simulator::getTransactionCount(){
+  return readCount + writeCount;
+}
+
+uint32_t DRV8711Simulator::getReadCount(){
+  return readCount;
+}
+
+uint32_t DRV8711Simulator::getWriteCount(){
+  return writeCount;
+}
+
+uint32_t DRV8711Simulator::getRegisterReadCount(uint8_t regAddress){
+  return registerReads[regAddress & 0x07];
+}
+
+uint32_t DRV8711Simulator::getRegisterWriteCount(uint8_t regAddress){
+  return registerWrites[regAddress & 0x07];
+}
+
+uint32_t DRV8711Simulator::getRegisterLastWrite(uint8_t regAddress){
+  return registerLastWrite[regAddress & 0x07];
+}
+
+void DRV8711Simulator::resetCounters(){
+  readCount = 0;
+  writeCount = 0;
+  for(uint8_t i = 0; i < DRV8711_REGISTER_COUNT; i++){
+    registerReads[i] = 0;
+    registerWrites[i] = 0;
+    registerLastWrite[i] = 0;
+  }
+}
+
+//################## TEST FUNCTIONS #####################
+
+//True if every configuration register was written back to what the driver holds, with CTRL after the rest
+static bool restoredWithCtrlLast(DRV8711Simulator& simulator, DRV8711& driver){
+  for(uint8_t regAddress = CTRL_REG_ADDR; regAddress < DRV8711_CONFIG_REGISTER_COUNT; regAddress++){
+    if(simulator.getRegisterWriteCount(regAddress) != 1 || simulator.getRegister(regAddress) != driver.getShadowRegister(regAddress)){
+      return false;
+    }
+    if(regAddress != CTRL_REG_ADDR && simulator.getRegisterLastWrite(regAddress) > simulator.getRegisterLastWrite(CTRL_REG_ADDR)){
+      return false;
+    }
+  }
+  return true;
+}
+
+bool testRegisterRestoreOrder(){
+  HostSpiBus bus;
+  DRV8711Simulator simulator;
+  bus.attachDevice(DRV8711_CS_PIN, &simulator);
+  DRV8711 driver(bus);
+  driver.init();
+  driver.configureDefaultBrushedMotorProfile();
+  driver.setMotorEnabled(true);
+
+  //Straight away, as after a brownout
+  simulator.powerCycle();
+  simulator.resetCounters();
+  driver.restoreRegisters();
+  if(!restoredWithCtrlLast(simulator, driver)){
+    return false;
+  }
+
+  //Batched, as recovery does after the chip stopped answering
+  simulator.powerCycle();
+  simulator.resetCounters();
+  SpiBatch batch;
+  if(!driver.queueClearFaults(batch, STATUS_FAULT_MASK, true) || !bus.submitBatch(batch)){
+    return false;
+  }
+  while(!bus.pollBatch(batch)){
+  }
+  if(simulator.getRegisterWriteCount(STATUS_REG_ADDR) != 1 || simulator.getRegisterLastWrite(STATUS_REG_ADDR) != 1){
+    return false;
+  }
+  return restoredWithCtrlLast(simulator, driver);
+}
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef __DRV8711_SIM__
+#define __DRV8711_SIM__
+#ifndef ARDUINO
+#include <stdint.h>
+#include "hal_host.h"
+#include "drv8711.h"
+
+//Simulated DRV8711 for testing and benchmarking on the host
+//Attach it to a HostSpiBus and it decodes the same 16 bit frames the real chip does:
+//bit 15 is 1 for a read and 0 for a write, bits 14-12 are the address and bits 11-0 are the data
+class DRV8711Simulator : public HostSpiDevice {
+  private:
+    uint16_t registers[DRV8711_REGISTER_COUNT];
+
+    //STATUS bits whose cause is still present, clearing them does nothing until they are released
+    uint16_t persistentFaults;
+
+    bool connected;
+
+    uint32_t readCount;
+    uint32_t writeCount;
+    uint32_t registerReads[DRV8711_REGISTER_COUNT];
+    uint32_t registerWrites[DRV8711_REGISTER_COUNT];
+
+    //writeCount at each register's last write, so the order they were written in can be checked
+    uint32_t registerLastWrite[DRV8711_REGISTER_COUNT];
+
+  public:
+    DRV8711Simulator();
+
+    uint16_t transfer16(uint16_t frame);
+
+    //Puts every register back to its power on value, like a brownout would
+    void powerCycle();
+
+    //With the chip disconnected every frame reads back as all 1s and writes are lost
+    void setConnected(bool isConnected);
+
+    //Latches STATUS fault bits, e.g. 1 << STATUS_AOCP_BIT
+    void injectFault(uint16_t statusBits);
+
+    //Latches STATUS fault bits and keeps them set until releaseFault, e.g. an over temperature that has not cooled down
+    void holdFault(uint16_t statusBits);
+
+    void releaseFault(uint16_t statusBits);
+
+    //Sets the live stall bit (STD) and latches STDLAT when it goes active
+    void setStall(bool stalled);
+
+    //Register values as the chip holds them, without going through SPI
+    uint16_t getRegister(uint8_t regAddress);
+
+    void setRegister(uint8_t regAddress, uint16_t value);
+
+    uint32_t getTransactionCount();
+    uint32_t getReadCount();
+    uint32_t getWriteCount();
+    uint32_t getRegisterReadCount(uint8_t regAddress);
+    uint32_t getRegisterWriteCount(uint8_t regAddress);
+
+    //Goes up with every write, a register written later has a higher value and one never written has 0
+    uint32_t getRegisterLastWrite(uint8_t regAddress);
+
+    void resetCounters();
+};
+
+//Checks that restoring the registers after a power loss, both straight away and batched, writes CTRL last
+bool testRegisterRestoreOrder();
+
+#endif
+#endif
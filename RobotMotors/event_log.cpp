@@ -0,0 +1,143 @@
+#include "platform.h"
+#include "event_log.h"
+#include "loop_profiler.h"
+
+EventLog eventLog;
+
+//Text for each LOG_EVENT, every argument is printed as a long
+static const char* const LOG_EVENT_FORMATS[LOG_EVENT_COUNT] = {
+  /*EVT_LOG_DROPPED*/ "Warning: %ld log messages dropped\n",
+  /*EVT_SPEED_ABOVE_MAX*/ "Warning: Motor speed set above 100%%\n",
+  /*EVT_SPEED_BELOW_MIN*/ "Warning: Motor speed set below -100%%\n",
+  /*EVT_CURRENT_ABOVE_MAX*/ "Warning: Current limit >20 A provided, defaulting to 20 A\n",
+  /*EVT_CURRENT_NEGATIVE*/ "Warning: Negative current limit provided, defaulting to 0 A\n",
+  /*EVT_TORQUE_TOO_HIGH*/ "Error, requested current limit too high: %ld\n",
+  /*EVT_TORQUE_SET*/ "Setting torque to %ld\n",
+  /*EVT_CURRENT_LIMIT_SET*/ "Current limit set to %ld mA, gain %ld, torque %ld\n",
+  /*EVT_CURRENT_LIMIT_UNREACHABLE*/ "Error: no measured sense gain reaches a current limit of %ld mA\n",
+  /*EVT_COMMS_LOST*/ "Error: lost communication with motor driver %ld\n",
+  /*EVT_DRIVER_FAULT*/ "Error: Motor Driver %ld Fault detected, STATUS 0x%03lX\n",
+  /*EVT_RECONNECTING*/ "Attempting to reconnect to motor driver %ld\n",
+  /*EVT_CLEARING_FAULTS*/ "Attempting to reset motor driver %ld faults...\n",
+  /*EVT_FAULTS_CLEARED*/ "Motor driver %ld faults cleared\n",
+  /*EVT_REGISTER_MISMATCH*/ "Register %ld mismatch, expected 0x%03lX but read 0x%03lX\n",
+  /*EVT_RECONNECT_MISMATCH*/ "Error: motor driver %ld registers do not match after reconnecting\n",
+  /*EVT_SETTINGS_MISMATCH*/ "Error: motor driver %ld registers do not match the new settings\n",
+  /*EVT_CONTROLLER_AXES*/ "axis L: %4ld, %4ld, axis R: %4ld, %4ld\n",
+  /*EVT_CONTROLLER_BUTTONS*/ "dpad: 0x%02lx, buttons: 0x%04lx, brake: %4ld, throttle: %4ld\n",
+  /*EVT_CONTROLLER_NOT_READY*/ "Data not available yet\n",
+  /*EVT_INPUT_TIMEOUT*/ "Warning: No input for %ld ms, stopping the motors\n",
+  /*EVT_INPUT_RECOVERED*/ "Input is back after %ld ms\n"
+};
+
+EventLog::EventLog() : writeIndex(0), recordsLogged(0), recordsDropped(0){
+  readIndex = 0;
+  droppedReported = 0;
+  for(uint32_t i = 0; i < LOG_BUFFER_SIZE; i++){
+    slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+bool EventLog::begin(uint8_t core, uint8_t priority){
+#ifdef ARDUINO
+  return xTaskCreatePinnedToCore(logTask, "EventLog", LOG_TASK_STACK_SIZE, this, priority, nullptr, core) == pdPASS;
+#else
+  //There are no tasks on the host, call drain to print the log
+  (void)core;
+  (void)priority;
+  return false;
+#endif
+}
+
+void EventLog::log(uint8_t level, LOG_EVENT eventId, int32_t arg0, int32_t arg1, int32_t arg2, int32_t arg3){
+  uint32_t position = writeIndex.load(std::memory_order_relaxed);
+  LogSlot* slot;
+  for(;;){
+    slot = &slots[position & (LOG_BUFFER_SIZE - 1)];
+    uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+    int32_t difference = (int32_t)(sequence - position);
+
+    //The slot is free, try to claim it
+    if(difference == 0){
+      if(writeIndex.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)){
+        break;
+      }
+    }
+    //The reader has not emptied this slot yet so the buffer is full
+    else if(difference < 0){
+      recordsDropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    //Another task claimed this slot first, try the next one
+    else{
+      position = writeIndex.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->record.timestampUs = micros();
+  slot->record.eventId = eventId;
+  slot->record.level = level;
+  slot->record.args[0] = arg0;
+  slot->record.args[1] = arg1;
+  slot->record.args[2] = arg2;
+  slot->record.args[3] = arg3;
+
+  //Hand the slot to the reader
+  slot->sequence.store(position + 1, std::memory_order_release);
+  recordsLogged.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint32_t EventLog::drain(uint32_t maxRecords){
+  uint32_t printed = 0;
+  while(printed < maxRecords){
+    LogSlot* slot = &slots[readIndex & (LOG_BUFFER_SIZE - 1)];
+    if(slot->sequence.load(std::memory_order_acquire) != readIndex + 1){
+      break;
+    }
+
+    LogRecord record = slot->record;
+
+    //Hand the slot back to the writers for the next time round the buffer
+    slot->sequence.store(readIndex + LOG_BUFFER_SIZE, std::memory_order_release);
+    readIndex++;
+
+    printRecord(record);
+    printed++;
+  }
+
+  uint32_t dropped = recordsDropped.load(std::memory_order_relaxed);
+  if(dropped != droppedReported){
+    Serial.printf(LOG_EVENT_FORMATS[EVT_LOG_DROPPED], (long)(dropped - droppedReported));
+    droppedReported = dropped;
+  }
+  return printed;
+}
+
+void EventLog::printRecord(const LogRecord& record){
+  if(record.eventId >= LOG_EVENT_COUNT){
+    return;
+  }
+  //printf ignores any arguments the format does not use
+  Serial.printf(LOG_EVENT_FORMATS[record.eventId], (long)record.args[0], (long)record.args[1], (long)record.args[2], (long)record.args[3]);
+}
+
+#ifdef ARDUINO
+void EventLog::logTask(void* parameter){
+  EventLog* log = (EventLog*)parameter;
+  for(;;){
+    {
+      PROFILE_SCOPE(PROFILE_LOG_PRINT);
+      log->drain();
+    }
+    vTaskDelay(pdMS_TO_TICKS(LOG_TASK_PERIOD_MS));
+  }
+}
+#endif
+
+LogStats EventLog::getStats(){
+  LogStats stats;
+  stats.recordsLogged = recordsLogged.load(std::memory_order_relaxed);
+  stats.recordsDropped = recordsDropped.load(std::memory_order_relaxed);
+  stats.bytesLogged = stats.recordsLogged * sizeof(LogRecord);
+  return stats;
+}
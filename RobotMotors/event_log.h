@@ -0,0 +1,138 @@
+#ifndef __EVENT_LOG__
+#define __EVENT_LOG__
+#include "platform.h"
+#include <atomic>
+
+//Log levels, anything above LOG_LEVEL is compiled out completely
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+//Set this to LOG_LEVEL_DEBUG to see the controller inputs every loop
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+//Number of records the ring buffer holds, must be a power of 2
+#define LOG_BUFFER_SIZE 128
+
+#define LOG_MAX_ARGS 4
+
+#define LOG_TASK_CORE 1
+#define LOG_TASK_PRIORITY 1
+#define LOG_TASK_STACK_SIZE 4096
+#define LOG_TASK_PERIOD_MS 10
+
+//Every message that can be logged, the text for each one lives in event_log.cpp
+enum LOG_EVENT {
+    EVT_LOG_DROPPED = 0,
+    EVT_SPEED_ABOVE_MAX,
+    EVT_SPEED_BELOW_MIN,
+    EVT_CURRENT_ABOVE_MAX,
+    EVT_CURRENT_NEGATIVE,
+    EVT_TORQUE_TOO_HIGH,
+    EVT_TORQUE_SET,
+    EVT_CURRENT_LIMIT_SET,
+    EVT_CURRENT_LIMIT_UNREACHABLE,
+    EVT_COMMS_LOST,
+    EVT_DRIVER_FAULT,
+    EVT_RECONNECTING,
+    EVT_CLEARING_FAULTS,
+    EVT_FAULTS_CLEARED,
+    EVT_REGISTER_MISMATCH,
+    EVT_RECONNECT_MISMATCH,
+    EVT_SETTINGS_MISMATCH,
+    EVT_CONTROLLER_AXES,
+    EVT_CONTROLLER_BUTTONS,
+    EVT_CONTROLLER_NOT_READY,
+    EVT_INPUT_TIMEOUT,
+    EVT_INPUT_RECOVERED,
+    LOG_EVENT_COUNT
+};
+
+//A log message before it has been formatted, 24 bytes instead of a whole line of text
+struct LogRecord {
+  uint32_t timestampUs;
+  uint16_t eventId;
+  uint8_t level;
+  int32_t args[LOG_MAX_ARGS];
+};
+
+struct LogStats {
+  uint32_t recordsLogged;
+  uint32_t recordsDropped;
+  uint32_t bytesLogged;
+};
+
+//Lock free ring buffer of LogRecords
+//Any task can log without waiting, a low priority task formats the records and prints them
+//If the buffer is full the record is dropped and counted rather than blocking the caller
+class EventLog {
+  private:
+    //Each slot has a sequence number that says whether it is free for the next writer
+    //or filled and ready for the reader, this is what lets several tasks log at once
+    struct LogSlot {
+      std::atomic<uint32_t> sequence;
+      LogRecord record;
+    };
+
+    LogSlot slots[LOG_BUFFER_SIZE];
+    std::atomic<uint32_t> writeIndex;
+    uint32_t readIndex;
+
+    std::atomic<uint32_t> recordsLogged;
+    std::atomic<uint32_t> recordsDropped;
+    uint32_t droppedReported;
+
+#ifdef ARDUINO
+    static void logTask(void* parameter);
+#endif
+
+    void printRecord(const LogRecord& record);
+
+  public:
+    EventLog();
+
+    //Starts the task that prints the log, on the host there is no task so call drain instead
+    bool begin(uint8_t core = LOG_TASK_CORE, uint8_t priority = LOG_TASK_PRIORITY);
+
+    //Adds a record to the buffer, never blocks
+    void log(uint8_t level, LOG_EVENT eventId, int32_t arg0 = 0, int32_t arg1 = 0, int32_t arg2 = 0, int32_t arg3 = 0);
+
+    //Prints up to maxRecords records, returns how many were printed
+    uint32_t drain(uint32_t maxRecords = LOG_BUFFER_SIZE);
+
+    LogStats getStats();
+};
+
+extern EventLog eventLog;
+
+//Disabled levels keep the call inside if(0) so the arguments are still type checked
+//but the compiler removes the call and the argument evaluation completely
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) eventLog.log(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) do { if(0) eventLog.log(LOG_LEVEL_ERROR, __VA_ARGS__); } while(0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) eventLog.log(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do { if(0) eventLog.log(LOG_LEVEL_WARN, __VA_ARGS__); } while(0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) eventLog.log(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do { if(0) eventLog.log(LOG_LEVEL_INFO, __VA_ARGS__); } while(0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) eventLog.log(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do { if(0) eventLog.log(LOG_LEVEL_DEBUG, __VA_ARGS__); } while(0)
+#endif
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef __HAL__
+#define __HAL__
+
+//Picks the SPI bus, PWM backend and settings storage at compile time
+//DRV8711 and Motors call these classes directly so there is no virtual call overhead on the ESP32
+#ifdef ARDUINO
+#include "hal_esp32.h"
+typedef Esp32SpiBus SpiBus;
+#ifdef PWM_USE_MCPWM_PRELUDE
+typedef Esp32McpwmPreludeBackend PwmBackend;
+#else
+typedef Esp32McpwmBackend PwmBackend;
+#endif
+typedef Esp32SettingsStore SettingsStore;
+#else
+#include "hal_host.h"
+typedef HostSpiBus SpiBus;
+typedef HostPwmBackend PwmBackend;
+typedef HostSettingsStore SettingsStore;
+#endif
+
+#endif
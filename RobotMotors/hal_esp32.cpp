@@ -0,0 +1,536 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#include "hal_esp32.h"
+#include <Preferences.h>
+
+Esp32SpiBus::Esp32SpiBus(){
+  deviceCount = 0;
+  started = false;
+  lock = nullptr;
+  queuedBatch = nullptr;
+  framesQueued = 0;
+  framesCollected = 0;
+}
+
+void Esp32SpiBus::begin(){
+  if(started){
+    return;
+  }
+
+  spi_bus_config_t busConfig = {};
+  busConfig.mosi_io_num = DRV_SPI_MOSI_PIN;
+  busConfig.miso_io_num = DRV_SPI_MISO_PIN;
+  busConfig.sclk_io_num = DRV_SPI_SCK_PIN;
+  busConfig.quadwp_io_num = -1;
+  busConfig.quadhd_io_num = -1;
+  busConfig.max_transfer_sz = SPI_BATCH_MAX_FRAMES * 2;
+  if(spi_bus_initialize(SPI3_HOST, &busConfig, SPI_DMA_CH_AUTO) != ESP_OK){
+    Serial.println("Error: could not start the motor driver SPI bus");
+    return;
+  }
+
+  //With nothing driving MISO every read comes back as all 1s, which is how lost comms are spotted
+  gpio_pullup_en((gpio_num_t)DRV_SPI_MISO_PIN);
+
+  lock = xSemaphoreCreateMutex();
+  started = true;
+}
+
+void Esp32SpiBus::addDevice(uint8_t csPin){
+  if(!started || findDevice(csPin) != nullptr || deviceCount >= ESP32_SPI_MAX_DEVICES){
+    return;
+  }
+
+  spi_device_interface_config_t deviceConfig = {};
+  deviceConfig.mode = 0;
+  deviceConfig.clock_speed_hz = DRV_SPI_FREQUENCY;
+  deviceConfig.spics_io_num = csPin;
+  deviceConfig.flags = SPI_DEVICE_POSITIVE_CS;
+  //Hold chip select for a clock either side of the frame
+  deviceConfig.cs_ena_pretrans = 1;
+  deviceConfig.cs_ena_posttrans = 1;
+  deviceConfig.queue_size = SPI_BATCH_MAX_FRAMES;
+  if(spi_bus_add_device(SPI3_HOST, &deviceConfig, &devices[deviceCount]) != ESP_OK){
+    Serial.printf("Error: could not add the SPI device on pin %i\n", csPin);
+    return;
+  }
+  devicePins[deviceCount] = csPin;
+  deviceCount++;
+}
+
+spi_device_handle_t Esp32SpiBus::findDevice(uint8_t csPin){
+  for(uint8_t i = 0; i < deviceCount; i++){
+    if(devicePins[i] == csPin){
+      return devices[i];
+    }
+  }
+  return nullptr;
+}
+
+uint16_t Esp32SpiBus::transfer16(uint8_t csPin, uint16_t frame){
+  spi_device_handle_t device = findDevice(csPin);
+  if(device == nullptr){
+    return 0xFFFF;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  //A polling transaction can't start while queued ones are still in flight
+  collectQueuedBatch(portMAX_DELAY);
+
+  spi_transaction_t transaction = {};
+  transaction.flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA;
+  transaction.length = 16;
+  transaction.tx_data[0] = frame >> 8;
+  transaction.tx_data[1] = frame & 0xFF;
+
+  uint16_t readData = 0xFFFF;
+  if(spi_device_polling_transmit(device, &transaction) == ESP_OK){
+    readData = (transaction.rx_data[0] << 8) | transaction.rx_data[1];
+  }
+
+  xSemaphoreGive(lock);
+  return readData;
+}
+
+bool Esp32SpiBus::submitBatch(SpiBatch& batch){
+  if(!started || batch.frameCount == 0){
+    return false;
+  }
+
+  //Never wait for the bus, the caller tries again on its next call
+  if(xSemaphoreTake(lock, 0) != pdTRUE){
+    return false;
+  }
+  if(queuedBatch != nullptr){
+    xSemaphoreGive(lock);
+    return false;
+  }
+
+  queueBatch(batch);
+  collectQueuedBatch(0);
+
+  xSemaphoreGive(lock);
+  return true;
+}
+
+void Esp32SpiBus::transferBatch(SpiBatch& batch){
+  if(!started || batch.frameCount == 0){
+    batch.state = SPI_BATCH_DONE;
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  collectQueuedBatch(portMAX_DELAY);
+  queueBatch(batch);
+  collectQueuedBatch(portMAX_DELAY);
+  xSemaphoreGive(lock);
+}
+
+void Esp32SpiBus::queueBatch(SpiBatch& batch){
+  batch.state = SPI_BATCH_QUEUED;
+  queuedBatch = &batch;
+  framesQueued = 0;
+  framesCollected = 0;
+
+  //Frames go out in order, so stop at the first one that can't be queued and leave the rest reading all 1s
+  for(uint8_t i = 0; i < batch.frameCount; i++){
+    spi_device_handle_t device = findDevice(batch.csPins[i]);
+    if(device == nullptr){
+      break;
+    }
+    spi_transaction_t& transaction = transactions[i];
+    transaction = spi_transaction_t();
+    transaction.flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA;
+    transaction.length = 16;
+    transaction.tx_data[0] = batch.txFrames[i] >> 8;
+    transaction.tx_data[1] = batch.txFrames[i] & 0xFF;
+    if(spi_device_queue_trans(device, &transaction, 0) != ESP_OK){
+      break;
+    }
+    framesQueued++;
+  }
+}
+
+bool Esp32SpiBus::pollBatch(SpiBatch& batch){
+  if(batch.state == SPI_BATCH_QUEUED && xSemaphoreTake(lock, 0) == pdTRUE){
+    if(queuedBatch == &batch){
+      collectQueuedBatch(0);
+    }
+    xSemaphoreGive(lock);
+  }
+  return batch.state == SPI_BATCH_DONE;
+}
+
+void Esp32SpiBus::collectQueuedBatch(TickType_t waitTicks){
+  if(queuedBatch == nullptr){
+    return;
+  }
+
+  //Each device hands back its transactions in the order they were queued
+  while(framesCollected < framesQueued){
+    spi_transaction_t* finished;
+    spi_device_handle_t device = findDevice(queuedBatch->csPins[framesCollected]);
+    if(spi_device_get_trans_result(device, &finished, waitTicks) != ESP_OK){
+      return;
+    }
+    queuedBatch->rxFrames[framesCollected] = (finished->rx_data[0] << 8) | finished->rx_data[1];
+    framesCollected++;
+  }
+
+  queuedBatch->state = SPI_BATCH_DONE;
+  queuedBatch = nullptr;
+}
+
+#ifdef PWM_USE_MCPWM_PRELUDE
+Esp32McpwmPreludeBackend::Esp32McpwmPreludeBackend(){
+  for(uint8_t i = 0; i < MOTOR_COUNT; i++){
+    timers[i] = nullptr;
+    faults[i] = nullptr;
+    periodTicks[i] = 0;
+    resolutionHz[i] = 0;
+    for(uint8_t output = 0; output < 2; output++){
+      operators[i][output] = nullptr;
+      comparators[i][output] = nullptr;
+      generators[i][output] = nullptr;
+    }
+  }
+}
+
+bool Esp32McpwmPreludeBackend::configureMotor(MOTOR leftOrRightMotor, const PwmConfig& config){
+  //The period register can be changed on a running timer, the tick rate can't
+  if(timers[leftOrRightMotor] != nullptr && resolutionHz[leftOrRightMotor] == config.resolutionHz){
+    mcpwm_comparator_set_compare_value(comparators[leftOrRightMotor][0], 0);
+    mcpwm_comparator_set_compare_value(comparators[leftOrRightMotor][1], 0);
+    if(mcpwm_timer_set_period(timers[leftOrRightMotor], config.periodTicks()) != ESP_OK){
+      return false;
+    }
+    periodTicks[leftOrRightMotor] = config.periodTicks();
+    return true;
+  }
+
+  if(timers[leftOrRightMotor] != nullptr){
+    teardownMotor(leftOrRightMotor);
+  }
+  return setupMotor(leftOrRightMotor, config);
+}
+
+bool Esp32McpwmPreludeBackend::setupMotor(MOTOR leftOrRightMotor, const PwmConfig& config){
+  int group = (leftOrRightMotor == RIGHT_MOTOR) ? 0 : 1;
+  periodTicks[leftOrRightMotor] = config.periodTicks();
+  resolutionHz[leftOrRightMotor] = config.resolutionHz;
+
+  mcpwm_timer_config_t timerConfig = {};
+  timerConfig.group_id = group;
+  timerConfig.clk_src = MCPWM_TIMER_CLK_SRC_DEFAULT;
+  timerConfig.resolution_hz = config.resolutionHz;
+  timerConfig.count_mode = MCPWM_TIMER_COUNT_MODE_UP;
+  timerConfig.period_ticks = periodTicks[leftOrRightMotor];
+  timerConfig.flags.update_period_on_empty = true;
+  if(mcpwm_new_timer(&timerConfig, &timers[leftOrRightMotor]) != ESP_OK){
+    Serial.printf("Error: could not create the PWM timer for motor %i\n", leftOrRightMotor);
+    timers[leftOrRightMotor] = nullptr;
+    return false;
+  }
+
+  //Every operator in the group brakes on the same nFAULT pin
+  mcpwm_gpio_fault_config_t faultConfig = {};
+  faultConfig.group_id = group;
+  faultConfig.gpio_num = DRV_FAULT_PIN;
+  faultConfig.flags.active_level = 0;
+  if(mcpwm_new_gpio_fault(&faultConfig, &faults[leftOrRightMotor]) != ESP_OK){
+    Serial.printf("Error: could not set up the PWM fault input for motor %i\n", leftOrRightMotor);
+    faults[leftOrRightMotor] = nullptr;
+    teardownMotor(leftOrRightMotor);
+    return false;
+  }
+
+  int pins[2];
+  pins[0] = (leftOrRightMotor == RIGHT_MOTOR) ? AOUT1 : BOUT1;
+  pins[1] = (leftOrRightMotor == RIGHT_MOTOR) ? AOUT2 : BOUT2;
+  for(uint8_t output = 0; output < 2; output++){
+    if(!setupOutput(leftOrRightMotor, output, pins[output])){
+      Serial.printf("Error: could not set up PWM output %i for motor %i\n", output, leftOrRightMotor);
+      teardownMotor(leftOrRightMotor);
+      return false;
+    }
+  }
+
+  mcpwm_timer_enable(timers[leftOrRightMotor]);
+  mcpwm_timer_start_stop(timers[leftOrRightMotor], MCPWM_TIMER_START_NO_STOP);
+  return true;
+}
+
+bool Esp32McpwmPreludeBackend::setupOutput(MOTOR leftOrRightMotor, uint8_t output, int pin){
+  int group = (leftOrRightMotor == RIGHT_MOTOR) ? 0 : 1;
+
+  mcpwm_operator_config_t operatorConfig = {};
+  operatorConfig.group_id = group;
+  operatorConfig.flags.update_dead_time_on_tez = true;
+  if(mcpwm_new_operator(&operatorConfig, &operators[leftOrRightMotor][output]) != ESP_OK){
+    operators[leftOrRightMotor][output] = nullptr;
+    return false;
+  }
+  mcpwm_oper_handle_t oper = operators[leftOrRightMotor][output];
+  mcpwm_operator_connect_timer(oper, timers[leftOrRightMotor]);
+
+  //New compare values wait for the timer to reach zero, so a period is never cut short
+  mcpwm_comparator_config_t comparatorConfig = {};
+  comparatorConfig.flags.update_cmp_on_tez = true;
+  if(mcpwm_new_comparator(oper, &comparatorConfig, &comparators[leftOrRightMotor][output]) != ESP_OK){
+    comparators[leftOrRightMotor][output] = nullptr;
+    return false;
+  }
+  mcpwm_cmpr_handle_t comparator = comparators[leftOrRightMotor][output];
+  mcpwm_comparator_set_compare_value(comparator, 0);
+
+  mcpwm_generator_config_t generatorConfig = {};
+  generatorConfig.gen_gpio_num = pin;
+  if(mcpwm_new_generator(oper, &generatorConfig, &generators[leftOrRightMotor][output]) != ESP_OK){
+    generators[leftOrRightMotor][output] = nullptr;
+    return false;
+  }
+  mcpwm_gen_handle_t generator = generators[leftOrRightMotor][output];
+
+  //High at the start of each period and low once the timer reaches the compare value
+  mcpwm_generator_set_action_on_timer_event(generator,
+    MCPWM_GEN_TIMER_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, MCPWM_TIMER_EVENT_EMPTY, MCPWM_GEN_ACTION_HIGH));
+  mcpwm_generator_set_action_on_compare_event(generator,
+    MCPWM_GEN_COMPARE_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, comparator, MCPWM_GEN_ACTION_LOW));
+
+  //Delaying every rising edge means the input being turned on always waits for the other one to go low
+  mcpwm_dead_time_config_t deadTimeConfig = {};
+  deadTimeConfig.posedge_delay_ticks = PWM_DEAD_TIME_TICKS;
+  mcpwm_generator_set_dead_time(generator, generator, &deadTimeConfig);
+
+  //Cycle by cycle braking lets the outputs run again on their own once nFAULT is released
+  mcpwm_brake_config_t brakeConfig = {};
+  brakeConfig.fault = faults[leftOrRightMotor];
+  brakeConfig.brake_mode = MCPWM_OPER_BRAKE_MODE_CBC;
+  brakeConfig.flags.cbc_recover_on_tez = true;
+  mcpwm_operator_set_brake_on_fault(oper, &brakeConfig);
+  mcpwm_generator_set_action_on_brake_event(generator,
+    MCPWM_GEN_BRAKE_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, MCPWM_OPER_BRAKE_MODE_CBC, MCPWM_GEN_ACTION_LOW));
+  return true;
+}
+
+void Esp32McpwmPreludeBackend::teardownMotor(MOTOR leftOrRightMotor){
+  for(uint8_t output = 0; output < 2; output++){
+    if(generators[leftOrRightMotor][output] != nullptr){
+      mcpwm_generator_set_force_level(generators[leftOrRightMotor][output], 0, true);
+      mcpwm_del_generator(generators[leftOrRightMotor][output]);
+      generators[leftOrRightMotor][output] = nullptr;
+    }
+    if(comparators[leftOrRightMotor][output] != nullptr){
+      mcpwm_del_comparator(comparators[leftOrRightMotor][output]);
+      comparators[leftOrRightMotor][output] = nullptr;
+    }
+    if(operators[leftOrRightMotor][output] != nullptr){
+      mcpwm_del_operator(operators[leftOrRightMotor][output]);
+      operators[leftOrRightMotor][output] = nullptr;
+    }
+  }
+  if(faults[leftOrRightMotor] != nullptr){
+    mcpwm_del_fault(faults[leftOrRightMotor]);
+    faults[leftOrRightMotor] = nullptr;
+  }
+  if(timers[leftOrRightMotor] != nullptr){
+    //A timer that was never started can't be stopped, so ignore the errors from that case
+    mcpwm_timer_start_stop(timers[leftOrRightMotor], MCPWM_TIMER_STOP_EMPTY);
+    mcpwm_timer_disable(timers[leftOrRightMotor]);
+    mcpwm_del_timer(timers[leftOrRightMotor]);
+    timers[leftOrRightMotor] = nullptr;
+  }
+}
+
+uint32_t Esp32McpwmPreludeBackend::getPeriodTicks(MOTOR leftOrRightMotor){
+  return periodTicks[leftOrRightMotor];
+}
+
+uint32_t Esp32McpwmPreludeBackend::compareTicksForDuty(MOTOR leftOrRightMotor, uint32_t dutyTicks){
+  if(dutyTicks == 0){
+    return 0;
+  }
+
+  //The dead time comes off the start of each pulse, so add it back to keep the duty as asked
+  uint32_t compareTicks = dutyTicks + PWM_DEAD_TIME_TICKS;
+  if(compareTicks > periodTicks[leftOrRightMotor]){
+    compareTicks = periodTicks[leftOrRightMotor];
+  }
+  return compareTicks;
+}
+
+void Esp32McpwmPreludeBackend::setMotorOutput(MOTOR leftOrRightMotor, bool forward, uint32_t dutyTicks){
+  uint32_t compareTicks = compareTicksForDuty(leftOrRightMotor, dutyTicks);
+
+  //Output 0 is the forward input
+  //The idle input is forced low straight away rather than left on a 0% compare,
+  //so it can never be high at the same time as the driven one, which would brake the motor
+  uint8_t drivenOutput = forward ? 0 : 1;
+  uint8_t idleOutput = 1 - drivenOutput;
+  mcpwm_generator_set_force_level(generators[leftOrRightMotor][idleOutput], 0, true);
+  //Releasing a force takes effect straight away but a compare value only loads at timer zero,
+  //so the idle input's compare goes to 0 while it is held low. When it is next driven it then starts at 0%
+  //until its new duty loads, rather than running on an old brake or drive duty for the rest of the period
+  mcpwm_comparator_set_compare_value(comparators[leftOrRightMotor][idleOutput], 0);
+  mcpwm_comparator_set_compare_value(comparators[leftOrRightMotor][drivenOutput], compareTicks);
+  mcpwm_generator_set_force_level(generators[leftOrRightMotor][drivenOutput], -1, true);
+}
+
+void Esp32McpwmPreludeBackend::setMotorBrake(MOTOR leftOrRightMotor, uint32_t brakeTicks){
+  //Both inputs get the same dead time, so they still rise and fall together
+  uint32_t compareTicks = compareTicksForDuty(leftOrRightMotor, brakeTicks);
+  mcpwm_comparator_set_compare_value(comparators[leftOrRightMotor][0], compareTicks);
+  mcpwm_comparator_set_compare_value(comparators[leftOrRightMotor][1], compareTicks);
+  //Let go of whichever input setMotorOutput was forcing low
+  mcpwm_generator_set_force_level(generators[leftOrRightMotor][0], -1, true);
+  mcpwm_generator_set_force_level(generators[leftOrRightMotor][1], -1, true);
+}
+#else
+//Compare value update methods, one 4 bit field per comparator in the operator's GEN_STMP_CFG register
+#define COMPARE_UPDATE_ON_TEZ 0x1
+#define COMPARE_UPDATE_HOLD 0x8
+#define COMPARE_UPDATE_BITS 0xFF
+
+Esp32McpwmBackend::Esp32McpwmBackend(){
+  for(uint8_t i = 0; i < MOTOR_COUNT; i++){
+    configured[i] = false;
+    periodTicks[i] = 0;
+  }
+}
+
+void Esp32McpwmBackend::holdCompareUpdates(MOTOR leftOrRightMotor, bool hold){
+  //Each motor uses the operator with the same number as its timer
+  mcpwm_dev_t* mcpwm = (leftOrRightMotor == RIGHT_MOTOR) ? &MCPWM0 : &MCPWM1;
+  int operatorId = (leftOrRightMotor == RIGHT_MOTOR) ? 0 : 1;
+
+  //Both comparators are changed in one register write so neither can be released before the other
+  uint32_t method = hold ? COMPARE_UPDATE_HOLD : COMPARE_UPDATE_ON_TEZ;
+  uint32_t config = mcpwm->operators[operatorId].gen_stmp_cfg.val & ~COMPARE_UPDATE_BITS;
+  mcpwm->operators[operatorId].gen_stmp_cfg.val = config | method | (method << 4);
+}
+
+bool Esp32McpwmBackend::configureMotor(MOTOR leftOrRightMotor, const PwmConfig& config){
+  mcpwm_unit_t unit = (leftOrRightMotor == RIGHT_MOTOR) ? MCPWM_UNIT_0 : MCPWM_UNIT_1;
+  mcpwm_timer_t timer = (leftOrRightMotor == RIGHT_MOTOR) ? MCPWM_TIMER_0 : MCPWM_TIMER_1;
+
+  //The driver defaults to a 1MHz timer, which only gives 100 steps at 10kHz
+  //Each motor has a unit to itself, so the group clock can be set to the timer resolution
+  if(mcpwm_group_set_resolution(unit, config.resolutionHz) != ESP_OK ||
+     mcpwm_timer_set_resolution(unit, timer, config.resolutionHz) != ESP_OK){
+    Serial.printf("Error: could not set the PWM timer resolution for motor %i\n", leftOrRightMotor);
+    return false;
+  }
+  periodTicks[leftOrRightMotor] = config.periodTicks();
+
+  if(configured[leftOrRightMotor]){
+    //Already running, so just change the period and start again from 0%
+    mcpwm_set_duty(unit, timer, MCPWM_OPR_A, 0.0f);
+    mcpwm_set_duty(unit, timer, MCPWM_OPR_B, 0.0f);
+    return mcpwm_set_frequency(unit, timer, config.frequencyHz) == ESP_OK;
+  }
+
+  mcpwm_config_t pwm_config;
+  pwm_config.frequency = config.frequencyHz;
+  pwm_config.cmpr_a = 0;    //duty cycle of PWMxA = 0
+  pwm_config.cmpr_b = 0;    //duty cycle of PWMxb = 0
+  pwm_config.counter_mode = MCPWM_UP_COUNTER;
+  pwm_config.duty_mode = MCPWM_DUTY_MODE_0;
+  mcpwm_init(unit, timer, &pwm_config);    //Configure PWMxA & PWMxB with above settings
+
+  if(leftOrRightMotor == RIGHT_MOTOR){
+    //Initialise motor control PWM for the right motor
+    mcpwm_gpio_init(MCPWM_UNIT_0, MCPWM0A, AOUT1);
+    mcpwm_gpio_init(MCPWM_UNIT_0, MCPWM0B, AOUT2);
+  }
+  else{
+    //Initialise motor control PWM for the left motor
+    mcpwm_gpio_init(MCPWM_UNIT_1, MCPWM1A, BOUT1);
+    mcpwm_gpio_init(MCPWM_UNIT_1, MCPWM1B, BOUT2);
+  }
+
+  //Compare values only change at timer zero, so a new duty never cuts a PWM period short
+  holdCompareUpdates(leftOrRightMotor, false);
+  configured[leftOrRightMotor] = true;
+  return true;
+}
+
+uint32_t Esp32McpwmBackend::getPeriodTicks(MOTOR leftOrRightMotor){
+  return periodTicks[leftOrRightMotor];
+}
+
+float Esp32McpwmBackend::ticksToDutyPercent(MOTOR leftOrRightMotor, uint32_t dutyTicks){
+  //The driver works out the compare value by truncating, so aim half a tick up to land on dutyTicks
+  if(dutyTicks >= periodTicks[leftOrRightMotor]){
+    return 100.0f;
+  }
+  return (dutyTicks + 0.5f) * 100.0f / periodTicks[leftOrRightMotor];
+}
+
+void Esp32McpwmBackend::setMotorOutput(MOTOR leftOrRightMotor, bool forward, uint32_t dutyTicks){
+  mcpwm_unit_t unit = (leftOrRightMotor == RIGHT_MOTOR) ? MCPWM_UNIT_0 : MCPWM_UNIT_1;
+  mcpwm_timer_t timer = (leftOrRightMotor == RIGHT_MOTOR) ? MCPWM_TIMER_0 : MCPWM_TIMER_1;
+  float dutyPercent = ticksToDutyPercent(leftOrRightMotor, dutyTicks);
+
+  //Forward drives output A and holds B low, backward does the opposite
+  //The idle output is forced low rather than left on a 0% compare,
+  //so it can never be high at the same time as the driven one, which would brake the motor
+  mcpwm_generator_t drivenOutput = forward ? MCPWM_OPR_A : MCPWM_OPR_B;
+  mcpwm_generator_t lowOutput = forward ? MCPWM_OPR_B : MCPWM_OPR_A;
+  mcpwm_set_signal_low(unit, timer, lowOutput);
+
+  //The new compare values load together at the next timer zero, but set_duty_type lets go of the low output straight away
+  //The idle output's compare goes to 0 while it is held low, so when it is next driven it starts at 0%
+  //until its new duty loads, rather than running on an old brake or drive duty for the rest of the period
+  holdCompareUpdates(leftOrRightMotor, true);
+  mcpwm_set_duty(unit, timer, lowOutput, 0.0f);
+  mcpwm_set_duty(unit, timer, drivenOutput, dutyPercent);
+  mcpwm_set_duty_type(unit, timer, drivenOutput, MCPWM_DUTY_MODE_0);
+  holdCompareUpdates(leftOrRightMotor, false);
+}
+
+void Esp32McpwmBackend::setMotorBrake(MOTOR leftOrRightMotor, uint32_t brakeTicks){
+  mcpwm_unit_t unit = (leftOrRightMotor == RIGHT_MOTOR) ? MCPWM_UNIT_0 : MCPWM_UNIT_1;
+  mcpwm_timer_t timer = (leftOrRightMotor == RIGHT_MOTOR) ? MCPWM_TIMER_0 : MCPWM_TIMER_1;
+  float brakePercent = ticksToDutyPercent(leftOrRightMotor, brakeTicks);
+
+  holdCompareUpdates(leftOrRightMotor, true);
+  mcpwm_set_duty(unit, timer, MCPWM_OPR_A, brakePercent);
+  mcpwm_set_duty(unit, timer, MCPWM_OPR_B, brakePercent);
+  //Put back the PWM on whichever output setMotorOutput was holding low
+  mcpwm_set_duty_type(unit, timer, MCPWM_OPR_A, MCPWM_DUTY_MODE_0);
+  mcpwm_set_duty_type(unit, timer, MCPWM_OPR_B, MCPWM_DUTY_MODE_0);
+  holdCompareUpdates(leftOrRightMotor, false);
+}
+#endif
+
+bool Esp32SettingsStore::load(const char* key, void* data, size_t length){
+  Preferences preferences;
+  //Opening read only fails if nothing has been saved yet
+  if(!preferences.begin(SETTINGS_NAMESPACE, true)){
+    return false;
+  }
+  bool loaded = preferences.getBytesLength(key) == length && preferences.getBytes(key, data, length) == length;
+  preferences.end();
+  return loaded;
+}
+
+bool Esp32SettingsStore::save(const char* key, const void* data, size_t length){
+  Preferences preferences;
+  if(!preferences.begin(SETTINGS_NAMESPACE, false)){
+    return false;
+  }
+  bool saved = preferences.putBytes(key, data, length) == length;
+  preferences.end();
+  return saved;
+}
+
+void Esp32SettingsStore::clear(){
+  Preferences preferences;
+  if(preferences.begin(SETTINGS_NAMESPACE, false)){
+    preferences.clear();
+    preferences.end();
+  }
+}
+
+#endif
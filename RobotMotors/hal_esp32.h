@@ -0,0 +1,190 @@
+#ifndef __HAL_ESP32__
+#define __HAL_ESP32__
+#ifdef ARDUINO
+#include <Arduino.h>
+#include "driver/spi_master.h"
+#include "driver/gpio.h"
+#include "motor_types.h"
+#include "pwm_config.h"
+#include "spi_batch.h"
+
+//arduino-esp32 3.x is built on ESP-IDF 5, which has the newer MCPWM driver
+//The old and new drivers cannot be linked into the same program, so only one is ever included
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+#define PWM_USE_MCPWM_PRELUDE
+#include "driver/mcpwm_prelude.h"
+#else
+#include "driver/mcpwm.h"
+#include "soc/mcpwm_periph.h"
+#endif
+
+//Motor A drive pins
+#define AOUT1 26
+#define AOUT2 25
+
+//Motor B drive pins
+#define BOUT1 33
+#define BOUT2 32
+
+//DRV8711 nFAULT output, low while the driver has a fault
+#define DRV_FAULT_PIN 34
+
+//Time both inputs of an H bridge are held low when the driven input changes, in PWM timer ticks
+#define PWM_DEAD_TIME_TICKS 10
+
+//SPI bus the DRV8711 is on, the ESP32's VSPI pins
+#define DRV_SPI_SCK_PIN 18
+#define DRV_SPI_MISO_PIN 19
+#define DRV_SPI_MOSI_PIN 23
+#define DRV_SPI_FREQUENCY 1000000
+
+#define ESP32_SPI_MAX_DEVICES 4
+
+//NVS namespace the settings are saved under, at most 15 characters
+#define SETTINGS_NAMESPACE "robotmotors"
+
+//SPI bus on the ESP-IDF spi_master driver
+//Each device gets a hardware chip select, driven active high because that is how the DRV8711 is selected
+//transfer16 sends one frame and waits for it, init and the setters use it
+//submitBatch puts a batch of frames on the driver's transaction queue and returns straight away,
+//the frames are sent from the SPI interrupt and pollBatch picks up the results on a later call
+//Only one batch is in flight at a time, and a mutex stops the loop and the control task using the bus at once
+class Esp32SpiBus {
+  private:
+    uint8_t devicePins[ESP32_SPI_MAX_DEVICES];
+    spi_device_handle_t devices[ESP32_SPI_MAX_DEVICES];
+    uint8_t deviceCount;
+    bool started;
+    SemaphoreHandle_t lock;
+
+    //Batch on the transaction queue, with one transaction per frame
+    SpiBatch* queuedBatch;
+    spi_transaction_t transactions[SPI_BATCH_MAX_FRAMES];
+    uint8_t framesQueued;
+    uint8_t framesCollected;
+
+    spi_device_handle_t findDevice(uint8_t csPin);
+
+    //Puts a batch's frames on the transaction queue, only call this with the lock held and no batch queued
+    void queueBatch(SpiBatch& batch);
+
+    //Picks up the finished frames of the queued batch, waiting up to waitTicks for each one
+    //Only call this with the lock held
+    void collectQueuedBatch(TickType_t waitTicks);
+
+  public:
+    Esp32SpiBus();
+
+    void begin();
+
+    //Adds a device with its chip select on csPin, leaving it deselected
+    void addDevice(uint8_t csPin);
+
+    //Sends one frame and waits for the reply, finishing any queued batch first
+    uint16_t transfer16(uint8_t csPin, uint16_t frame);
+
+    //Queues a batch, returns false if it is empty, another batch has not finished or the bus is in use
+    bool submitBatch(SpiBatch& batch);
+
+    //Returns true once every frame of the batch has been sent, never waits
+    bool pollBatch(SpiBatch& batch);
+
+    //Sends a batch and waits for it, finishing any queued batch first
+    //The frames still go out back to back from the queue, but the caller waits for them like transfer16
+    void transferBatch(SpiBatch& batch);
+};
+
+#ifdef PWM_USE_MCPWM_PRELUDE
+//Motor PWM using the ESP-IDF 5 MCPWM timer, operator, comparator and generator objects
+//Each motor has a timer and two operators, one per H bridge input, so each input gets its own dead time
+//The right motor (channel A) is on MCPWM group 0 and the left motor (channel B) is on MCPWM group 1
+//Compare values load when the timer reaches zero, and a low on DRV_FAULT_PIN holds every output low
+//until the first timer zero after the fault goes away
+class Esp32McpwmPreludeBackend {
+  private:
+    mcpwm_timer_handle_t timers[MOTOR_COUNT];
+    mcpwm_oper_handle_t operators[MOTOR_COUNT][2];
+    mcpwm_cmpr_handle_t comparators[MOTOR_COUNT][2];
+    mcpwm_gen_handle_t generators[MOTOR_COUNT][2];
+    mcpwm_fault_handle_t faults[MOTOR_COUNT];
+    uint32_t periodTicks[MOTOR_COUNT];
+    uint32_t resolutionHz[MOTOR_COUNT];
+
+    bool setupMotor(MOTOR leftOrRightMotor, const PwmConfig& config);
+
+    bool setupOutput(MOTOR leftOrRightMotor, uint8_t output, int pin);
+
+    //Compare value that gives an output dutyTicks high once the dead time has been taken off
+    uint32_t compareTicksForDuty(MOTOR leftOrRightMotor, uint32_t dutyTicks);
+
+    //Drives both outputs low and deletes everything setupMotor created
+    void teardownMotor(MOTOR leftOrRightMotor);
+
+  public:
+    Esp32McpwmPreludeBackend();
+
+    //Sets up one motor's PWM, or changes it if it is already running
+    //A new frequency takes effect at the end of the current period, a new resolution rebuilds the timer
+    //Both outputs are left at 0% duty
+    bool configureMotor(MOTOR leftOrRightMotor, const PwmConfig& config);
+
+    //Number of timer ticks in one PWM period, duty is set in the same units
+    uint32_t getPeriodTicks(MOTOR leftOrRightMotor);
+
+    //Drives one input of the H bridge for dutyTicks of each period and holds the other one low
+    void setMotorOutput(MOTOR leftOrRightMotor, bool forward, uint32_t dutyTicks);
+
+    //Drives both inputs high for brakeTicks of each period, which turns on both low side FETs
+    //and brakes the motor, then low for the rest of the period so it coasts
+    void setMotorBrake(MOTOR leftOrRightMotor, uint32_t brakeTicks);
+};
+#else
+//Motor PWM using the legacy ESP-IDF 4 MCPWM driver
+//The right motor (channel A) is on MCPWM unit 0 and the left motor (channel B) is on MCPWM unit 1
+//Both comparators of a motor are written together and only take effect at the next timer zero,
+//so a change of direction never leaves one half of the H bridge updated and the other not
+class Esp32McpwmBackend {
+  private:
+    bool configured[MOTOR_COUNT];
+    uint32_t periodTicks[MOTOR_COUNT];
+
+    //Holds or releases the compare values of one motor's operator
+    void holdCompareUpdates(MOTOR leftOrRightMotor, bool hold);
+
+    //This driver only takes duty as a percentage, so ticks are converted back here
+    float ticksToDutyPercent(MOTOR leftOrRightMotor, uint32_t dutyTicks);
+
+  public:
+    Esp32McpwmBackend();
+
+    //Sets up one motor's PWM, or changes it if it is already running
+    //Both outputs are left at 0% duty
+    bool configureMotor(MOTOR leftOrRightMotor, const PwmConfig& config);
+
+    //Number of timer ticks in one PWM period, duty is set in the same units
+    uint32_t getPeriodTicks(MOTOR leftOrRightMotor);
+
+    //Drives one input of the H bridge for dutyTicks of each period and holds the other one low
+    void setMotorOutput(MOTOR leftOrRightMotor, bool forward, uint32_t dutyTicks);
+
+    //Drives both inputs high for brakeTicks of each period, which turns on both low side FETs
+    //and brakes the motor, then low for the rest of the period so it coasts
+    void setMotorBrake(MOTOR leftOrRightMotor, uint32_t brakeTicks);
+};
+#endif
+
+//Settings kept in the ESP32's NVS flash through Preferences, so they survive a reset or a new sketch upload
+//Each call opens and closes the namespace, these are only meant to be used at startup or on the bench
+class Esp32SettingsStore {
+  public:
+    //Copies the value saved under key into data, returns false if there is none or it is not length bytes long
+    bool load(const char* key, void* data, size_t length);
+
+    bool save(const char* key, const void* data, size_t length);
+
+    //Erases every value in SETTINGS_NAMESPACE
+    void clear();
+};
+
+#endif
+#endif
@@ -0,0 +1,191 @@
+#ifndef ARDUINO
+#include "hal_host.h"
+#include <string.h>
+
+HostSpiBus::HostSpiBus(){
+  deviceCount = 0;
+  transferCount = 0;
+  queuedBatch = nullptr;
+}
+
+void HostSpiBus::begin(){
+}
+
+void HostSpiBus::addDevice(uint8_t csPin){
+  for(uint8_t i = 0; i < deviceCount; i++){
+    if(devicePins[i] == csPin){
+      return;
+    }
+  }
+  if(deviceCount < HOST_SPI_MAX_DEVICES){
+    devicePins[deviceCount] = csPin;
+    devices[deviceCount] = nullptr;
+    deviceCount++;
+  }
+}
+
+void HostSpiBus::attachDevice(uint8_t csPin, HostSpiDevice* device){
+  addDevice(csPin);
+  for(uint8_t i = 0; i < deviceCount; i++){
+    if(devicePins[i] == csPin){
+      devices[i] = device;
+    }
+  }
+}
+
+uint16_t HostSpiBus::transfer16(uint8_t csPin, uint16_t frame){
+  runQueuedBatch();
+  transferCount++;
+  for(uint8_t i = 0; i < deviceCount; i++){
+    if(devicePins[i] == csPin && devices[i] != nullptr){
+      return devices[i]->transfer16(frame);
+    }
+  }
+  return 0xFFFF;
+}
+
+bool HostSpiBus::submitBatch(SpiBatch& batch){
+  if(batch.frameCount == 0 || queuedBatch != nullptr){
+    return false;
+  }
+  batch.state = SPI_BATCH_QUEUED;
+  queuedBatch = &batch;
+  return true;
+}
+
+bool HostSpiBus::pollBatch(SpiBatch& batch){
+  if(queuedBatch == &batch){
+    runQueuedBatch();
+  }
+  return batch.state == SPI_BATCH_DONE;
+}
+
+void HostSpiBus::transferBatch(SpiBatch& batch){
+  runQueuedBatch();
+  queuedBatch = &batch;
+  runQueuedBatch();
+}
+
+void HostSpiBus::runQueuedBatch(){
+  if(queuedBatch == nullptr){
+    return;
+  }
+  SpiBatch* batch = queuedBatch;
+  queuedBatch = nullptr;
+  for(uint8_t i = 0; i < batch->frameCount; i++){
+    batch->rxFrames[i] = transfer16(batch->csPins[i], batch->txFrames[i]);
+  }
+  batch->state = SPI_BATCH_DONE;
+}
+
+uint32_t HostSpiBus::getTransferCount(){
+  return transferCount;
+}
+
+HostPwmBackend::HostPwmBackend(){
+  updateCount = 0;
+  for(uint8_t i = 0; i < MOTOR_COUNT; i++){
+    frequencyHz[i] = 0;
+    periodTicks[i] = 0;
+    motorForward[i] = true;
+    motorBraking[i] = false;
+    motorDutyTicks[i] = 0;
+  }
+}
+
+bool HostPwmBackend::configureMotor(MOTOR leftOrRightMotor, const PwmConfig& config){
+  frequencyHz[leftOrRightMotor] = config.frequencyHz;
+  periodTicks[leftOrRightMotor] = config.periodTicks();
+  motorBraking[leftOrRightMotor] = false;
+  motorDutyTicks[leftOrRightMotor] = 0;
+  return true;
+}
+
+uint32_t HostPwmBackend::getPeriodTicks(MOTOR leftOrRightMotor){
+  return periodTicks[leftOrRightMotor];
+}
+
+void HostPwmBackend::setMotorOutput(MOTOR leftOrRightMotor, bool forward, uint32_t dutyTicks){
+  motorForward[leftOrRightMotor] = forward;
+  motorBraking[leftOrRightMotor] = false;
+  motorDutyTicks[leftOrRightMotor] = (dutyTicks > periodTicks[leftOrRightMotor]) ? periodTicks[leftOrRightMotor] : dutyTicks;
+  updateCount++;
+}
+
+void HostPwmBackend::setMotorBrake(MOTOR leftOrRightMotor, uint32_t brakeTicks){
+  motorBraking[leftOrRightMotor] = true;
+  motorDutyTicks[leftOrRightMotor] = (brakeTicks > periodTicks[leftOrRightMotor]) ? periodTicks[leftOrRightMotor] : brakeTicks;
+  updateCount++;
+}
+
+bool HostPwmBackend::isMotorBraking(MOTOR leftOrRightMotor){
+  return motorBraking[leftOrRightMotor];
+}
+
+bool HostPwmBackend::isMotorForward(MOTOR leftOrRightMotor){
+  return motorForward[leftOrRightMotor];
+}
+
+uint32_t HostPwmBackend::getMotorDutyTicks(MOTOR leftOrRightMotor){
+  return motorDutyTicks[leftOrRightMotor];
+}
+
+float HostPwmBackend::getMotorDuty(MOTOR leftOrRightMotor){
+  if(periodTicks[leftOrRightMotor] == 0){
+    return 0.0f;
+  }
+  return motorDutyTicks[leftOrRightMotor] * 100.0f / periodTicks[leftOrRightMotor];
+}
+
+uint32_t HostPwmBackend::getFrequency(MOTOR leftOrRightMotor){
+  return frequencyHz[leftOrRightMotor];
+}
+
+uint32_t HostPwmBackend::getUpdateCount(){
+  return updateCount;
+}
+
+HostSettingsStore::HostSettingsStore(){
+  clear();
+}
+
+int8_t HostSettingsStore::findEntry(const char* key){
+  for(uint8_t i = 0; i < entryCount; i++){
+    if(strncmp(keys[i], key, HOST_SETTINGS_MAX_KEY_LENGTH) == 0){
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool HostSettingsStore::load(const char* key, void* data, size_t length){
+  int8_t entry = findEntry(key);
+  if(entry < 0 || lengths[entry] != length){
+    return false;
+  }
+  memcpy(data, values[entry], length);
+  return true;
+}
+
+bool HostSettingsStore::save(const char* key, const void* data, size_t length){
+  if(strlen(key) >= HOST_SETTINGS_MAX_KEY_LENGTH || length > HOST_SETTINGS_MAX_BYTES){
+    return false;
+  }
+  int8_t entry = findEntry(key);
+  if(entry < 0){
+    if(entryCount >= HOST_SETTINGS_MAX_ENTRIES){
+      return false;
+    }
+    entry = entryCount++;
+    strcpy(keys[entry], key);
+  }
+  memcpy(values[entry], data, length);
+  lengths[entry] = length;
+  return true;
+}
+
+void HostSettingsStore::clear(){
+  entryCount = 0;
+}
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef __HAL_HOST__
+#define __HAL_HOST__
+#ifndef ARDUINO
+#include <stdint.h>
+#include <stddef.h>
+#include "motor_types.h"
+#include "pwm_config.h"
+#include "spi_batch.h"
+
+//Same pin numbers as the control board so code that refers to them still builds
+#define AOUT1 26
+#define AOUT2 25
+#define BOUT1 33
+#define BOUT2 32
+
+#define HOST_SPI_MAX_DEVICES 8
+
+#define HOST_SETTINGS_MAX_ENTRIES 8
+#define HOST_SETTINGS_MAX_KEY_LENGTH 16
+#define HOST_SETTINGS_MAX_BYTES 128
+
+//Something that answers SPI frames on the host, e.g. a simulated DRV8711
+class HostSpiDevice {
+  public:
+    virtual ~HostSpiDevice() {}
+
+    virtual uint16_t transfer16(uint16_t frame) = 0;
+};
+
+//SPI bus for building on a PC
+//Frames go to whichever HostSpiDevice is attached to the chip select pin
+//With nothing attached, reads come back as all 1s like a real bus with nothing answering
+//A submitted batch is only sent when it is polled or the next blocking transfer is made,
+//so code that reads a batch's results before polling it sees stale frames here as well as on the board
+class HostSpiBus {
+  private:
+    uint8_t devicePins[HOST_SPI_MAX_DEVICES];
+    HostSpiDevice* devices[HOST_SPI_MAX_DEVICES];
+    uint8_t deviceCount;
+    uint32_t transferCount;
+
+    //Batch that has been submitted and not sent yet
+    SpiBatch* queuedBatch;
+
+    void runQueuedBatch();
+
+  public:
+    HostSpiBus();
+
+    void begin();
+
+    void addDevice(uint8_t csPin);
+
+    //Connects a device to a chip select pin, pass nullptr to disconnect it
+    void attachDevice(uint8_t csPin, HostSpiDevice* device);
+
+    //Sends one frame and waits for the reply, finishing any queued batch first
+    uint16_t transfer16(uint8_t csPin, uint16_t frame);
+
+    //Queues a batch, returns false if it is empty or another batch has not finished
+    bool submitBatch(SpiBatch& batch);
+
+    //Returns true once every frame of the batch has been sent
+    bool pollBatch(SpiBatch& batch);
+
+    //Sends a batch straight away and waits for it, finishing any queued batch first
+    void transferBatch(SpiBatch& batch);
+
+    //Number of 16 bit frames sent since the bus was created
+    uint32_t getTransferCount();
+};
+
+//Records what each motor output was last set to instead of driving pins
+class HostPwmBackend {
+  private:
+    uint32_t frequencyHz[MOTOR_COUNT];
+    uint32_t periodTicks[MOTOR_COUNT];
+    bool motorForward[MOTOR_COUNT];
+    bool motorBraking[MOTOR_COUNT];
+    uint32_t motorDutyTicks[MOTOR_COUNT];
+    uint32_t updateCount;
+
+  public:
+    HostPwmBackend();
+
+    //Both outputs are left at 0% duty, like on the board
+    bool configureMotor(MOTOR leftOrRightMotor, const PwmConfig& config);
+
+    uint32_t getPeriodTicks(MOTOR leftOrRightMotor);
+
+    void setMotorOutput(MOTOR leftOrRightMotor, bool forward, uint32_t dutyTicks);
+
+    //Both inputs high for brakeTicks of each period, after this the duty is the brake duty
+    void setMotorBrake(MOTOR leftOrRightMotor, uint32_t brakeTicks);
+
+    bool isMotorBraking(MOTOR leftOrRightMotor);
+
+    bool isMotorForward(MOTOR leftOrRightMotor);
+
+    uint32_t getMotorDutyTicks(MOTOR leftOrRightMotor);
+
+    //Duty as a percentage of the period
+    float getMotorDuty(MOTOR leftOrRightMotor);
+
+    uint32_t getFrequency(MOTOR leftOrRightMotor);
+
+    //Number of times setMotorOutput or setMotorBrake has been called
+    uint32_t getUpdateCount();
+};
+
+//Settings storage for building on a PC, values are only kept in memory
+class HostSettingsStore {
+  private:
+    char keys[HOST_SETTINGS_MAX_ENTRIES][HOST_SETTINGS_MAX_KEY_LENGTH];
+    uint8_t values[HOST_SETTINGS_MAX_ENTRIES][HOST_SETTINGS_MAX_BYTES];
+    size_t lengths[HOST_SETTINGS_MAX_ENTRIES];
+    uint8_t entryCount;
+
+    //Index of the entry for key, or -1 if there is none
+    int8_t findEntry(const char* key);
+
+  public:
+    HostSettingsStore();
+
+    //Copies the value saved under key into data, returns false if there is none or it is not length bytes long
+    bool load(const char* key, void* data, size_t length);
+
+    bool save(const char* key, const void* data, size_t length);
+
+    //Forgets every saved value, like erasing the flash
+    void clear();
+};
+
+#endif
+#endif
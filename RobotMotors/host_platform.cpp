@@ -0,0 +1,98 @@
+#ifndef ARDUINO
+#include "host_platform.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <chrono>
+#include <thread>
+
+HostSerial Serial;
+
+static const std::chrono::steady_clock::time_point programStart = std::chrono::steady_clock::now();
+
+//Added to the real time by advanceHostClock
+static uint64_t clockOffsetUs = 0;
+
+HostSerial::HostSerial(){
+  output = stdout;
+}
+
+void HostSerial::begin(unsigned long baud){
+  (void)baud;
+}
+
+void HostSerial::setOutput(FILE* stream){
+  output = stream;
+}
+
+int HostSerial::printf(const char* format, ...){
+  va_list args;
+  va_start(args, format);
+  int length = vfprintf(output, format, args);
+  va_end(args);
+  return length;
+}
+
+size_t HostSerial::print(char c){
+  return fputc(c, output) == EOF ? 0 : 1;
+}
+
+size_t HostSerial::print(const char* text){
+  return fputs(text, output) == EOF ? 0 : 1;
+}
+
+size_t HostSerial::println(){
+  return print('\n');
+}
+
+size_t HostSerial::println(const char* text){
+  return print(text) + println();
+}
+
+size_t HostSerial::write(uint8_t byte){
+  return fwrite(&byte, 1, 1, output);
+}
+
+size_t HostSerial::write(const uint8_t* data, size_t length){
+  return fwrite(data, 1, length, output);
+}
+
+unsigned long millis(){
+  return (unsigned long)((std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - programStart).count() + clockOffsetUs) / 1000);
+}
+
+unsigned long micros(){
+  return (unsigned long)(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - programStart).count() + clockOffsetUs);
+}
+
+void advanceHostClock(uint32_t us){
+  clockOffsetUs += us;
+}
+
+void delay(uint32_t ms){
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us){
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void pinMode(uint8_t pin, uint8_t mode){
+  (void)pin;
+  (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value){
+  (void)pin;
+  (void)value;
+}
+
+int digitalRead(uint8_t pin){
+  (void)pin;
+  return LOW;
+}
+
+long map(long value, long fromLow, long fromHigh, long toLow, long toHigh){
+  return (value - fromLow) * (toHigh - toLow) / (fromHigh - fromLow) + toLow;
+}
+
+#endif
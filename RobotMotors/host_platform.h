@@ -0,0 +1,57 @@
+#ifndef __HOST_PLATFORM__
+#define __HOST_PLATFORM__
+#ifndef ARDUINO
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+//Stand ins for the parts of the Arduino core the library uses, for building on a PC
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define LOW 0x0
+#define HIGH 0x1
+
+//Prints to stdout, or another stream set with setOutput
+class HostSerial {
+  private:
+    FILE* output;
+
+  public:
+    HostSerial();
+
+    void begin(unsigned long baud);
+
+    //Send everything printed to stream instead, e.g. to keep log output out of benchmark results
+    void setOutput(FILE* stream);
+
+    int printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    size_t print(char c);
+    size_t print(const char* text);
+    size_t println();
+    size_t println(const char* text);
+    size_t write(uint8_t byte);
+    size_t write(const uint8_t* data, size_t length);
+};
+
+extern HostSerial Serial;
+
+//Time since the program started
+unsigned long millis();
+unsigned long micros();
+
+//Moves millis() and micros() on as if the time had passed, so code that works over time can run faster than real time
+void advanceHostClock(uint32_t us);
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+//There are no pins on a PC, these do nothing and digitalRead always returns LOW
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+long map(long value, long fromLow, long fromHigh, long toLow, long toHigh);
+
+#endif
+#endif
@@ -0,0 +1,149 @@
+#include "latency_trace.h"
+
+#if LATENCY_TRACE
+LatencyTrace latencyTrace;
+#endif
+
+static const char* const LATENCY_STAGE_NAMES[LATENCY_STAGE_COUNT] = {
+  "BP32 update",
+  "Read to mapped",
+  "Mapped to published",
+  "Published to applied",
+  "Read to applied"
+};
+
+//Values below 4 get a bucket each, above that the top bit picks the power of 2 and the next 2 bits the quarter
+static uint8_t latencyBucket(uint32_t latencyUs){
+  const uint32_t subBuckets = 1 << LATENCY_SUB_BUCKET_BITS;
+  if(latencyUs < subBuckets){
+    return (uint8_t)latencyUs;
+  }
+  uint32_t topBit = 31 - __builtin_clz(latencyUs);
+  uint32_t bucket = (topBit - LATENCY_SUB_BUCKET_BITS + 1) * subBuckets +
+    ((latencyUs >> (topBit - LATENCY_SUB_BUCKET_BITS)) & (subBuckets - 1));
+  return (bucket < LATENCY_BUCKET_COUNT) ? (uint8_t)bucket : LATENCY_BUCKET_COUNT - 1;
+}
+
+//Largest latency that goes in a bucket
+static uint32_t latencyBucketTopUs(uint8_t bucket){
+  const uint32_t subBuckets = 1 << LATENCY_SUB_BUCKET_BITS;
+  if(bucket < subBuckets){
+    return bucket;
+  }
+  uint32_t topBit = bucket / subBuckets + LATENCY_SUB_BUCKET_BITS - 1;
+  uint32_t quarter = bucket % subBuckets;
+  return ((subBuckets + quarter + 1) << (topBit - LATENCY_SUB_BUCKET_BITS)) - 1;
+}
+
+LatencyHistogram::LatencyHistogram(){
+  reset();
+}
+
+void LatencyHistogram::record(uint32_t latencyUs){
+  buckets[latencyBucket(latencyUs)]++;
+  if(count == 0 || latencyUs < minUs){
+    minUs = latencyUs;
+  }
+  if(latencyUs > maxUs){
+    maxUs = latencyUs;
+  }
+  count++;
+}
+
+void LatencyHistogram::reset(){
+  for(uint8_t i = 0; i < LATENCY_BUCKET_COUNT; i++){
+    buckets[i] = 0;
+  }
+  count = 0;
+  minUs = 0;
+  maxUs = 0;
+}
+
+uint32_t LatencyHistogram::getCount(){
+  return count;
+}
+
+uint32_t LatencyHistogram::getMinUs(){
+  return minUs;
+}
+
+uint32_t LatencyHistogram::getMaxUs(){
+  return maxUs;
+}
+
+uint32_t LatencyHistogram::getPercentileUs(uint16_t permille){
+  uint32_t total = count;
+  if(total == 0){
+    return 0;
+  }
+
+  //Round up so p99 of fewer than 100 samples is the largest one
+  uint32_t target = (uint32_t)(((uint64_t)total * permille + 999) / 1000);
+  uint32_t seen = 0;
+  for(uint8_t i = 0; i < LATENCY_BUCKET_COUNT; i++){
+    seen += buckets[i];
+    if(seen >= target && i < LATENCY_BUCKET_COUNT - 1){
+      uint32_t topUs = latencyBucketTopUs(i);
+      return (topUs < maxUs) ? topUs : maxUs;
+    }
+  }
+  return maxUs;
+}
+
+void LatencyTrace::record(LATENCY_STAGE stage, uint32_t startUs, uint32_t endUs){
+  if(stage < LATENCY_STAGE_COUNT){
+    histograms[stage].record(endUs - startUs);
+  }
+}
+
+LatencyHistogram& LatencyTrace::getHistogram(LATENCY_STAGE stage){
+  return histograms[(stage < LATENCY_STAGE_COUNT) ? stage : 0];
+}
+
+void LatencyTrace::reset(){
+  for(uint8_t i = 0; i < LATENCY_STAGE_COUNT; i++){
+    histograms[i].reset();
+  }
+}
+
+void LatencyTrace::print(){
+  Serial.printf("%-22s %8s %8s %8s %8s %8s\n", "Latency (us)", "count", "min", "p50", "p99", "max");
+  for(uint8_t i = 0; i < LATENCY_STAGE_COUNT; i++){
+    LatencyHistogram& histogram = histograms[i];
+    Serial.printf("%-22s %8u %8u %8u %8u %8u\n", LATENCY_STAGE_NAMES[i], histogram.getCount(),
+      histogram.getMinUs(), histogram.getPercentileUs(500), histogram.getPercentileUs(990), histogram.getMaxUs());
+  }
+}
+
+bool testLatencyHistogram(){
+  //Every value has to land in a bucket whose top is at or above it and less than 25% above it
+  for(uint32_t latencyUs = 0; latencyUs < 100000; latencyUs++){
+    uint32_t topUs = latencyBucketTopUs(latencyBucket(latencyUs));
+    if(topUs < latencyUs || (latencyUs >= 4 && topUs - latencyUs > latencyUs / 4)){
+      return false;
+    }
+  }
+
+  //1 to 100us once each
+  LatencyHistogram histogram;
+  for(uint32_t latencyUs = 1; latencyUs <= 100; latencyUs++){
+    histogram.record(latencyUs);
+  }
+  if(histogram.getCount() != 100 || histogram.getMinUs() != 1 || histogram.getMaxUs() != 100){
+    return false;
+  }
+
+  //p50 is 50us, which is in the 48-55us bucket, and p99 is 99us, in the 96-111us bucket but capped at the max
+  if(histogram.getPercentileUs(500) != 55 || histogram.getPercentileUs(990) != 100){
+    return false;
+  }
+
+  //Anything past the last bucket still counts, with the exact max
+  histogram.record(1000000);
+  if(histogram.getPercentileUs(1000) != 1000000){
+    return false;
+  }
+
+  histogram.reset();
+  return histogram.getCount() == 0 && histogram.getPercentileUs(500) == 0;
+}
@@ -0,0 +1,92 @@
+#ifndef __LATENCY_TRACE__
+#define __LATENCY_TRACE__
+#include "platform.h"
+
+//Set this to 0 to remove the latency instrumentation completely
+#ifndef LATENCY_TRACE
+#define LATENCY_TRACE 1
+#endif
+
+//Each power of 2 is split into 4 buckets, so a bucket is never more than 25% wide
+//64 buckets covers up to 131ms, anything longer goes in the last bucket
+#define LATENCY_SUB_BUCKET_BITS 2
+#define LATENCY_BUCKET_COUNT 64
+
+//Stages between a controller report and the PWM duty it leads to
+//Timestamps come from micros() rather than the cycle counter, as the stages run on both cores
+//and each core has its own cycle counter
+enum LATENCY_STAGE {
+    //Start of loop() until BP32.update() has returned with a new report
+    LATENCY_BP32_UPDATE = 0,
+    //Report read until the motor duties have been worked out from it
+    LATENCY_READ_TO_MAPPED = 1,
+    //Duties worked out until they have been published for the control task
+    LATENCY_MAPPED_TO_PUBLISHED = 2,
+    //Setpoint published until the control task has written it to the PWM
+    //The comparators load it at the next timer zero, up to one PWM period later
+    LATENCY_PUBLISHED_TO_APPLIED = 3,
+    //Report read until the duty has been written to the PWM
+    LATENCY_READ_TO_APPLIED = 4,
+    LATENCY_STAGE_COUNT = 5
+};
+
+//Histogram of latencies in microseconds with fixed buckets
+//Only one task may record into a histogram, others can read it at any time
+class LatencyHistogram {
+  private:
+    uint32_t buckets[LATENCY_BUCKET_COUNT];
+    uint32_t count;
+    uint32_t minUs;
+    uint32_t maxUs;
+
+  public:
+    LatencyHistogram();
+
+    void record(uint32_t latencyUs);
+
+    void reset();
+
+    uint32_t getCount();
+
+    uint32_t getMinUs();
+
+    uint32_t getMaxUs();
+
+    //Latency that permille thousandths of the samples are at or below, e.g. 990 for p99
+    //This is the top of the bucket the sample is in, so it can be up to 25% high
+    uint32_t getPercentileUs(uint16_t permille);
+};
+
+//One histogram per LATENCY_STAGE
+class LatencyTrace {
+  private:
+    LatencyHistogram histograms[LATENCY_STAGE_COUNT];
+
+  public:
+    //Records endUs - startUs against a stage, both from micros()
+    void record(LATENCY_STAGE stage, uint32_t startUs, uint32_t endUs);
+
+    LatencyHistogram& getHistogram(LATENCY_STAGE stage);
+
+    //Counts recorded while this runs may be lost
+    void reset();
+
+    //Prints count, min, p50, p99 and max for every stage
+    void print();
+};
+
+//Checks the bucket edges and percentiles against known samples, returns true if they all match
+bool testLatencyHistogram();
+
+#if LATENCY_TRACE
+extern LatencyTrace latencyTrace;
+
+#define LATENCY_NOW() ((uint32_t)micros())
+#define LATENCY_RECORD(stage, startUs, endUs) latencyTrace.record(stage, startUs, endUs)
+#else
+//The timestamps are all 0 and nothing is recorded, the compiler removes the calls completely
+#define LATENCY_NOW() ((uint32_t)0)
+#define LATENCY_RECORD(stage, startUs, endUs) do { (void)(startUs); (void)(endUs); } while(0)
+#endif
+
+#endif
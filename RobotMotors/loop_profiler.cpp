@@ -0,0 +1,172 @@
+#include "loop_profiler.h"
+#ifndef ARDUINO
+#include <chrono>
+#endif
+
+#if LOOP_PROFILER
+LoopProfiler loopProfiler;
+#endif
+
+static const char* const PROFILE_PHASE_NAMES[PROFILE_PHASE_COUNT] = {
+  "BP32 update",
+  "Input processing",
+  "Status LED",
+  "Stats print",
+  "Log print",
+  "PWM apply",
+  "Fault poll"
+};
+
+//Task each phase runs in, used to estimate the load on each task when FreeRTOS cannot say
+#define PROFILE_TASK_COUNT 3
+static const char* const PROFILE_TASK_NAMES[PROFILE_TASK_COUNT] = {"Loop", "EventLog", "MotorControl"};
+static const uint8_t PROFILE_PHASE_TASKS[PROFILE_PHASE_COUNT] = {0, 0, 0, 0, 1, 2, 2};
+
+LoopProfiler::LoopProfiler(){
+  //The cycle counter runs at the CPU clock, on the host now() counts nanoseconds
+#ifdef ARDUINO
+  ticksPerUs = 240;
+#else
+  ticksPerUs = 1000;
+#endif
+  for(uint8_t i = 0; i < PROFILE_PHASE_COUNT; i++){
+    calls[i] = 0;
+    totalUs[i] = 0;
+    maxTicks[i] = 0;
+    maxWindow[i] = 0;
+    remainderTicks[i] = 0;
+    printedCalls[i] = 0;
+    printedUs[i] = 0;
+  }
+  lastPrintUs = 0;
+  window = 0;
+#ifdef PROFILER_TASK_STATS
+  taskCount = 0;
+  lastTotalRunTime = 0;
+#endif
+}
+
+void LoopProfiler::begin(){
+#ifdef ARDUINO
+  ticksPerUs = getCpuFrequencyMhz();
+#endif
+  lastPrintUs = micros();
+}
+
+uint32_t LoopProfiler::now(){
+#ifdef ARDUINO
+  return ESP.getCycleCount();
+#else
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void LoopProfiler::record(PROFILE_PHASE phase, uint32_t startTicks, uint32_t endTicks){
+  //The counter wraps every few seconds, the difference is still right as long as the phase is shorter than that
+  uint32_t elapsedTicks = endTicks - startTicks;
+  if(maxWindow[phase] != window){
+    maxWindow[phase] = window;
+    maxTicks[phase] = 0;
+  }
+  if(elapsedTicks > maxTicks[phase]){
+    maxTicks[phase] = elapsedTicks;
+  }
+
+  uint32_t ticks = remainderTicks[phase] + elapsedTicks;
+  uint32_t elapsedUs = ticks / ticksPerUs;
+  remainderTicks[phase] = ticks - elapsedUs * ticksPerUs;
+  totalUs[phase] += elapsedUs;
+  calls[phase]++;
+}
+
+PhaseStats LoopProfiler::getPhaseStats(PROFILE_PHASE phase){
+  PhaseStats stats;
+  stats.calls = calls[phase];
+  stats.totalUs = totalUs[phase];
+  stats.maxUs = (maxWindow[phase] == window) ? maxTicks[phase] / ticksPerUs : 0;
+  return stats;
+}
+
+void LoopProfiler::print(){
+  uint32_t nowUs = micros();
+  uint32_t windowUs = nowUs - lastPrintUs;
+  lastPrintUs = nowUs;
+  if(windowUs == 0){
+    windowUs = 1;
+  }
+
+  Serial.printf("Profile over %u ms\n", windowUs / 1000);
+  Serial.printf("%-17s %-13s %8s %8s %8s %7s\n", "Phase", "task", "calls", "mean us", "max us", "load %");
+  uint32_t phaseUs[PROFILE_PHASE_COUNT];
+  for(uint8_t i = 0; i < PROFILE_PHASE_COUNT; i++){
+    uint32_t phaseCalls = calls[i] - printedCalls[i];
+    phaseUs[i] = totalUs[i] - printedUs[i];
+    printedCalls[i] += phaseCalls;
+    printedUs[i] += phaseUs[i];
+    uint32_t maxUs = (maxWindow[i] == window) ? maxTicks[i] / ticksPerUs : 0;
+
+    Serial.printf("%-17s %-13s %8u %8.1f %8u %7.2f\n", PROFILE_PHASE_NAMES[i], PROFILE_TASK_NAMES[PROFILE_PHASE_TASKS[i]],
+      phaseCalls, (phaseCalls > 0) ? (float)phaseUs[i] / phaseCalls : 0.0f, maxUs, phaseUs[i] * 100.0f / windowUs);
+  }
+  window = window + 1;
+  printTaskLoad(phaseUs, windowUs);
+}
+
+#ifdef PROFILER_TASK_STATS
+void LoopProfiler::printTaskLoad(const uint32_t* phaseUs, uint32_t windowUs){
+  (void)phaseUs;
+  (void)windowUs;
+  TaskStatus_t statuses[PROFILER_MAX_TASKS];
+  uint32_t totalRunTime = 0;
+  UBaseType_t count = uxTaskGetSystemState(statuses, PROFILER_MAX_TASKS, &totalRunTime);
+  if(count == 0){
+    Serial.printf("CPU load: more than %u tasks, nothing to show\n", PROFILER_MAX_TASKS);
+    return;
+  }
+
+  //The run time counter counts for each core, so 100% is one whole core
+  uint32_t totalDelta = totalRunTime - lastTotalRunTime;
+  lastTotalRunTime = totalRunTime;
+  Serial.printf("CPU load (%% of one core):");
+  for(UBaseType_t i = 0; i < count; i++){
+    uint32_t previousRunTime = 0;
+    for(uint8_t j = 0; j < taskCount; j++){
+      if(taskHandles[j] == statuses[i].xHandle){
+        previousRunTime = taskRunTimes[j];
+      }
+    }
+    uint32_t taskDelta = statuses[i].ulRunTimeCounter - previousRunTime;
+    Serial.printf(" %s %.1f", statuses[i].pcTaskName, (totalDelta > 0) ? taskDelta * 100.0f / totalDelta : 0.0f);
+  }
+  Serial.println();
+
+  taskCount = 0;
+  for(UBaseType_t i = 0; i < count; i++){
+    taskHandles[taskCount] = statuses[i].xHandle;
+    taskRunTimes[taskCount] = statuses[i].ulRunTimeCounter;
+    taskCount++;
+  }
+}
+#else
+void LoopProfiler::printTaskLoad(const uint32_t* phaseUs, uint32_t windowUs){
+  //Without run time stats the best we can do is add up the phases each task was seen in
+  uint32_t taskUs[PROFILE_TASK_COUNT] = {0};
+  for(uint8_t i = 0; i < PROFILE_PHASE_COUNT; i++){
+    taskUs[PROFILE_PHASE_TASKS[i]] += phaseUs[i];
+  }
+  Serial.printf("CPU load from profiled phases (%% of one core):");
+  for(uint8_t i = 0; i < PROFILE_TASK_COUNT; i++){
+    Serial.printf(" %s %.1f", PROFILE_TASK_NAMES[i], taskUs[i] * 100.0f / windowUs);
+  }
+  Serial.println();
+}
+#endif
+
+ProfileScope::ProfileScope(LoopProfiler& scopeProfiler, PROFILE_PHASE scopePhase) : profiler(scopeProfiler){
+  phase = scopePhase;
+  startTicks = LoopProfiler::now();
+}
+
+ProfileScope::~ProfileScope(){
+  profiler.record(phase, startTicks, LoopProfiler::now());
+}
@@ -0,0 +1,115 @@
+#ifndef __LOOP_PROFILER__
+#define __LOOP_PROFILER__
+#include "platform.h"
+
+//Set this to 0 to remove the profiler completely
+#ifndef LOOP_PROFILER
+#define LOOP_PROFILER 1
+#endif
+
+//FreeRTOS can only report how long each task has run for if the core was built with run time stats
+#if defined(ARDUINO) && defined(configGENERATE_RUN_TIME_STATS) && defined(configUSE_TRACE_FACILITY)
+#if (configGENERATE_RUN_TIME_STATS == 1) && (configUSE_TRACE_FACILITY == 1)
+#define PROFILER_TASK_STATS
+#endif
+#endif
+
+//Most tasks the CPU load summary keeps track of
+#define PROFILER_MAX_TASKS 24
+
+//Parts of the program the profiler times
+//Each one only ever runs in one task, so the counters never need a lock
+enum PROFILE_PHASE {
+    //loop(), on the Arduino loop task
+    PROFILE_BP32_UPDATE = 0,
+    PROFILE_INPUT_PROCESSING = 1,
+    PROFILE_STATUS_LED = 2,
+    PROFILE_STATS_PRINT = 3,
+    //Formatting and printing queued log messages, on the event log task
+    PROFILE_LOG_PRINT = 4,
+    //Motors::controlStep, on the control task
+    PROFILE_PWM_APPLY = 5,
+    PROFILE_FAULT_POLL = 6,
+    PROFILE_PHASE_COUNT = 7
+};
+
+struct PhaseStats {
+  uint32_t calls;
+  uint32_t totalUs;
+  uint32_t maxUs;
+};
+
+//Adds up how much time is spent in each PROFILE_PHASE
+//Times are taken from the CPU cycle counter, each phase starts and ends on the same core
+class LoopProfiler {
+  private:
+    uint32_t ticksPerUs;
+
+    uint32_t calls[PROFILE_PHASE_COUNT];
+    uint32_t totalUs[PROFILE_PHASE_COUNT];
+
+    //Longest record in the current summary window
+    //print() starts a new window and each phase clears its own maximum on its first record in it,
+    //so only the task that records a phase ever writes to it
+    uint32_t maxTicks[PROFILE_PHASE_COUNT];
+    uint32_t maxWindow[PROFILE_PHASE_COUNT];
+    volatile uint32_t window;
+
+    //Part of a microsecond left over from each phase's last record, so short phases still add up
+    uint32_t remainderTicks[PROFILE_PHASE_COUNT];
+
+    //Totals at the last print, so each summary covers the time since the one before
+    uint32_t printedCalls[PROFILE_PHASE_COUNT];
+    uint32_t printedUs[PROFILE_PHASE_COUNT];
+    uint32_t lastPrintUs;
+
+#ifdef PROFILER_TASK_STATS
+    //Run time of each task at the last print
+    TaskHandle_t taskHandles[PROFILER_MAX_TASKS];
+    uint32_t taskRunTimes[PROFILER_MAX_TASKS];
+    uint8_t taskCount;
+    uint32_t lastTotalRunTime;
+#endif
+
+    void printTaskLoad(const uint32_t* phaseUs, uint32_t windowUs);
+
+  public:
+    LoopProfiler();
+
+    //Reads the CPU clock speed, call this from setup()
+    void begin();
+
+    //Current value of the cycle counter
+    static uint32_t now();
+
+    void record(PROFILE_PHASE phase, uint32_t startTicks, uint32_t endTicks);
+
+    //Calls and time since the program started, and the longest call since the last print
+    PhaseStats getPhaseStats(PROFILE_PHASE phase);
+
+    //Prints the time spent in each phase and the load on each task since the last print
+    void print();
+};
+
+//Times from where it is declared to the end of the enclosing block
+class ProfileScope {
+  private:
+    LoopProfiler& profiler;
+    PROFILE_PHASE phase;
+    uint32_t startTicks;
+
+  public:
+    ProfileScope(LoopProfiler& scopeProfiler, PROFILE_PHASE scopePhase);
+
+    ~ProfileScope();
+};
+
+#if LOOP_PROFILER
+extern LoopProfiler loopProfiler;
+
+#define PROFILE_SCOPE(phase) ProfileScope profileScope(loopProfiler, phase)
+#else
+#define PROFILE_SCOPE(phase) do {} while(0)
+#endif
+
+#endif
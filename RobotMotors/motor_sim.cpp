@@ -0,0 +1,89 @@
+#ifndef ARDUINO
+#include "motor_sim.h"
+
+//Longest step the model takes at once, shorter than any of the time constants so it stays stable
+#define MOTOR_SIM_STEP_US 100
+
+MotorSimulator::MotorSimulator(HostPwmBackend& pwmBackend){
+  pwm = &pwmBackend;
+  for(uint8_t i = 0; i < MOTOR_COUNT; i++){
+    speed[i] = 0.0f;
+    current[i] = 0.0f;
+  }
+
+  //Roughly a small geared DC motor driving a robot's wheels
+  setParameters(60.0f, 800.0f, 20.0f);
+}
+
+void MotorSimulator::setParameters(float electricalTimeConstantMs, float coastTimeConstantMs, float frictionPercentPerSecond){
+  electricalTimeConstantS = electricalTimeConstantMs / 1000.0f;
+  coastTimeConstantS = coastTimeConstantMs / 1000.0f;
+  frictionPerSecond = frictionPercentPerSecond / 100.0f;
+}
+
+void MotorSimulator::step(uint32_t elapsedUs){
+  while(elapsedUs > 0){
+    uint32_t stepUs = (elapsedUs > MOTOR_SIM_STEP_US) ? MOTOR_SIM_STEP_US : elapsedUs;
+    for(uint8_t i = 0; i < MOTOR_COUNT; i++){
+      stepMotor((MOTOR)i, stepUs / 1000000.0f);
+    }
+    elapsedUs -= stepUs;
+  }
+}
+
+void MotorSimulator::stepMotor(MOTOR leftOrRightMotor, float elapsedS){
+  float motorSpeed = speed[leftOrRightMotor];
+  float duty = pwm->getMotorDuty(leftOrRightMotor) / 100.0f;
+
+  //Voltage across the motor while the bridge is on, as a fraction of the supply
+  float onVoltage = 0.0f;
+  float onFraction = 0.0f;
+  if(pwm->isMotorBraking(leftOrRightMotor)){
+    onFraction = duty;
+  }
+  else if(duty > 0.0f){
+    onVoltage = pwm->isMotorForward(leftOrRightMotor) ? 1.0f : -1.0f;
+
+    //Once the motor is going faster than the duty the back EMF is higher than the average voltage,
+    //the current would have to flow backwards through the high side FET so the motor just coasts
+    float target = onVoltage * duty;
+    if((onVoltage > 0.0f && motorSpeed < target) || (onVoltage < 0.0f && motorSpeed > target)){
+      onFraction = duty;
+    }
+  }
+
+  //Current while the bridge is on is set by the difference between the applied voltage and the back EMF
+  float onCurrent = onVoltage - motorSpeed;
+  current[leftOrRightMotor] = onFraction * onCurrent;
+
+  float coastAcceleration = -motorSpeed / coastTimeConstantS;
+  if(motorSpeed > 0.0f){
+    coastAcceleration -= frictionPerSecond;
+  }
+  else if(motorSpeed < 0.0f){
+    coastAcceleration += frictionPerSecond;
+  }
+  float acceleration = onFraction * onCurrent / electricalTimeConstantS + (1.0f - onFraction) * coastAcceleration;
+
+  //Only driving can turn the motor the other way, friction and braking just stop it
+  float newSpeed = motorSpeed + acceleration * elapsedS;
+  bool driving = (onVoltage != 0.0f && onFraction > 0.0f);
+  if(!driving && ((motorSpeed > 0.0f && newSpeed < 0.0f) || (motorSpeed < 0.0f && newSpeed > 0.0f))){
+    newSpeed = 0.0f;
+  }
+  speed[leftOrRightMotor] = newSpeed;
+}
+
+float MotorSimulator::getSpeed(MOTOR leftOrRightMotor){
+  return speed[leftOrRightMotor];
+}
+
+void MotorSimulator::setSpeed(MOTOR leftOrRightMotor, float newSpeed){
+  speed[leftOrRightMotor] = newSpeed;
+}
+
+float MotorSimulator::getCurrent(MOTOR leftOrRightMotor){
+  return current[leftOrRightMotor];
+}
+
+#endif
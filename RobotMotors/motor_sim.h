@@ -0,0 +1,48 @@
+#ifndef __MOTOR_SIM__
+#define __MOTOR_SIM__
+#ifndef ARDUINO
+#include <stdint.h>
+#include "hal_host.h"
+
+//Simple model of the two drive motors for testing braking and ramps on the host
+//It reads what a HostPwmBackend was last set to and works out each motor's speed and current
+//averaged over a PWM period:
+//  driving: the supply is across the motor for the duty and the motor coasts for the rest,
+//           the H bridge can push the motor towards the duty's speed but not hold it back
+//  braking: the motor is shorted for the brake duty and coasts for the rest
+//  coasting: only friction slows the motor down
+//Speed is a fraction of the free running speed at 100% duty, current is a fraction of the stall current
+class MotorSimulator {
+  private:
+    HostPwmBackend* pwm;
+
+    float speed[MOTOR_COUNT];
+    float current[MOTOR_COUNT];
+
+    //Time for the speed to get 63% of the way to the duty when driven, or to 0 when shorted
+    float electricalTimeConstantS;
+
+    //Time for the speed to fall by 63% when coasting, and a constant drag from friction
+    float coastTimeConstantS;
+    float frictionPerSecond;
+
+    void stepMotor(MOTOR leftOrRightMotor, float elapsedS);
+
+  public:
+    MotorSimulator(HostPwmBackend& pwmBackend);
+
+    //Time constants are in milliseconds, friction is in % of free running speed lost per second
+    void setParameters(float electricalTimeConstantMs, float coastTimeConstantMs, float frictionPercentPerSecond);
+
+    //Moves both motors on by elapsedUs with the outputs the backend is set to now
+    void step(uint32_t elapsedUs);
+
+    float getSpeed(MOTOR leftOrRightMotor);
+
+    void setSpeed(MOTOR leftOrRightMotor, float newSpeed);
+
+    float getCurrent(MOTOR leftOrRightMotor);
+};
+
+#endif
+#endif
@@ -0,0 +1,16 @@
+#ifndef __MOTOR_TYPES__
+#define __MOTOR_TYPES__
+
+enum MOTOR {
+    LEFT_MOTOR = 0,
+    RIGHT_MOTOR = 1
+};
+
+#define MOTOR_COUNT 2
+
+enum BRAKE_MODE {
+    NEUTRAL = 0,
+    AUTO_BRAKE = 1
+};
+
+#endif
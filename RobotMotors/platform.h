@@ -0,0 +1,12 @@
+#ifndef __PLATFORM__
+#define __PLATFORM__
+
+//On the ESP32 this is just the Arduino core
+//Anywhere else it is a small set of stand ins so the library can be built and tested on a PC
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include "host_platform.h"
+#endif
+
+#endif
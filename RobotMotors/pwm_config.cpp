@@ -0,0 +1,33 @@
+#include "platform.h"
+#include "pwm_config.h"
+
+uint32_t PwmConfig::periodTicks() const{
+  if(frequencyHz == 0){
+    return 0;
+  }
+  return resolutionHz / frequencyHz;
+}
+
+bool validatePwmConfig(const PwmConfig& config){
+  if(config.resolutionHz == 0 || PWM_CLOCK_HZ % config.resolutionHz != 0){
+    Serial.printf("Error: PWM resolution %luHz does not divide exactly from the %luHz clock\n",
+      (unsigned long)config.resolutionHz, (unsigned long)PWM_CLOCK_HZ);
+    return false;
+  }
+
+  uint32_t divider = PWM_CLOCK_HZ / config.resolutionHz;
+  if(divider < PWM_MIN_CLOCK_DIVIDER || divider > PWM_MAX_CLOCK_DIVIDER){
+    Serial.printf("Error: PWM resolution %luHz is outside %luHz to %luHz\n", (unsigned long)config.resolutionHz,
+      (unsigned long)(PWM_CLOCK_HZ / PWM_MAX_CLOCK_DIVIDER), (unsigned long)(PWM_CLOCK_HZ / PWM_MIN_CLOCK_DIVIDER));
+    return false;
+  }
+
+  uint32_t periodTicks = config.periodTicks();
+  if(periodTicks < PWM_MIN_PERIOD_TICKS || periodTicks > PWM_MAX_PERIOD_TICKS){
+    Serial.printf("Error: PWM frequency %luHz needs %lu ticks per period at %luHz, it must be %i to %i\n",
+      (unsigned long)config.frequencyHz, (unsigned long)periodTicks, (unsigned long)config.resolutionHz,
+      PWM_MIN_PERIOD_TICKS, PWM_MAX_PERIOD_TICKS);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,31 @@
+#ifndef __PWM_CONFIG__
+#define __PWM_CONFIG__
+#include <stdint.h>
+
+//Clock the MCPWM timers are divided down from
+#define PWM_CLOCK_HZ 160000000
+
+//The MCPWM group clock is at most half of PWM_CLOCK_HZ, and the legacy driver sets the resolution
+//through the group prescaler alone, which only goes up to 256
+#define PWM_MIN_CLOCK_DIVIDER 2
+#define PWM_MAX_CLOCK_DIVIDER 256
+
+//The period register is 16 bits, and below 100 ticks a duty step is more than 1%
+#define PWM_MIN_PERIOD_TICKS 100
+#define PWM_MAX_PERIOD_TICKS 65535
+
+//Timer settings for one motor's PWM
+struct PwmConfig {
+  uint32_t frequencyHz;
+  uint32_t resolutionHz;
+
+  //Ticks in one period, the frequency actually produced is resolutionHz / periodTicks()
+  uint32_t periodTicks() const;
+};
+
+//Checks that the resolution can be divided exactly from PWM_CLOCK_HZ
+//and that the period fits the timer with at least PWM_MIN_PERIOD_TICKS steps
+//Prints why if it can't
+bool validatePwmConfig(const PwmConfig& config);
+
+#endif
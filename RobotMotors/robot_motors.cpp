@@ -1,115 +1,603 @@
-#include <Arduino.h>
+#include "platform.h"
 #include "robot_motors.h"
+#include "event_log.h"
+#include "latency_trace.h"
+#include "loop_profiler.h"
 
-DRV8711 drv8711Driver;
+SpiBus drvSpiBus;
+
+DRV8711 drv8711Driver(drvSpiBus);
+
+PwmBackend motorPwm;
+
+SettingsStore settingsStore;
 
 float currentLimit = 10.0f;
 
+//How long to wait after clearing each class of fault before checking it has gone
+//Over temperature needs time to cool down, over current can be retried almost straight away
+const uint32_t DEFAULT_FAULT_BACKOFF_MS[FAULT_CLASS_COUNT] = {
+  /*OTS*/ 2000,
+  /*OCP*/ 50,
+  /*PDF*/ 100,
+  /*UVLO*/ 250,
+  /*COMMS*/ 500
+};
+
 Motors::Motors(){
+  driver = &drv8711Driver;
+  drivers[0] = driver;
+  driverCount = 1;
+  pwm = &motorPwm;
+  resetState();
 }
 
-void Motors::init(){
-  drv8711Driver.init();
-  drv8711Driver.writeRegister(STATUS_REG_ADDR, 0);
-  drv8711Driver.configureDefaultBrushedMotorProfile();
+Motors::Motors(DRV8711& motorDriver, PwmBackend& pwmBackend){
+  driver = &motorDriver;
+  drivers[0] = driver;
+  driverCount = 1;
+  pwm = &pwmBackend;
+  resetState();
+}
 
-  mcpwm_config_t pwm_config;
-  pwm_config.frequency = PWM_FREQ;
-  pwm_config.cmpr_a = 0;    //duty cycle of PWMxA = 0
-  pwm_config.cmpr_b = 0;    //duty cycle of PWMxb = 0
-  pwm_config.counter_mode = MCPWM_UP_COUNTER;
-  pwm_config.duty_mode = MCPWM_DUTY_MODE_0;
-  mcpwm_init(MCPWM_UNIT_0, MCPWM_TIMER_0, &pwm_config);    //Configure PWM0A & PWM0B with above settings
-  mcpwm_init(MCPWM_UNIT_1, MCPWM_TIMER_1, &pwm_config);    //Configure PWM1A & PWM1B with above settings
+void Motors::resetState(){
+  for(uint8_t i = 0; i < MOTORS_MAX_DRIVERS; i++){
+    recoveries[i].state = RECOVERY_ARMED;
+    recoveries[i].faultMask = 0;
+    recoveries[i].fromCommsLoss = false;
+    recoveries[i].startMs = 0;
+    recoveries[i].backoffMs = 0;
+    recoveries[i].statusFrame = -1;
+    recoveries[i].readBack = false;
+    recoveries[i].statusReady = false;
+    recoveries[i].verifyWrites = false;
+    recoveries[i].faulted = false;
+  }
+  faultBatch.clear();
+  driverProfile = DRIVER_PROFILE_DEFAULT_BRUSHED;
+  for(uint8_t i = 0; i < FAULT_CLASS_COUNT; i++){
+    faultBackoffMs[i] = DEFAULT_FAULT_BACKOFF_MS[i];
+    faultCounts[i] = 0;
+  }
+  for(uint8_t i = 0; i < MOTOR_COUNT; i++){
+    motorFaulted[i] = false;
+    setpointTicks[i] = 0;
+    appliedTicks[i] = 0;
+    rampTicks[i] = 0;
+    appliedBraking[i] = false;
+    appliedBrakeTicks[i] = 0;
+    brakePolicies[i] = BRAKE_NEVER;
+    brakePermille[i] = 1000;
+    outputValid[i] = false;
+    pwmConfigs[i].frequencyHz = PWM_FREQ;
+    pwmConfigs[i].resolutionHz = PWM_RESOLUTION_HZ;
+    pwmPeriodTicks[i] = 0;
+    slewRemainder[i] = 0;
+  }
+  pwmStarted = false;
+  //What init() sets if setCurrentLimit is never called, looked up quietly as the log may not be set up yet
+  currentLimitGain = GAIN5;
+  currentLimitTorque = 0;
+  currentCalibration.lookup(currentLimit, currentLimitGain, currentLimitTorque);
+  pendingCurrentLimit.store(0);
+  pendingDriverProfile.store(0);
+  pendingDecayMode.store(0);
+  initTimes.driverUs = 0;
+  initTimes.pwmUs = 0;
+  initTimes.warmStart = false;
+  setpointBrakeMode = AUTO_BRAKE;
 
+  for(uint8_t i = 0; i < SLEW_PHASE_COUNT; i++){
+    slewPercentPerSecond[i] = 0.0f;
+  }
+  for(uint8_t i = 0; i < MOTOR_COUNT; i++){
+    updateSlewTicks((MOTOR)i);
+  }
+  lastSlewUs = 0;
+  slewStarted = false;
+
+  inputTimeoutUs = 0;
+  failsafeBrakePermille = 0;
+  inputSeen = false;
+  lastInputUs = 0;
+  resetInputWatchdogStats();
+}
+
+void Motors::init(){
+  uint32_t startUs = micros();
+  //This writes the profile and current limit itself, so nothing is left for the control task
+  pendingCurrentLimit.store(0);
+  pendingDriverProfile.store(0);
+  DRV8711Profile expected = expectedDriverRegisters();
+  initTimes.warmStart = driver->init() && driver->matchesProfile(expected);
+  driver->writeRegister(STATUS_REG_ADDR, 0);
+  if(initTimes.warmStart){
+    driver->setMotorEnabled(true);
+  }
+  else if(!driver->applyProfile(expected)){
+    Serial.println("Warning: motor driver registers did not read back as written");
+  }
+  initTimes.driverUs = micros() - startUs;
 
-  //Initialise motor control PWM for the right motor
-  mcpwm_gpio_init(MCPWM_UNIT_0, MCPWM0A, AOUT1);
-  mcpwm_gpio_init(MCPWM_UNIT_0, MCPWM0B, AOUT2);
+  startUs = micros();
+  //This leaves both outputs low, so the next speed must be written whatever it is
+  for(uint8_t i = 0; i < MOTOR_COUNT; i++){
+    if(!pwm->configureMotor((MOTOR)i, pwmConfigs[i])){
+      Serial.printf("Error: could not start the PWM for motor %i\n", i);
+    }
+    pwmPeriodTicks[i] = pwm->getPeriodTicks((MOTOR)i);
+    outputValid[i] = false;
+    updateSlewTicks((MOTOR)i);
+  }
+  pwmStarted = true;
+  initTimes.pwmUs = micros() - startUs;
+}
 
-  //Initialise motor control PWM for the left motor
-  mcpwm_gpio_init(MCPWM_UNIT_1, MCPWM1A, BOUT1);
-  mcpwm_gpio_init(MCPWM_UNIT_1, MCPWM1B, BOUT2);
+MotorsInitTimes Motors::getInitTimes(){
+  return initTimes;
 }
 
 
 void Motors::setMotorSpeed(MOTOR leftOrRightMotor, float speed){
-  if(speed >= 0.0f){
-    setMotorForwardSpeed(leftOrRightMotor, speed);
+  setMotorDutyTicks(leftOrRightMotor, speedToTicks(leftOrRightMotor, validateSpeed(speed)));
+}
+
+void Motors::setMotorDutyTicks(MOTOR leftOrRightMotor, int32_t dutyTicks){
+  driveMotor(leftOrRightMotor, dutyTicks);
+
+  //Carry on ramping from here the next time controlStep runs
+  rampTicks[leftOrRightMotor] = appliedTicks[leftOrRightMotor];
+}
+
+void Motors::setMotorBrake(MOTOR leftOrRightMotor, float brakePercent){
+  if(brakePercent < 0.0f || brakePercent > 100.0f){
+    Serial.printf("Warning: Brake %f%% is out of range, use 0 to 100\n", brakePercent);
+    brakePercent = (brakePercent < 0.0f) ? 0.0f : 100.0f;
+  }
+  setMotorBrakeTicks(leftOrRightMotor, (uint32_t)(brakePercent * pwmConfigs[leftOrRightMotor].periodTicks() / 100.0f + 0.5f));
+}
+
+void Motors::setMotorBrakeTicks(MOTOR leftOrRightMotor, uint32_t brakeTicks){
+  brakeMotor(leftOrRightMotor, brakeTicks);
+  rampTicks[leftOrRightMotor] = 0;
+}
+
+bool Motors::isMotorBraking(MOTOR leftOrRightMotor){
+  return appliedBraking[leftOrRightMotor];
+}
+
+void Motors::driveMotor(MOTOR leftOrRightMotor, int32_t dutyTicks){
+  int32_t periodTicks = (int32_t)pwmPeriodTicks[leftOrRightMotor];
+  if(dutyTicks > periodTicks){
+    dutyTicks = periodTicks;
+  }
+  else if(dutyTicks < -periodTicks){
+    dutyTicks = -periodTicks;
+  }
+
+  //Hold a faulted motor at 0 so it does not jump back to full speed when the fault clears
+  if(motorFaulted[leftOrRightMotor]){
+    dutyTicks = 0;
+  }
+  appliedTicks[leftOrRightMotor] = dutyTicks;
+  appliedBraking[leftOrRightMotor] = false;
+  appliedBrakeTicks[leftOrRightMotor] = 0;
+
+  if(dutyTicks >= 0){
+    applyMotorOutput(leftOrRightMotor, true, (uint32_t)dutyTicks);
   }
   else{
-    setMotorBackwardSpeed(leftOrRightMotor, speed);
+    applyMotorOutput(leftOrRightMotor, false, (uint32_t)-dutyTicks);
+  }
+}
+
+void Motors::brakeMotor(MOTOR leftOrRightMotor, uint32_t brakeTicks){
+  if(brakeTicks > pwmPeriodTicks[leftOrRightMotor]){
+    brakeTicks = pwmPeriodTicks[leftOrRightMotor];
+  }
+
+  //A brake of 0 is both inputs low, the same as driving at 0
+  if(brakeTicks == 0 || motorFaulted[leftOrRightMotor]){
+    driveMotor(leftOrRightMotor, 0);
+    return;
+  }
+  appliedTicks[leftOrRightMotor] = 0;
+  appliedBraking[leftOrRightMotor] = true;
+  appliedBrakeTicks[leftOrRightMotor] = brakeTicks;
+  applyMotorBrake(leftOrRightMotor, brakeTicks);
+}
+
+void Motors::publishSetpoint(SETPOINT_SOURCE source, float leftSpeed, float rightSpeed, BRAKE_MODE brakeMode){
+  if(source >= SETPOINT_SOURCE_COUNT){
+    return;
+  }
+
+  //Validate and convert here so the control task never has to print a warning or use floating point
+  publishSetpointTicks(source, speedToTicks(LEFT_MOTOR, validateSpeed(leftSpeed)),
+    speedToTicks(RIGHT_MOTOR, validateSpeed(rightSpeed)), brakeMode);
+}
+
+void Motors::publishSetpointTicks(SETPOINT_SOURCE source, int32_t leftTicks, int32_t rightTicks, BRAKE_MODE brakeMode, uint32_t inputTimestampUs){
+  if(source >= SETPOINT_SOURCE_COUNT){
+    return;
+  }
+
+  MotorSetpoint setpoint;
+  setpoint.dutyTicks[LEFT_MOTOR] = leftTicks;
+  setpoint.dutyTicks[RIGHT_MOTOR] = rightTicks;
+  setpoint.brakeMode = brakeMode;
+  setpoint.source = source;
+  setpoint.timestampUs = micros();
+  setpoint.inputTimestampUs = (inputTimestampUs != 0) ? inputTimestampUs : setpoint.timestampUs;
+  setpointMailboxes[source].publish(setpoint);
+}
+
+bool Motors::getLatestSetpoint(MotorSetpoint& latestSetpoint){
+  bool found = false;
+  for(uint8_t source = 0; source < SETPOINT_SOURCE_COUNT; source++){
+    MotorSetpoint setpoint;
+    if(!setpointMailboxes[source].read(setpoint)){
+      continue;
+    }
+
+    //Compare the difference rather than the raw timestamps so micros() wrapping round does not matter
+    if(!found || (int32_t)(setpoint.timestampUs - latestSetpoint.timestampUs) > 0){
+      latestSetpoint = setpoint;
+      found = true;
+    }
+  }
+  return found;
+}
+
+void Motors::controlStep(){
+  {
+    PROFILE_SCOPE(PROFILE_PWM_APPLY);
+    applyLatestSetpoint();
+  }
+
+  //This checks for any motor controller faults
+  //If any are detected it will print the error and try to automatically clear the faults
+  {
+    PROFILE_SCOPE(PROFILE_FAULT_POLL);
+    checkFaults();
+  }
+}
+
+void Motors::applyLatestSetpoint(){
+  MotorSetpoint setpoint = {};
+  bool setpointFound = getLatestSetpoint(setpoint);
+  if(setpointFound){
+    setpointTicks[LEFT_MOTOR] = setpoint.dutyTicks[LEFT_MOTOR];
+    setpointTicks[RIGHT_MOTOR] = setpoint.dutyTicks[RIGHT_MOTOR];
+    setpointBrakeMode = setpoint.brakeMode;
+  }
+
+  //Read the time after the setpoint so it is never older than the setpoint's timestamp
+  uint32_t nowUs = micros();
+  //A new timestamp means a new setpoint, the same setpoint is read again on every step until it is replaced
+  bool newSetpoint = setpointFound && (!inputSeen || setpoint.timestampUs != lastInputUs);
+  bool inputTimedOut = updateInputWatchdog(newSetpoint, setpointFound ? setpoint.timestampUs : lastInputUs, nowUs);
+
+  //Ramp on every step, not just when there is a new setpoint, the output cache stops this
+  //writing to the PWM once the motors have reached their setpoints
+  uint32_t elapsedUs = slewStarted ? (nowUs - lastSlewUs) : 0;
+  if(elapsedUs > SLEW_MAX_STEP_US){
+    elapsedUs = SLEW_MAX_STEP_US;
+  }
+  lastSlewUs = nowUs;
+  slewStarted = true;
+  for(uint8_t i = 0; i < MOTOR_COUNT; i++){
+    MOTOR motor = (MOTOR)i;
+    rampTicks[i] = slewTowards(motor, setpointTicks[i], elapsedUs);
+
+    //Start the ramp again from 0 once a fault has been recovered or the input has come back
+    if(motorFaulted[i] || inputTimedOut){
+      rampTicks[i] = 0;
+    }
+
+    //The failsafe stops the motors straight away rather than waiting for the ramp
+    if(inputTimedOut){
+      brakeMotor(motor, pwmPeriodTicks[i] * failsafeBrakePermille / 1000);
+      continue;
+    }
+
+    uint32_t brakeTicks = policyBrakeTicks(motor, setpointTicks[i]);
+    if(brakeTicks > 0){
+      //Braking to a stop holds the ramp at 0, so pushing the stick again part way through ramps up from 0
+      //A reversal keeps ramping down, as that is how long its brake lasts
+      if(setpointTicks[i] == 0){
+        rampTicks[i] = 0;
+      }
+      brakeMotor(motor, brakeTicks);
+    }
+    else{
+      //Whatever the ramp had got to while braking, the brake has been slowing the motor, so drive again from 0
+      if(appliedBraking[i]){
+        rampTicks[i] = 0;
+      }
+      driveMotor(motor, rampTicks[i]);
+    }
+  }
+
+  //Both motors have now been written, the comparators load the new duties at their next timer zero
+  if(newSetpoint){
+    uint32_t appliedUs = LATENCY_NOW();
+    LATENCY_RECORD(LATENCY_PUBLISHED_TO_APPLIED, setpoint.timestampUs, appliedUs);
+    LATENCY_RECORD(LATENCY_READ_TO_APPLIED, setpoint.inputTimestampUs, appliedUs);
+  }
+}
+
+bool Motors::updateInputWatchdog(bool newSetpoint, uint32_t setpointTimestampUs, uint32_t nowUs){
+  if(newSetpoint){
+    if(inputSeen){
+      inputStats.lastGapUs = setpointTimestampUs - lastInputUs;
+      if(inputStats.lastGapUs > inputStats.worstGapUs){
+        inputStats.worstGapUs = inputStats.lastGapUs;
+      }
+    }
+    inputSeen = true;
+    lastInputUs = setpointTimestampUs;
+  }
+
+  if(inputTimeoutUs == 0){
+    inputStats.tripped = false;
+    return false;
+  }
+
+  //Nothing to go on yet, keep the motors stopped without counting it as a trip
+  if(!inputSeen){
+    return true;
+  }
+
+  int32_t inputAgeUs = (int32_t)(nowUs - lastInputUs);
+  bool stale = inputAgeUs > (int32_t)inputTimeoutUs;
+  if(stale && !inputStats.tripped){
+    inputStats.tripped = true;
+    inputStats.trips++;
+    LOG_WARN(EVT_INPUT_TIMEOUT, inputAgeUs / 1000);
+  }
+  else if(!stale && inputStats.tripped){
+    inputStats.tripped = false;
+    LOG_INFO(EVT_INPUT_RECOVERED, inputStats.lastGapUs / 1000);
+  }
+  return inputStats.tripped;
+}
+
+void Motors::setInputTimeout(uint32_t timeoutMs, float failsafeBrakePercent){
+  if(failsafeBrakePercent < 0.0f || failsafeBrakePercent > 100.0f){
+    Serial.printf("Warning: Brake %f%% is out of range, use 0 to 100\n", failsafeBrakePercent);
+    failsafeBrakePercent = (failsafeBrakePercent < 0.0f) ? 0.0f : 100.0f;
+  }
+  failsafeBrakePermille = (uint16_t)(failsafeBrakePercent * 10.0f + 0.5f);
+  inputTimeoutUs = timeoutMs * 1000;
+}
+
+InputWatchdogStats Motors::getInputWatchdogStats(){
+  return inputStats;
+}
+
+void Motors::resetInputWatchdogStats(){
+  inputStats.trips = 0;
+  inputStats.lastGapUs = 0;
+  inputStats.worstGapUs = 0;
+  inputStats.tripped = false;
+}
+
+void Motors::printInputWatchdogStats(){
+  InputWatchdogStats current = getInputWatchdogStats();
+  Serial.printf("Input: gap %u us (worst %u us), failsafe trips %u%s\n",
+    current.lastGapUs, current.worstGapUs, current.trips, current.tripped ? ", motors stopped" : "");
+}
+
+//Duty in 0.01% steps, a setpoint published past full speed is sent as full speed rather than wrapping round
+static int16_t telemetryDuty(int32_t ticks, uint32_t periodTicks){
+  int64_t period = (periodTicks > 0) ? (int64_t)periodTicks : 1;
+  int64_t clampedTicks = (ticks > period) ? period : ((ticks < -period) ? -period : ticks);
+  return (int16_t)(clampedTicks * 10000 / period);
+}
+
+void Motors::fillTelemetryRecord(TelemetryRecord& record){
+  record.timestampUs = micros();
+
+  for(uint8_t i = 0; i < MOTOR_COUNT; i++){
+    record.setpoint[i] = telemetryDuty(setpointTicks[i], pwmPeriodTicks[i]);
+    record.appliedDuty[i] = telemetryDuty(appliedTicks[i], pwmPeriodTicks[i]);
   }
+  record.driverStatus = driver->getLastStatus().raw;
 }
 
 float Motors::validateSpeed(float speed){
   if(speed > 100.0f){
-    Serial.println("Warning: Motor speed set above 100%");
+    LOG_WARN(EVT_SPEED_ABOVE_MAX);
     speed = 100.0f;
   }
   else if(speed < -100.0f){
-    Serial.println("Warning: Motor speed set below -100%");
+    LOG_WARN(EVT_SPEED_BELOW_MIN);
     speed = -100.0f;
   }
   return speed;
 }
 
-void Motors::setMotorForwardSpeed(MOTOR leftOrRightMotor, float speed){
-  speed = validateSpeed(speed);
+int32_t Motors::speedToTicks(MOTOR leftOrRightMotor, float speed){
+  //Use the configured period so this also works before init()
+  float ticks = speed * pwmConfigs[leftOrRightMotor].periodTicks() / 100.0f;
+  return (int32_t)(ticks >= 0.0f ? ticks + 0.5f : ticks - 0.5f);
+}
+
+void Motors::applyMotorOutput(MOTOR leftOrRightMotor, bool forward, uint32_t dutyTicks){
+  if(outputValid[leftOrRightMotor] && !outputBraking[leftOrRightMotor] && outputDutyTicks[leftOrRightMotor] == dutyTicks){
+    //At 0% both inputs are low whichever way the motor was going, so direction only matters above 0
+    if(dutyTicks == 0 || outputForward[leftOrRightMotor] == forward){
+      return;
+    }
+  }
 
-  if(leftOrRightMotor == RIGHT_MOTOR){
-    // Serial.printf("Setting right motor pwm to %f\n", speed);
+  pwm->setMotorOutput(leftOrRightMotor, forward, dutyTicks);
+  outputValid[leftOrRightMotor] = true;
+  outputBraking[leftOrRightMotor] = false;
+  outputForward[leftOrRightMotor] = forward;
+  outputDutyTicks[leftOrRightMotor] = dutyTicks;
+}
 
-    mcpwm_set_signal_low(MCPWM_UNIT_0, MCPWM_TIMER_0, MCPWM_OPR_B);
-    mcpwm_set_duty(MCPWM_UNIT_0, MCPWM_TIMER_0, MCPWM_OPR_A, speed);
-    mcpwm_set_duty_type(MCPWM_UNIT_0, MCPWM_TIMER_0, MCPWM_OPR_A, MCPWM_DUTY_MODE_0);
+void Motors::applyMotorBrake(MOTOR leftOrRightMotor, uint32_t brakeTicks){
+  if(outputValid[leftOrRightMotor] && outputBraking[leftOrRightMotor] && outputDutyTicks[leftOrRightMotor] == brakeTicks){
+    return;
   }
-  else{
-    // Serial.printf("Setting left motor pwm to %f\n", speed);
 
-    mcpwm_set_signal_low(MCPWM_UNIT_1, MCPWM_TIMER_1, MCPWM_OPR_B);
-    mcpwm_set_duty(MCPWM_UNIT_1, MCPWM_TIMER_1, MCPWM_OPR_A, speed);
-    mcpwm_set_duty_type(MCPWM_UNIT_1, MCPWM_TIMER_1, MCPWM_OPR_A, MCPWM_DUTY_MODE_0);
+  pwm->setMotorBrake(leftOrRightMotor, brakeTicks);
+  outputValid[leftOrRightMotor] = true;
+  outputBraking[leftOrRightMotor] = true;
+  outputDutyTicks[leftOrRightMotor] = brakeTicks;
+}
+
+void Motors::setMotorBrakeMode(BRAKE_MODE brakeMode){
+  //The control task owns the driver's registers, so it writes the decay mode itself
+  if(brakeMode == AUTO_BRAKE){
+    pendingDecayMode.store(DRIVER_SETTING_PENDING | FORCE_FAST_DECAY, std::memory_order_release);
+  }
+  else if(brakeMode == NEUTRAL){
+    pendingDecayMode.store(DRIVER_SETTING_PENDING | FORCE_SLOW_DECAY, std::memory_order_release);
   }
 }
 
-void Motors::setMotorBackwardSpeed(MOTOR leftOrRightMotor, float speed){
-  speed = validateSpeed(speed);
+void Motors::setBrakePolicy(MOTOR leftOrRightMotor, BRAKE_POLICY policy, float brakePercent){
+  if(brakePercent < 0.0f || brakePercent > 100.0f){
+    Serial.printf("Warning: Brake %f%% is out of range, use 0 to 100\n", brakePercent);
+    brakePercent = (brakePercent < 0.0f) ? 0.0f : 100.0f;
+  }
+  brakePolicies[leftOrRightMotor] = policy;
+  brakePermille[leftOrRightMotor] = (uint16_t)(brakePercent * 10.0f + 0.5f);
+}
 
-  //Convert the negative speed to a positive speed
-  speed = -speed;
-  if(leftOrRightMotor == RIGHT_MOTOR){
-    // Serial.printf("Setting right motor pwm to reverse %f\n", speed);
+BRAKE_POLICY Motors::getBrakePolicy(MOTOR leftOrRightMotor){
+  return brakePolicies[leftOrRightMotor];
+}
 
-    mcpwm_set_signal_low(MCPWM_UNIT_0, MCPWM_TIMER_0, MCPWM_OPR_A);
-    mcpwm_set_duty(MCPWM_UNIT_0, MCPWM_TIMER_0, MCPWM_OPR_B, speed);
-    mcpwm_set_duty_type(MCPWM_UNIT_0, MCPWM_TIMER_0, MCPWM_OPR_B, MCPWM_DUTY_MODE_0);
+uint32_t Motors::policyBrakeTicks(MOTOR leftOrRightMotor, int32_t targetTicks){
+  BRAKE_POLICY policy = brakePolicies[leftOrRightMotor];
+  if(setpointBrakeMode != AUTO_BRAKE || policy == BRAKE_NEVER){
+    return 0;
   }
-  else{
-    // Serial.printf("Setting left motor pwm to reverse %f\n", speed);
 
-    mcpwm_set_signal_low(MCPWM_UNIT_1, MCPWM_TIMER_1, MCPWM_OPR_A);
-    mcpwm_set_duty(MCPWM_UNIT_1, MCPWM_TIMER_1, MCPWM_OPR_B, speed);
-    mcpwm_set_duty_type(MCPWM_UNIT_1, MCPWM_TIMER_1, MCPWM_OPR_B, MCPWM_DUTY_MODE_0);
+  uint32_t brakeTicks = pwmPeriodTicks[leftOrRightMotor] * brakePermille[leftOrRightMotor] / 1000;
+  if(targetTicks == 0){
+    return brakeTicks;
   }
+
+  //Brake until the reverse ramp has got down to 0, then drive the other way
+  int32_t ramp = rampTicks[leftOrRightMotor];
+  if(policy == BRAKE_AT_ZERO_AND_REVERSE && ((ramp > 0 && targetTicks < 0) || (ramp < 0 && targetTicks > 0))){
+    return brakeTicks;
+  }
+  return 0;
 }
 
-void Motors::setMotorBrakeMode(BRAKE_MODE brakeMode){
-  if(brakeMode == AUTO_BRAKE){
-    drv8711Driver.setDecayMode(FORCE_FAST_DECAY);
+void Motors::setSlewRates(float acceleratePercentPerSecond, float deceleratePercentPerSecond, float reversePercentPerSecond){
+  float rates[SLEW_PHASE_COUNT] = {acceleratePercentPerSecond, deceleratePercentPerSecond, reversePercentPerSecond};
+  for(uint8_t i = 0; i < SLEW_PHASE_COUNT; i++){
+    if(rates[i] < 0.0f){
+      Serial.printf("Warning: Slew rate %f%%/s is invalid, the limit has been turned off\n", rates[i]);
+      rates[i] = 0.0f;
+    }
+    slewPercentPerSecond[i] = rates[i];
   }
-  else if(brakeMode == NEUTRAL){
-    drv8711Driver.setDecayMode(FORCE_SLOW_DECAY);
+  for(uint8_t i = 0; i < MOTOR_COUNT; i++){
+    updateSlewTicks((MOTOR)i);
+  }
+}
+
+float Motors::getSlewRate(SLEW_PHASE phase){
+  if(phase >= SLEW_PHASE_COUNT){
+    return 0.0f;
+  }
+  return slewPercentPerSecond[phase];
+}
+
+void Motors::updateSlewTicks(MOTOR leftOrRightMotor){
+  uint32_t periodTicks = pwmConfigs[leftOrRightMotor].periodTicks();
+  for(uint8_t i = 0; i < SLEW_PHASE_COUNT; i++){
+    if(slewPercentPerSecond[i] <= 0.0f){
+      slewTicksPerSecond[leftOrRightMotor][i] = 0;
+      continue;
+    }
+
+    //Always allow at least 1 tick per second, otherwise a tiny rate would turn the limit off
+    float ticksPerSecond = slewPercentPerSecond[i] * periodTicks / 100.0f;
+    if(ticksPerSecond < 1.0f){
+      ticksPerSecond = 1.0f;
+    }
+    else if(ticksPerSecond > 4000000000.0f){
+      ticksPerSecond = 4000000000.0f;
+    }
+    slewTicksPerSecond[leftOrRightMotor][i] = (uint32_t)ticksPerSecond;
+  }
+  slewRemainder[leftOrRightMotor] = 0;
+}
+
+int32_t Motors::slewTowards(MOTOR leftOrRightMotor, int32_t targetTicks, uint32_t elapsedUs){
+  //Clamp first so a setpoint past full speed is reached and the ramp stops
+  int32_t periodTicks = (int32_t)pwmPeriodTicks[leftOrRightMotor];
+  if(targetTicks > periodTicks){
+    targetTicks = periodTicks;
+  }
+  else if(targetTicks < -periodTicks){
+    targetTicks = -periodTicks;
+  }
+
+  int32_t currentTicks = rampTicks[leftOrRightMotor];
+  if(currentTicks == targetTicks){
+    slewRemainder[leftOrRightMotor] = 0;
+    return targetTicks;
+  }
+
+  int32_t targetMagnitude = (targetTicks < 0) ? -targetTicks : targetTicks;
+  int32_t currentMagnitude = (currentTicks < 0) ? -currentTicks : currentTicks;
+  SLEW_PHASE phase;
+  if((currentTicks > 0 && targetTicks < 0) || (currentTicks < 0 && targetTicks > 0)){
+    phase = SLEW_REVERSE;
+  }
+  else if(targetMagnitude > currentMagnitude){
+    phase = SLEW_ACCELERATE;
+  }
+  else{
+    phase = SLEW_DECELERATE;
+  }
+
+  uint32_t ticksPerSecond = slewTicksPerSecond[leftOrRightMotor][phase];
+  if(ticksPerSecond == 0){
+    slewRemainder[leftOrRightMotor] = 0;
+    return targetTicks;
   }
+
+  uint64_t scaledStep = (uint64_t)ticksPerSecond * elapsedUs + slewRemainder[leftOrRightMotor];
+  int64_t stepTicks = (int64_t)(scaledStep / 1000000);
+  slewRemainder[leftOrRightMotor] = (uint32_t)(scaledStep % 1000000);
+
+  //A reversal stops at 0 for this step, the rest of the way is at the accelerate rate from the next step
+  int64_t limitTicks = (phase == SLEW_REVERSE) ? 0 : targetTicks;
+  int64_t nextTicks;
+  if(limitTicks > currentTicks){
+    nextTicks = currentTicks + stepTicks;
+    if(nextTicks > limitTicks){
+      nextTicks = limitTicks;
+    }
+  }
+  else{
+    nextTicks = currentTicks - stepTicks;
+    if(nextTicks < limitTicks){
+      nextTicks = limitTicks;
+    }
+  }
+  return (int32_t)nextTicks;
 }
 
 float Motors::validateCurrent(float current){
   if(current > 20.0f){
-    Serial.println("Warning: Current limit >20 A provided, defaulting to 20 A");
+    LOG_WARN(EVT_CURRENT_ABOVE_MAX);
     current = 20.0f;
   }
   else if(current < 0.0f){
-    Serial.println("Warning: Negative current limit provided, defaulting to 10 A");
+    LOG_WARN(EVT_CURRENT_NEGATIVE);
     current = 0;
   }
   return current;
@@ -117,28 +605,501 @@ float Motors::validateCurrent(float current){
 
 void Motors::setCurrentLimit(float current){
   currentLimit = current;
-  current = validateCurrent(current);
-  drv8711Driver.setCurrentLimit((uint8_t) current);
+  //Looked up even before init() so getCurrentLimit is right from the start
+  ISGAIN_GAIN gain;
+  uint8_t torque;
+  if(!currentLimitRegisters(gain, torque) || !pwmStarted){
+    return;
+  }
+  //The control task owns the driver's registers, so it writes the new limit itself
+  pendingCurrentLimit.store(CURRENT_LIMIT_PENDING | (gain << 8) | torque, std::memory_order_release);
+  LOG_INFO(EVT_CURRENT_LIMIT_SET, int32_t(currentCalibration.limitFor(gain, torque) * 1000.0f), 5 << gain, torque);
+}
+
+float Motors::getCurrentLimit(){
+  return currentCalibration.limitFor(currentLimitGain, currentLimitTorque);
+}
+
+bool Motors::currentLimitRegisters(ISGAIN_GAIN& gain, uint8_t& torque){
+  float current = validateCurrent(currentLimit);
+  if(!currentCalibration.lookup(current, gain, torque)){
+    LOG_ERROR(EVT_CURRENT_LIMIT_UNREACHABLE, int32_t(current * 1000.0f));
+    return false;
+  }
+  currentLimitGain = gain;
+  currentLimitTorque = torque;
+  return true;
+}
+
+DRV8711Profile Motors::expectedDriverRegisters(){
+  DRV8711Profile expected = lookupDriverProfile(driverProfile);
+  ISGAIN_GAIN gain;
+  uint8_t torque;
+  if(currentLimitRegisters(gain, torque)){
+    expected = expected.senseAmplifierGain(gain).torque(torque);
+  }
+  return expected;
+}
+
+void Motors::setCurrentCalibration(const CurrentCalibration& calibration){
+  currentCalibration = calibration;
+  setCurrentLimit(currentLimit);
+}
+
+const CurrentCalibration& Motors::getCurrentCalibration(){
+  return currentCalibration;
+}
+
+bool Motors::loadCurrentCalibration(SettingsStore& store){
+  CurrentCalibration calibration;
+  if(!calibration.load(store)){
+    return false;
+  }
+  setCurrentCalibration(calibration);
+  return true;
+}
+
+bool Motors::saveCurrentCalibration(SettingsStore& store){
+  return currentCalibration.save(store);
+}
+
+bool Motors::setDriverProfile(DRIVER_PROFILE profile){
+  if(profile >= DRIVER_PROFILE_COUNT){
+    Serial.printf("Warning: there is no motor driver profile %i\n", profile);
+    return false;
+  }
+  driverProfile = profile;
+  if(!pwmStarted){
+    return true;
+  }
+  //The control task owns the driver's registers, so it writes the new profile itself
+  pendingDriverProfile.store(DRIVER_SETTING_PENDING | profile, std::memory_order_release);
+  return true;
+}
+
+DRIVER_PROFILE Motors::getDriverProfile(){
+  return driverProfile;
+}
+
+void Motors::detectCommsLoss(uint8_t driverIndex){
+  DriverRecovery& recovery = recoveries[driverIndex];
+  LOG_ERROR(EVT_COMMS_LOST, driverIndex);
+  recovery.fromCommsLoss = true;
+  recovery.faultMask = STATUS_FAULT_MASK;
+  recovery.faulted = true;
+  faultCounts[FAULT_COMMS]++;
+  recovery.backoffMs = faultBackoffMs[FAULT_COMMS];
+  if(driverIndex == 0){
+    motorFaulted[LEFT_MOTOR] = true;
+    motorFaulted[RIGHT_MOTOR] = true;
+  }
+}
+
+void Motors::addFaultClass(uint8_t driverIndex, FAULT_CLASS faultClass){
+  faultCounts[faultClass]++;
+
+  //Wait for the slowest fault present to settle
+  if(faultBackoffMs[faultClass] > recoveries[driverIndex].backoffMs){
+    recoveries[driverIndex].backoffMs = faultBackoffMs[faultClass];
+  }
+}
+
+void Motors::detectFaults(uint8_t driverIndex, DriverStatus status){
+  DriverRecovery& recovery = recoveries[driverIndex];
+  LOG_ERROR(EVT_DRIVER_FAULT, driverIndex, status.raw);
+  recovery.fromCommsLoss = false;
+  recovery.faultMask = status.raw & STATUS_FAULT_MASK;
+  recovery.backoffMs = 0;
+  recovery.faulted = true;
+
+  if(status.overTemperature){
+    addFaultClass(driverIndex, FAULT_OTS);
+  }
+  if(status.underVoltage){
+    addFaultClass(driverIndex, FAULT_UVLO);
+  }
+  if(status.channelAPredriverFault || status.channelBPredriverFault){
+    addFaultClass(driverIndex, FAULT_PDF);
+  }
+  if(status.channelAOverCurrent || status.channelBOverCurrent){
+    addFaultClass(driverIndex, FAULT_OCP);
+  }
+
+  //Only the first driver's H bridges are the motors, the others are left to whoever uses them
+  if(driverIndex != 0){
+    return;
+  }
+
+  //Over temperature and undervoltage shut down both H bridges
+  if(status.overTemperature || status.underVoltage){
+    motorFaulted[LEFT_MOTOR] = true;
+    motorFaulted[RIGHT_MOTOR] = true;
+  }
+
+  //Channel faults only stop their own H bridge
+  //Channel A drives the right motor and channel B drives the left motor
+  if(status.channelAOverCurrent || status.channelAPredriverFault){
+    motorFaulted[RIGHT_MOTOR] = true;
+  }
+  if(status.channelBOverCurrent || status.channelBPredriverFault){
+    motorFaulted[LEFT_MOTOR] = true;
+  }
 }
 
 void Motors::checkFaults(){
-  //This is a hacky way of detecting whether we can talk to the drv8711 or not
-  //If there is no SPI connection then the stall register will be all 1s
-  //We do not use this register so we can check if its all 1s or not
-  if(drv8711Driver.readRegister(STALL_REG_ADDR) == 0xFFF){
-    Serial.println("Error: lost communication with motor driver");
-    Serial.println("Attempting to reconnect");
-    drv8711Driver.writeRegister(STATUS_REG_ADDR, 0);
-    drv8711Driver.configureDefaultBrushedMotorProfile();
-
-    setCurrentLimit(currentLimit);
-    delay(1000);
-  }
-  else if(drv8711Driver.readRegister(STATUS_REG_ADDR) != 0){
-    Serial.println("Error: Motor Driver Fault detected");
-    drv8711Driver.printStatus();
-    Serial.println("Attempting to reset faults...");
-    drv8711Driver.writeRegister(STATUS_REG_ADDR, 0);
-    delay(1000);
-  }
-}
\ No newline at end of file
+  //SPI is never waited on here: every driver's frames are queued together by one call and collected by a later one
+  SpiBus* bus = driver->getBus();
+  if(faultBatch.state == SPI_BATCH_QUEUED && !bus->pollBatch(faultBatch)){
+    return;
+  }
+
+  //The bus was busy last time, so the frames were never sent
+  if(faultBatch.state == SPI_BATCH_IDLE && faultBatch.frameCount > 0){
+    bus->submitBatch(faultBatch);
+    return;
+  }
+
+  //Hand each driver the STATUS it asked for
+  bool batchDone = (faultBatch.state == SPI_BATCH_DONE);
+  for(uint8_t i = 0; i < driverCount; i++){
+    DriverRecovery& recovery = recoveries[i];
+    recovery.statusReady = batchDone && recovery.statusFrame >= 0;
+    if(recovery.statusReady){
+      drivers[i]->takeStatusRead(faultBatch, recovery.statusFrame, recovery.readBack);
+    }
+    recovery.statusFrame = -1;
+  }
+
+  faultBatch.clear();
+  for(uint8_t i = 0; i < driverCount; i++){
+    stepRecovery(i);
+  }
+
+  //New settings are only written while no recovery is running and nothing is being read back,
+  //so the shadow registers never change between a read back and the check against them
+  if(recoveries[0].state == RECOVERY_ARMED && !recoveries[0].readBack){
+    applyPendingDriverSettings();
+  }
+
+  if(faultBatch.frameCount > 0){
+    bus->submitBatch(faultBatch);
+  }
+}
+
+void Motors::applyPendingDriverSettings(){
+  uint8_t framesBefore = faultBatch.frameCount;
+
+  //The profile goes first, so a current limit set after it is written over it
+  uint8_t pendingProfile = pendingDriverProfile.load(std::memory_order_acquire);
+  if(pendingProfile & DRIVER_SETTING_PENDING){
+    //Keep the current limit the driver is already set to
+    uint16_t ctrl = driver->getShadowRegister(CTRL_REG_ADDR);
+    uint16_t torque = driver->getShadowRegister(TORQUE_REG_ADDR);
+    DRV8711Profile expected = lookupDriverProfile((DRIVER_PROFILE)(pendingProfile & ~DRIVER_SETTING_PENDING))
+      .senseAmplifierGain((ISGAIN_GAIN)((ctrl >> CTRL_ISGAIN_BIT) & 0b11))
+      .torque((torque >> TORQUE_TORQUE_BIT) & 0xFF);
+    if(!driver->queueProfile(faultBatch, expected)){
+      return;
+    }
+    //Fails and keeps the newer one if it was changed again in the meantime, the same for each setting below
+    pendingDriverProfile.compare_exchange_strong(pendingProfile, 0, std::memory_order_acq_rel);
+  }
+
+  uint8_t pendingDecay = pendingDecayMode.load(std::memory_order_acquire);
+  if(pendingDecay & DRIVER_SETTING_PENDING){
+    if(!driver->queueDecayMode(faultBatch, (DECAYMODE)(pendingDecay & ~DRIVER_SETTING_PENDING))){
+      return;
+    }
+    pendingDecayMode.compare_exchange_strong(pendingDecay, 0, std::memory_order_acq_rel);
+  }
+
+  uint16_t pendingLimit = pendingCurrentLimit.load(std::memory_order_acquire);
+  if(pendingLimit & CURRENT_LIMIT_PENDING){
+    if(driver->queueCurrentLimit(faultBatch, (ISGAIN_GAIN)((pendingLimit >> 8) & 0b11), pendingLimit & 0xFF)){
+      pendingCurrentLimit.compare_exchange_strong(pendingLimit, 0, std::memory_order_acq_rel);
+    }
+  }
+
+  //Settings that were already set add no frames and need no read back
+  if(faultBatch.frameCount > framesBefore){
+    recoveries[0].verifyWrites = true;
+  }
+}
+
+void Motors::stepRecovery(uint8_t driverIndex){
+  DRV8711* recoveringDriver = drivers[driverIndex];
+  DriverRecovery& recovery = recoveries[driverIndex];
+
+  switch(recovery.state){
+    case RECOVERY_ARMED:
+      //One STATUS read tells us both whether there is a fault and whether we can still talk to the drv8711
+      if(recovery.statusReady){
+        DriverStatus status = recoveringDriver->getLastStatus();
+        if(status.commsLost()){
+          detectCommsLoss(driverIndex);
+          recovery.state = RECOVERY_CLEAR;
+          break;
+        }
+        else if(status.hasFault()){
+          detectFaults(driverIndex, status);
+          recovery.state = RECOVERY_CLEAR;
+          break;
+        }
+        else if(recovery.readBack && !recoveringDriver->verifyReadback()){
+          //New settings did not all reach the chip, so recover as for lost comms, which writes every register again
+          LOG_ERROR(EVT_SETTINGS_MISMATCH, driverIndex);
+          detectCommsLoss(driverIndex);
+          recovery.state = RECOVERY_CLEAR;
+          break;
+        }
+      }
+      recovery.statusFrame = recoveringDriver->queueStatusRead(faultBatch, recovery.verifyWrites);
+      recovery.readBack = recovery.verifyWrites;
+      if(recovery.statusFrame >= 0){
+        recovery.verifyWrites = false;
+      }
+      break;
+
+    case RECOVERY_CLEAR:
+      //The shadow registers still hold the full configuration including the current limit
+      //so after lost comms they are written back along with the clear and checked once the chip has settled
+      if(!recoveringDriver->queueClearFaults(faultBatch, recovery.faultMask, recovery.fromCommsLoss)){
+        break;
+      }
+      if(recovery.fromCommsLoss){
+        LOG_INFO(EVT_RECONNECTING, driverIndex);
+      }
+      else{
+        LOG_INFO(EVT_CLEARING_FAULTS, driverIndex);
+      }
+      recovery.startMs = millis();
+      recovery.state = RECOVERY_SETTLE;
+      break;
+
+    case RECOVERY_SETTLE:
+      //Nothing is sent over SPI while we wait, the healthy motor carries on as normal
+      if(millis() - recovery.startMs >= recovery.backoffMs){
+        recovery.statusFrame = recoveringDriver->queueStatusRead(faultBatch, recovery.fromCommsLoss);
+        recovery.readBack = recovery.fromCommsLoss;
+        if(recovery.statusFrame >= 0){
+          recovery.state = RECOVERY_VERIFY;
+        }
+      }
+      break;
+
+    case RECOVERY_VERIFY: {
+      if(!recovery.statusReady){
+        break;
+      }
+      DriverStatus status = recoveringDriver->getLastStatus();
+
+      //Still faulted, go round again
+      if(status.commsLost()){
+        detectCommsLoss(driverIndex);
+        recovery.state = RECOVERY_CLEAR;
+      }
+      else if(recovery.fromCommsLoss && !recoveringDriver->verifyReadback()){
+        LOG_ERROR(EVT_RECONNECT_MISMATCH, driverIndex);
+        detectCommsLoss(driverIndex);
+        recovery.state = RECOVERY_CLEAR;
+      }
+      else if(status.hasFault()){
+        detectFaults(driverIndex, status);
+        recovery.state = RECOVERY_CLEAR;
+      }
+      else{
+        LOG_INFO(EVT_FAULTS_CLEARED, driverIndex);
+        if(driverIndex == 0){
+          motorFaulted[LEFT_MOTOR] = false;
+          motorFaulted[RIGHT_MOTOR] = false;
+        }
+        recovery.faulted = false;
+        recovery.fromCommsLoss = false;
+        recovery.faultMask = 0;
+        recovery.state = RECOVERY_ARMED;
+      }
+      break;
+    }
+  }
+}
+
+bool Motors::setPwmConfig(MOTOR leftOrRightMotor, uint32_t frequencyHz, uint32_t resolutionHz){
+  PwmConfig config;
+  config.frequencyHz = frequencyHz;
+  config.resolutionHz = resolutionHz;
+  if(!validatePwmConfig(config)){
+    return false;
+  }
+  if(!pwmStarted){
+    pwmConfigs[leftOrRightMotor] = config;
+    updateSlewTicks(leftOrRightMotor);
+    return true;
+  }
+
+  //The backend leaves the outputs at 0%, so put the motor back to the speed it was at
+  uint32_t oldPeriodTicks = pwmPeriodTicks[leftOrRightMotor];
+  bool configured = pwm->configureMotor(leftOrRightMotor, config);
+  if(configured){
+    pwmConfigs[leftOrRightMotor] = config;
+    updateSlewTicks(leftOrRightMotor);
+  }
+  else{
+    //Keep the motor running on the settings it had
+    pwm->configureMotor(leftOrRightMotor, pwmConfigs[leftOrRightMotor]);
+  }
+  pwmPeriodTicks[leftOrRightMotor] = pwm->getPeriodTicks(leftOrRightMotor);
+  outputValid[leftOrRightMotor] = false;
+  if(oldPeriodTicks > 0){
+    uint32_t newPeriodTicks = pwmPeriodTicks[leftOrRightMotor];
+    rampTicks[leftOrRightMotor] = (int32_t)((int64_t)rampTicks[leftOrRightMotor] * newPeriodTicks / oldPeriodTicks);
+    if(appliedBraking[leftOrRightMotor]){
+      brakeMotor(leftOrRightMotor, (uint32_t)((uint64_t)appliedBrakeTicks[leftOrRightMotor] * newPeriodTicks / oldPeriodTicks));
+    }
+    else{
+      driveMotor(leftOrRightMotor, (int32_t)((int64_t)appliedTicks[leftOrRightMotor] * newPeriodTicks / oldPeriodTicks));
+    }
+  }
+  return configured;
+}
+
+PwmConfig Motors::getPwmConfig(MOTOR leftOrRightMotor){
+  return pwmConfigs[leftOrRightMotor];
+}
+
+uint32_t Motors::getPwmPeriodTicks(MOTOR leftOrRightMotor){
+  return pwmConfigs[leftOrRightMotor].periodTicks();
+}
+
+void Motors::setFaultBackoff(FAULT_CLASS faultClass, uint32_t backoffMs){
+  if(faultClass < FAULT_CLASS_COUNT){
+    faultBackoffMs[faultClass] = backoffMs;
+  }
+}
+
+uint32_t Motors::getFaultCount(FAULT_CLASS faultClass){
+  if(faultClass >= FAULT_CLASS_COUNT){
+    return 0;
+  }
+  return faultCounts[faultClass];
+}
+
+RECOVERY_STATE Motors::getRecoveryState(uint8_t driverIndex){
+  if(driverIndex >= driverCount){
+    return RECOVERY_ARMED;
+  }
+  return recoveries[driverIndex].state;
+}
+
+int8_t Motors::addDriver(DRV8711& extraDriver){
+  if(driverCount >= MOTORS_MAX_DRIVERS){
+    Serial.printf("Error: Motors can only look after %i drivers\n", MOTORS_MAX_DRIVERS);
+    return -1;
+  }
+
+  //Every driver's frames go out in the same batch, so they must share a bus
+  if(extraDriver.getBus() != driver->getBus()){
+    Serial.println("Error: extra motor drivers must be on the same SPI bus as the motor driver");
+    return -1;
+  }
+  for(uint8_t i = 0; i < driverCount; i++){
+    if(drivers[i] == &extraDriver || drivers[i]->getChipSelectPin() == extraDriver.getChipSelectPin()){
+      Serial.printf("Error: there is already a motor driver on chip select pin %i\n", extraDriver.getChipSelectPin());
+      return -1;
+    }
+  }
+
+  extraDriver.init();
+  extraDriver.writeRegister(STATUS_REG_ADDR, 0);
+  drivers[driverCount] = &extraDriver;
+  return driverCount++;
+}
+
+uint8_t Motors::getDriverCount(){
+  return driverCount;
+}
+
+bool Motors::isDriverFaulted(uint8_t driverIndex){
+  if(driverIndex >= driverCount){
+    return false;
+  }
+  return recoveries[driverIndex].faulted;
+}
+
+bool Motors::isMotorFaulted(MOTOR leftOrRightMotor){
+  return motorFaulted[leftOrRightMotor];
+}
+
+//#########BENCH FUNCTIONS#############
+void Motors::pwmFrequencySweep(uint32_t startHz, uint32_t endHz, uint32_t stepHz, float speed, uint32_t dwellMs){
+  //Names of the STATUS register bits, in bit order
+  static const char* const STATUS_BIT_NAMES[8] = {"OTS", "AOCP", "BOCP", "APDF", "BPDF", "UVLO", "STD", "STDLAT"};
+
+  if(stepHz == 0 || endHz < startHz){
+    Serial.println("Error: PWM sweep needs a step above 0 and an end frequency above the start");
+    return;
+  }
+  PwmConfig originalConfigs[MOTOR_COUNT];
+  for(uint8_t i = 0; i < MOTOR_COUNT; i++){
+    originalConfigs[i] = pwmConfigs[i];
+  }
+
+  //Each column counts the 1ms polls where the last STATUS read had that bit set, resets is the number of recoveries started
+  Serial.printf("PWM sweep at %.1f%% speed, %lums per step\n", speed, (unsigned long)dwellMs);
+  Serial.printf("%8s", "Hz");
+  for(uint8_t bit = 0; bit < 8; bit++){
+    Serial.printf(" %7s", STATUS_BIT_NAMES[bit]);
+  }
+  Serial.printf(" %7s\n", "resets");
+
+  for(uint32_t frequencyHz = startHz; frequencyHz <= endHz; frequencyHz += stepHz){
+    if(!setPwmConfig(LEFT_MOTOR, frequencyHz, pwmConfigs[LEFT_MOTOR].resolutionHz) ||
+       !setPwmConfig(RIGHT_MOTOR, frequencyHz, pwmConfigs[RIGHT_MOTOR].resolutionHz)){
+      continue;
+    }
+
+    uint32_t faultsBefore = 0;
+    for(uint8_t i = 0; i < FAULT_CLASS_COUNT; i++){
+      faultsBefore += faultCounts[i];
+    }
+    uint32_t bitCounts[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+
+    unsigned long stepStartMs = millis();
+    while(millis() - stepStartMs < dwellMs){
+      setMotorSpeed(LEFT_MOTOR, speed);
+      setMotorSpeed(RIGHT_MOTOR, speed);
+      checkFaults();
+
+      uint16_t status = driver->getLastStatus().raw;
+      for(uint8_t bit = 0; bit < 8; bit++){
+        if(status & (1 << bit)){
+          bitCounts[bit]++;
+        }
+      }
+      delay(1);
+    }
+
+    uint32_t faultsAfter = 0;
+    for(uint8_t i = 0; i < FAULT_CLASS_COUNT; i++){
+      faultsAfter += faultCounts[i];
+    }
+
+    Serial.printf("%8lu", (unsigned long)frequencyHz);
+    for(uint8_t bit = 0; bit < 8; bit++){
+      Serial.printf(" %7lu", (unsigned long)bitCounts[bit]);
+    }
+    Serial.printf(" %7lu\n", (unsigned long)(faultsAfter - faultsBefore));
+
+    //Let the motors spin down and any recovery finish so the next step starts clean
+    setMotorSpeed(LEFT_MOTOR, 0.0f);
+    setMotorSpeed(RIGHT_MOTOR, 0.0f);
+    unsigned long settleStartMs = millis();
+    while(millis() - settleStartMs < dwellMs / 2 || (recoveries[0].state != RECOVERY_ARMED && millis() - settleStartMs < dwellMs * 4)){
+      checkFaults();
+      delay(1);
+    }
+  }
+
+  for(uint8_t i = 0; i < MOTOR_COUNT; i++){
+    setPwmConfig((MOTOR)i, originalConfigs[i].frequencyHz, originalConfigs[i].resolutionHz);
+  }
+}
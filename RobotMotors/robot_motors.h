@@ -1,58 +1,428 @@
 #ifndef __ROBOT_MOTORS__
 #define __ROBOT_MOTORS__
-#include <Arduino.h>
+#include "platform.h"
+#include "hal.h"
 #include "drv8711.h"
-#include "driver/mcpwm.h"
-#include "soc/mcpwm_periph.h"
+#include "drv8711_profile.h"
+#include "current_calibration.h"
+#include "motor_types.h"
+#include "setpoint_mailbox.h"
+#include "telemetry.h"
+#include "pwm_config.h"
 
+//Default PWM settings for each motor, these can be changed with Motors::setPwmConfig
+#define PWM_FREQ 10000
 
-//Motor A drive pins
-#define AOUT1 26
-#define AOUT2 25
-
-//Motor B drive pins
-#define BOUT1 33
-#define BOUT2 32
+//PWM timer tick rate, 10MHz gives 1000 duty steps at PWM_FREQ
+#define PWM_RESOLUTION_HZ 10000000
 
-#define PWM_FREQ 10000
+extern SpiBus drvSpiBus;
 
 extern DRV8711 drv8711Driver;
 
-enum MOTOR {
-    LEFT_MOTOR = 0,
-    RIGHT_MOTOR = 1
+extern PwmBackend motorPwm;
+
+//Where settings such as the current calibration are saved, NVS on the ESP32
+extern SettingsStore settingsStore;
+
+//Classes of fault that the recovery state machine handles, each has its own backoff time
+enum FAULT_CLASS {
+    FAULT_OTS = 0,
+    FAULT_OCP = 1,
+    FAULT_PDF = 2,
+    FAULT_UVLO = 3,
+    FAULT_COMMS = 4,
+    FAULT_CLASS_COUNT = 5
+};
+
+//Fault recovery goes detect (ARMED) -> CLEAR -> SETTLE -> VERIFY -> back to ARMED
+enum RECOVERY_STATE {
+    RECOVERY_ARMED = 0,
+    RECOVERY_CLEAR = 1,
+    RECOVERY_SETTLE = 2,
+    RECOVERY_VERIFY = 3
+};
+
+//Most DRV8711s one Motors looks after, the first drives the two motors
+//and the rest are other drivers on the same SPI bus, e.g. a second board or a weapon
+#define MOTORS_MAX_DRIVERS 4
+
+//Fault recovery progress of one DRV8711
+struct DriverRecovery {
+  RECOVERY_STATE state;
+
+  //Bits of the STATUS register that triggered the current recovery
+  uint16_t faultMask;
+
+  bool fromCommsLoss;
+
+  unsigned long startMs;
+
+  unsigned long backoffMs;
+
+  //Where this driver's STATUS read is in the fault batch, -1 if it has none in it,
+  //and whether the configuration registers are read back after it
+  int8_t statusFrame;
+  bool readBack;
+
+  //Set by checkFaults when the last batch brought back this driver's STATUS
+  bool statusReady;
+
+  //Set when the control task has written new settings, so the next STATUS read also reads the registers back
+  bool verifyWrites;
+
+  //True from when a fault is seen until the driver has been recovered
+  bool faulted;
+};
+
+//Which slew rate limit applies to a change in duty
+//Accelerate is moving away from 0, decelerate is moving towards 0 in the same direction
+//and reverse is moving towards 0 when the setpoint is in the other direction
+enum SLEW_PHASE {
+    SLEW_ACCELERATE = 0,
+    SLEW_DECELERATE = 1,
+    SLEW_REVERSE = 2,
+    SLEW_PHASE_COUNT = 3
+};
+
+//When controlStep brakes a motor instead of driving it, for setpoints published with AUTO_BRAKE
+//Setpoints published with NEUTRAL always let the motors coast
+enum BRAKE_POLICY {
+    //Never brake, a motor coasts when its setpoint is 0
+    BRAKE_NEVER = 0,
+    //Brake while the setpoint is 0
+    BRAKE_AT_ZERO = 1,
+    //Also brake instead of driving while the reverse slew ramp brings the motor down to 0
+    BRAKE_AT_ZERO_AND_REVERSE = 2
 };
 
-enum BRAKE_MODE {
-    NEUTRAL = 0,
-    AUTO_BRAKE = 1
+//Counters kept by the input watchdog in controlStep
+struct InputWatchdogStats {
+  //Number of times the motors have been stopped because the input went quiet
+  uint32_t trips;
+
+  //Time between the last two setpoints and the longest time between any two
+  uint32_t lastGapUs;
+  uint32_t worstGapUs;
+
+  //Whether the motors are stopped by the watchdog now
+  bool tripped;
 };
 
+//How long each part of init() took, for the startup timings
+struct MotorsInitTimes {
+  //Reading the DRV8711 back and configuring it
+  uint32_t driverUs;
+  uint32_t pwmUs;
+
+  //The DRV8711 still held the expected configuration, so it was only cleared and enabled
+  bool warmStart;
+};
+
+//Longest gap between control steps that the slew limiter will ramp over in one go,
+//so a stalled control task does not let the duty jump when it catches up
+#define SLEW_MAX_STEP_US 20000
+
+//Marks Motors::pendingCurrentLimit as holding a limit still to be written
+#define CURRENT_LIMIT_PENDING 0x8000
+
+//Marks Motors::pendingDriverProfile and pendingDecayMode as holding a setting still to be written
+#define DRIVER_SETTING_PENDING 0x80
+
 extern float currentLimit;
 
 class Motors {
   private:
-    float validateSpeed(float speed);
+    //The DRV8711 that drives the motors, this is always drivers[0]
+    DRV8711* driver;
+
+    DRV8711* drivers[MOTORS_MAX_DRIVERS];
+    uint8_t driverCount;
 
-    void setMotorForwardSpeed(MOTOR leftOrRightMotor, float speed);
+    //Configuration init() applies to the motor driver
+    DRIVER_PROFILE driverProfile;
+
+    PwmBackend* pwm;
+
+    float validateSpeed(float speed);
 
-    void setMotorBackwardSpeed(MOTOR leftOrRightMotor, float speed);
+    //Converts a speed from -100.0 to 100.0 into signed duty ticks for one motor
+    int32_t speedToTicks(MOTOR leftOrRightMotor, float speed);
 
     float validateCurrent(float current);
 
+    //Turns the current limit into the DRV8711's gain and TORQUE, returns false if it can't be reached
+    CurrentCalibration currentCalibration;
+    bool currentLimitRegisters(ISGAIN_GAIN& gain, uint8_t& torque);
+
+    //Gain and TORQUE of the last current limit that could be reached, what getCurrentLimit reports
+    ISGAIN_GAIN currentLimitGain;
+    uint8_t currentLimitTorque;
+
+    //A current limit setCurrentLimit has handed to the control task, written by checkFaults between recoveries
+    //CURRENT_LIMIT_PENDING is set while one is waiting, with the gain in bits 8-9 and TORQUE in bits 0-7
+    std::atomic<uint16_t> pendingCurrentLimit;
+
+    //A driver profile setDriverProfile has handed to the control task, DRIVER_SETTING_PENDING is set while one is waiting
+    std::atomic<uint8_t> pendingDriverProfile;
+
+    //A DECAYMODE setMotorBrakeMode has handed to the control task, written after any pending profile
+    std::atomic<uint8_t> pendingDecayMode;
+
+    //Queues the settings other tasks have handed over into the fault batch, only called while no recovery is running
+    void applyPendingDriverSettings();
+
+    //The registers the motor driver should hold: the driver profile with the current limit from setCurrentLimit
+    DRV8711Profile expectedDriverRegisters();
+
+    MotorsInitTimes initTimes;
+
+    DriverRecovery recoveries[MOTORS_MAX_DRIVERS];
+
+    //Every driver's fault handling frames for one checkFaults call, sent in one pass over the bus
+    SpiBatch faultBatch;
+
+    uint32_t faultBackoffMs[FAULT_CLASS_COUNT];
+
+    uint32_t faultCounts[FAULT_CLASS_COUNT];
+
+    //A motor whose H bridge has faulted is held at 0 until the fault is recovered
+    bool motorFaulted[MOTOR_COUNT];
+
+    //Latest command from each input source, read by controlStep
+    SetpointMailbox setpointMailboxes[SETPOINT_SOURCE_COUNT];
+
+    //Duty each motor was asked for and the duty it was actually driven at, in signed ticks
+    int32_t setpointTicks[MOTOR_COUNT];
+    int32_t appliedTicks[MOTOR_COUNT];
+
+    //Where the slew limiter has ramped each motor to, this carries on ramping while the motor is braked
+    int32_t rampTicks[MOTOR_COUNT];
+
+    //Brake mode of the latest setpoint, AUTO_BRAKE lets the brake policy apply
+    BRAKE_MODE setpointBrakeMode;
+
+    //Whether each motor is being braked rather than driven, and for how many ticks of each period
+    bool appliedBraking[MOTOR_COUNT];
+    uint32_t appliedBrakeTicks[MOTOR_COUNT];
+
+    BRAKE_POLICY brakePolicies[MOTOR_COUNT];
+
+    //How hard the brake policy brakes, in thousandths of each period
+    uint16_t brakePermille[MOTOR_COUNT];
+
+    //What each PWM output was last set to, so an unchanged speed is not written to the hardware again
+    bool outputValid[MOTOR_COUNT];
+    bool outputBraking[MOTOR_COUNT];
+    bool outputForward[MOTOR_COUNT];
+    uint32_t outputDutyTicks[MOTOR_COUNT];
+
+    //PWM settings for each motor and the length of its period in timer ticks, used to turn a speed into a duty
+    PwmConfig pwmConfigs[MOTOR_COUNT];
+    uint32_t pwmPeriodTicks[MOTOR_COUNT];
+    bool pwmStarted;
+
+    //Slew rate limits in % of full speed per second, 0 means no limit
+    float slewPercentPerSecond[SLEW_PHASE_COUNT];
+
+    //The same limits in ticks per second of each motor's PWM period, so the control task only uses integers
+    uint32_t slewTicksPerSecond[MOTOR_COUNT][SLEW_PHASE_COUNT];
+
+    //Part of a tick left over from the last step, in millionths of a tick, so slow ramps do not get rounded away
+    uint32_t slewRemainder[MOTOR_COUNT];
+
+    uint32_t lastSlewUs;
+    bool slewStarted;
+
+    void updateSlewTicks(MOTOR leftOrRightMotor);
+
+    //Input watchdog, a timeout of 0 turns it off
+    uint32_t inputTimeoutUs;
+    uint16_t failsafeBrakePermille;
+    bool inputSeen;
+    uint32_t lastInputUs;
+    InputWatchdogStats inputStats;
+
+    //Records a new setpoint's timestamp and returns true if the motors should be stopped because the input is stale
+    bool updateInputWatchdog(bool newSetpoint, uint32_t setpointTimestampUs, uint32_t nowUs);
+
+    //Moves a motor's slew ramp towards targetTicks by no more than its slew rate allows in elapsedUs
+    int32_t slewTowards(MOTOR leftOrRightMotor, int32_t targetTicks, uint32_t elapsedUs);
+
+    void applyMotorOutput(MOTOR leftOrRightMotor, bool forward, uint32_t dutyTicks);
+
+    void applyMotorBrake(MOTOR leftOrRightMotor, uint32_t brakeTicks);
+
+    //Drive or brake a motor without touching the slew ramp, a faulted motor is held coasting
+    void driveMotor(MOTOR leftOrRightMotor, int32_t dutyTicks);
+    void brakeMotor(MOTOR leftOrRightMotor, uint32_t brakeTicks);
+
+    //Reads the latest setpoint, checks the input watchdog and ramps, brakes or drives each motor
+    void applyLatestSetpoint();
+
+    //How hard the brake policy says to brake a motor this step, 0 means drive it as normal
+    uint32_t policyBrakeTicks(MOTOR leftOrRightMotor, int32_t targetTicks);
+
+    void detectCommsLoss(uint8_t driverIndex);
+
+    void detectFaults(uint8_t driverIndex, DriverStatus status);
+
+    void addFaultClass(uint8_t driverIndex, FAULT_CLASS faultClass);
+
+    //Advances one driver's recovery state machine, adding any frames it needs to the fault batch
+    void stepRecovery(uint8_t driverIndex);
+
+    void resetState();
+
   public:
+    //Uses the board's DRV8711 and MCPWM outputs
     Motors();
 
+    Motors(DRV8711& motorDriver, PwmBackend& pwmBackend);
+
+    //Reads the motor driver back first, if it kept its configuration through the reset
+    //(e.g. only the ESP32 browned out) its faults are cleared and it is enabled without writing the profile again
     void init();
 
+    MotorsInitTimes getInitTimes();
+
     void setMotorSpeed(MOTOR leftOrRightMotor, float speed);
 
+    //Same as setMotorSpeed but with the duty in ticks of the motor's PWM period, negative is backward
+    //This is the path controlStep uses, it has no floating point in it
+    void setMotorDutyTicks(MOTOR leftOrRightMotor, int32_t dutyTicks);
+
+    //Brakes one motor by turning on both low side FETs of its H bridge for brakePercent of each PWM period
+    //and letting it coast for the rest, 0 coasts and 100 is a full short brake
+    void setMotorBrake(MOTOR leftOrRightMotor, float brakePercent);
+
+    //Same as setMotorBrake but in ticks of the motor's PWM period
+    void setMotorBrakeTicks(MOTOR leftOrRightMotor, uint32_t brakeTicks);
+
+    bool isMotorBraking(MOTOR leftOrRightMotor);
+
+    //Publish a command to be applied on the next controlStep
+    //Each source must only be published from one task, but different sources can use different tasks
+    void publishSetpoint(SETPOINT_SOURCE source, float leftSpeed, float rightSpeed, BRAKE_MODE brakeMode = AUTO_BRAKE);
+
+    //Same as publishSetpoint but with the duties already in ticks, e.g. from an AxisShaper
+    //Duties are clamped to each motor's period when they are applied
+    //inputTimestampUs is micros() when the input was read, for the latency trace, 0 uses the time it is published
+    void publishSetpointTicks(SETPOINT_SOURCE source, int32_t leftTicks, int32_t rightTicks, BRAKE_MODE brakeMode = AUTO_BRAKE, uint32_t inputTimestampUs = 0);
+
+    //Gets the most recently published setpoint across all sources, returns false if there is none
+    bool getLatestSetpoint(MotorSetpoint& latestSetpoint);
+
+    //Ramps the motors towards the latest setpoint and polls for faults, called at a fixed rate by the control task
+    void controlStep();
+
+    //Stops the motors from controlStep if no new setpoint has been published for timeoutMs,
+    //they start again as soon as a new one is published, a timeout of 0 turns this off
+    //The motors are braked by failsafeBrakePercent while stopped, 0 lets them coast
+    //This also keeps them stopped until the first setpoint after it is turned on
+    void setInputTimeout(uint32_t timeoutMs, float failsafeBrakePercent = 0.0f);
+
+    InputWatchdogStats getInputWatchdogStats();
+
+    void resetInputWatchdogStats();
+
+    void printInputWatchdogStats();
+
+    //Fills in the timestamp, setpoints, applied speeds and driver status from the last controlStep
+    void fillTelemetryRecord(TelemetryRecord& record);
+
+    //Switches the DRV8711 decay mode for both motors at once
+    //The control task writes it on its next step with no fault recovery running, after init() if it is called before
+    //Call it from the same task as setDriverProfile, a profile picked after it sets the profile's decay mode again
+    //Braking each motor is done through its PWM outputs instead, see setBrakePolicy
     void setMotorBrakeMode(BRAKE_MODE brakeMode);
 
+    //Sets when controlStep brakes a motor and how hard, brakePercent is as for setMotorBrake
+    //Braking for a reversal lasts as long as the reverse slew ramp, so it needs a reverse slew rate
+    void setBrakePolicy(MOTOR leftOrRightMotor, BRAKE_POLICY policy, float brakePercent = 100.0f);
+
+    BRAKE_POLICY getBrakePolicy(MOTOR leftOrRightMotor);
+
+    //Sets the current limit in amps through the calibration table, rounding down to the nearest step it has
+    //After init() the new gain and TORQUE are handed to the control task, which writes the ones that change
+    //on its next step with no fault recovery running, so this can be called while driving,
+    //e.g. for a different limit in each drive mode
+    //Before init() this only sets what init() applies
+    //This and the calibration calls below must all be called from one task, e.g. setup() and loop()
     void setCurrentLimit(float current);
 
+    //The limit the motor driver is set to, or about to be, which can be a little under the one asked for
+    float getCurrentLimit();
+
+    //Replaces the calibration table and applies the current limit again with it
+    void setCurrentCalibration(const CurrentCalibration& calibration);
+
+    const CurrentCalibration& getCurrentCalibration();
+
+    //Loads a calibration table saved with saveCurrentCalibration, returns false and keeps the built in one if there is none
+    bool loadCurrentCalibration(SettingsStore& store);
+
+    bool saveCurrentCalibration(SettingsStore& store);
+
+    //Picks the motor driver's configuration from the profiles in drv8711_profile.h
+    //Before init() this sets what init() applies, after it the profile is handed to the control task,
+    //which writes it on its next step with no fault recovery running and reads it back on the step after
+    //The current limit from setCurrentLimit is kept, returns false if there is no such profile
+    //Call it from the same task as setCurrentLimit
+    bool setDriverProfile(DRIVER_PROFILE profile);
+
+    DRIVER_PROFILE getDriverProfile();
+
+    //Limits how quickly controlStep changes each motor's duty, in % of full speed per second
+    //e.g. an accelerate rate of 400 takes 250ms to go from stopped to full speed, 0 turns that limit off
+    //setMotorSpeed and setMotorDutyTicks are not limited, they always set the duty straight away
+    void setSlewRates(float acceleratePercentPerSecond, float deceleratePercentPerSecond, float reversePercentPerSecond);
+
+    float getSlewRate(SLEW_PHASE phase);
+
+    //Sets a motor's PWM frequency and timer resolution, returns false and changes nothing if they are not valid
+    //or the PWM hardware can't be set to them
+    //Before init() this sets what init() will use, after it the change is made straight away
+    //and the motor carries on at the same speed
+    //While the control scheduler is running this must only be called from the control task
+    bool setPwmConfig(MOTOR leftOrRightMotor, uint32_t frequencyHz, uint32_t resolutionHz = PWM_RESOLUTION_HZ);
+
+    PwmConfig getPwmConfig(MOTOR leftOrRightMotor);
+
+    //Ticks in one PWM period for a motor, this is full speed for setMotorDutyTicks and publishSetpointTicks
+    //Setpoints that are already published are not rescaled when this changes, so republish them
+    uint32_t getPwmPeriodTicks(MOTOR leftOrRightMotor);
+
+    //BENCH FUNCTIONS
+    //Runs both motors at speed while stepping the PWM frequency from startHz to endHz,
+    //then prints how often each DRV8711 fault was seen at each frequency
+    //This blocks for about dwellMs at every step, so run it before the control scheduler is started
+    //and with the robot's wheels off the ground
+    void pwmFrequencySweep(uint32_t startHz, uint32_t endHz, uint32_t stepHz, float speed, uint32_t dwellMs);
+
+    //Advances every driver's fault recovery state machine by one step, this never blocks
+    //All of the drivers' frames go out as one batch, which is collected by the next call
     void checkFaults();
 
+    void setFaultBackoff(FAULT_CLASS faultClass, uint32_t backoffMs);
+
+    //Number of faults of a class seen on all of the drivers
+    uint32_t getFaultCount(FAULT_CLASS faultClass);
+
+    RECOVERY_STATE getRecoveryState(uint8_t driverIndex = 0);
+
+    //Adds another DRV8711 on the same SPI bus and starts it, returns its index or -1 if it can't be added
+    //Its faults are polled and recovered along with the motor driver's, but Motors does not drive its outputs
+    //so use isDriverFaulted to stop whatever it drives. Add drivers before the control scheduler starts
+    int8_t addDriver(DRV8711& extraDriver);
+
+    uint8_t getDriverCount();
+
+    //True from when a driver's fault is seen until it has been recovered, driver 0 drives the motors
+    bool isDriverFaulted(uint8_t driverIndex);
+
+    bool isMotorFaulted(MOTOR leftOrRightMotor);
+
 };
 
 #endif
\ No newline at end of file
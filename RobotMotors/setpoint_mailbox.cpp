@@ -0,0 +1,52 @@
+#include "setpoint_mailbox.h"
+
+//A reader gives up after this many torn reads so it never waits on the writer
+const uint8_t SETPOINT_READ_ATTEMPTS = 4;
+
+SetpointMailbox::SetpointMailbox() : sequence(0){
+  for(uint8_t i = 0; i < MOTOR_COUNT; i++){
+    setpoint.dutyTicks[i] = 0;
+  }
+  setpoint.brakeMode = AUTO_BRAKE;
+  setpoint.source = SOURCE_CONTROLLER;
+  setpoint.timestampUs = 0;
+  setpoint.inputTimestampUs = 0;
+}
+
+void SetpointMailbox::publish(const MotorSetpoint& newSetpoint){
+  uint32_t startSequence = sequence.load(std::memory_order_relaxed);
+
+  //Odd sequence tells readers a write is in progress
+  sequence.store(startSequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  setpoint = newSetpoint;
+
+  //Even sequence publishes the new setpoint
+  sequence.store(startSequence + 2, std::memory_order_release);
+}
+
+bool SetpointMailbox::read(MotorSetpoint& latestSetpoint) const{
+  for(uint8_t attempt = 0; attempt < SETPOINT_READ_ATTEMPTS; attempt++){
+    uint32_t startSequence = sequence.load(std::memory_order_acquire);
+    if(startSequence == 0){
+      return false;
+    }
+    if(startSequence & 1){
+      continue;
+    }
+
+    MotorSetpoint copy = setpoint;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(sequence.load(std::memory_order_relaxed) == startSequence){
+      latestSetpoint = copy;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t SetpointMailbox::getPublishCount() const{
+  return sequence.load(std::memory_order_relaxed) / 2;
+}
@@ -0,0 +1,52 @@
+#ifndef __SETPOINT_MAILBOX__
+#define __SETPOINT_MAILBOX__
+#include <stdint.h>
+#include <atomic>
+#include "motor_types.h"
+
+//Everything that can command the motors, each source publishes to its own mailbox
+enum SETPOINT_SOURCE {
+    SOURCE_CONTROLLER = 0,
+    SOURCE_RC_RECEIVER = 1,
+    SOURCE_SERIAL_CONSOLE = 2,
+    SOURCE_AUTONOMOUS = 3,
+    SETPOINT_SOURCE_COUNT = 4
+};
+
+//One complete motor command
+struct MotorSetpoint {
+  //Duty of each motor in ticks of its PWM period, negative is backward
+  int32_t dutyTicks[MOTOR_COUNT];
+  BRAKE_MODE brakeMode;
+  SETPOINT_SOURCE source;
+
+  //micros() at the time the setpoint was published
+  uint32_t timestampUs;
+
+  //micros() at the time the input this setpoint came from was read, used to measure latency
+  uint32_t inputTimestampUs;
+};
+
+//Passes the latest MotorSetpoint from one writer to any number of readers without a mutex
+//This is a sequence lock: the writer makes the sequence odd while it is writing and even when
+//it is done, so a reader knows its copy is coherent if it saw the same even sequence before and after
+class SetpointMailbox {
+  private:
+    std::atomic<uint32_t> sequence;
+    MotorSetpoint setpoint;
+
+  public:
+    SetpointMailbox();
+
+    //Only one task may publish to a mailbox, this never waits
+    void publish(const MotorSetpoint& newSetpoint);
+
+    //Copies out the latest setpoint, returns false if nothing has been published yet
+    //or the writer kept overwriting it, in which case the reader should try again next cycle
+    bool read(MotorSetpoint& latestSetpoint) const;
+
+    //Number of times publish has been called
+    uint32_t getPublishCount() const;
+};
+
+#endif
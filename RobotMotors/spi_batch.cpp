@@ -0,0 +1,21 @@
+#include "spi_batch.h"
+
+SpiBatch::SpiBatch(){
+  frameCount = 0;
+  state = SPI_BATCH_IDLE;
+}
+
+void SpiBatch::clear(){
+  frameCount = 0;
+  state = SPI_BATCH_IDLE;
+}
+
+int8_t SpiBatch::add(uint8_t csPin, uint16_t frame){
+  if(frameCount >= SPI_BATCH_MAX_FRAMES){
+    return -1;
+  }
+  csPins[frameCount] = csPin;
+  txFrames[frameCount] = frame;
+  rxFrames[frameCount] = 0xFFFF;
+  return frameCount++;
+}
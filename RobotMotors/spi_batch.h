@@ -0,0 +1,38 @@
+#ifndef __SPI_BATCH__
+#define __SPI_BATCH__
+#include <stdint.h>
+
+//Most frames one batch can hold, enough for four DRV8711s to each read or write every register
+#define SPI_BATCH_MAX_FRAMES 32
+
+enum SPI_BATCH_STATE {
+    //Being filled in, or collected and free to be reused
+    SPI_BATCH_IDLE = 0,
+    //Handed to the bus, the received frames are not ready yet
+    SPI_BATCH_QUEUED = 1,
+    //Every frame has been sent and received
+    SPI_BATCH_DONE = 2
+};
+
+//16 bit frames queued on the SPI bus together and collected later, so the caller never waits on the bus
+//Frames are sent in order, each one to the device on its own chip select pin
+//A frame the bus could not send reads back as all 1s, the same as a device that did not answer
+struct SpiBatch {
+  uint8_t frameCount;
+  uint8_t csPins[SPI_BATCH_MAX_FRAMES];
+  uint16_t txFrames[SPI_BATCH_MAX_FRAMES];
+  uint16_t rxFrames[SPI_BATCH_MAX_FRAMES];
+
+  //Written by the bus, which may finish the batch from another task
+  volatile SPI_BATCH_STATE state;
+
+  SpiBatch();
+
+  //Empties the batch ready for new frames
+  void clear();
+
+  //Adds a frame and returns its index, or -1 if the batch is full
+  int8_t add(uint8_t csPin, uint16_t frame);
+};
+
+#endif
@@ -0,0 +1,247 @@
+#include "telemetry.h"
+#include <string.h>
+
+uint16_t telemetryCrc16(const uint8_t* data, size_t length){
+  uint16_t crc = 0xFFFF;
+  for(size_t i = 0; i < length; i++){
+    crc ^= (uint16_t)data[i] << 8;
+    for(uint8_t bit = 0; bit < 8; bit++){
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+size_t cobsEncode(const uint8_t* input, size_t length, uint8_t* output){
+  size_t codeIndex = 0;
+  size_t outputIndex = 1;
+  uint8_t code = 1;
+  for(size_t i = 0; i < length; i++){
+    if(input[i] == 0){
+      output[codeIndex] = code;
+      codeIndex = outputIndex++;
+      code = 1;
+    }
+    else{
+      output[outputIndex++] = input[i];
+      code++;
+      if(code == 0xFF){
+        output[codeIndex] = code;
+        codeIndex = outputIndex++;
+        code = 1;
+      }
+    }
+  }
+  output[codeIndex] = code;
+  return outputIndex;
+}
+
+size_t cobsDecode(const uint8_t* input, size_t length, uint8_t* output){
+  size_t inputIndex = 0;
+  size_t outputIndex = 0;
+  while(inputIndex < length){
+    uint8_t code = input[inputIndex++];
+    if(code == 0 || inputIndex + code - 1 > length){
+      return 0;
+    }
+    for(uint8_t i = 1; i < code; i++){
+      output[outputIndex++] = input[inputIndex++];
+    }
+    if(code != 0xFF && inputIndex < length){
+      output[outputIndex++] = 0;
+    }
+  }
+  return outputIndex;
+}
+
+static void putUint16(uint8_t* data, uint16_t value){
+  data[0] = value & 0xFF;
+  data[1] = value >> 8;
+}
+
+static void putUint32(uint8_t* data, uint32_t value){
+  putUint16(data, value & 0xFFFF);
+  putUint16(data + 2, value >> 16);
+}
+
+static uint16_t getUint16(const uint8_t* data){
+  return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+static uint32_t getUint32(const uint8_t* data){
+  return getUint16(data) | ((uint32_t)getUint16(data + 2) << 16);
+}
+
+//Records are written field by field in little endian so the layout does not depend on the compiler
+static void packRecord(const TelemetryRecord& record, uint8_t* data){
+  putUint32(data, record.timestampUs);
+  putUint16(data + 4, record.sequence);
+  for(uint8_t i = 0; i < 4; i++){
+    putUint16(data + 6 + i * 2, (uint16_t)record.axes[i]);
+  }
+  for(uint8_t i = 0; i < 2; i++){
+    putUint16(data + 14 + i * 2, (uint16_t)record.setpoint[i]);
+    putUint16(data + 18 + i * 2, (uint16_t)record.appliedDuty[i]);
+  }
+  putUint16(data + 22, record.driverStatus);
+  putUint16(data + 24, record.loopExecutionUs);
+  putUint16(data + 26, record.loopJitterUs);
+}
+
+static void unpackRecord(const uint8_t* data, TelemetryRecord& record){
+  record.timestampUs = getUint32(data);
+  record.sequence = getUint16(data + 4);
+  for(uint8_t i = 0; i < 4; i++){
+    record.axes[i] = (int16_t)getUint16(data + 6 + i * 2);
+  }
+  for(uint8_t i = 0; i < 2; i++){
+    record.setpoint[i] = (int16_t)getUint16(data + 14 + i * 2);
+    record.appliedDuty[i] = (int16_t)getUint16(data + 18 + i * 2);
+  }
+  record.driverStatus = getUint16(data + 22);
+  record.loopExecutionUs = getUint16(data + 24);
+  record.loopJitterUs = getUint16(data + 26);
+}
+
+size_t encodeTelemetryFrame(const TelemetryRecord& record, uint8_t* output){
+  uint8_t payload[TELEMETRY_PAYLOAD_SIZE];
+  payload[0] = TELEMETRY_FRAME_TYPE_CONTROL;
+  packRecord(record, payload + 1);
+  putUint16(payload + 1 + TELEMETRY_RECORD_SIZE, telemetryCrc16(payload, 1 + TELEMETRY_RECORD_SIZE));
+
+  output[0] = 0;
+  size_t length = 1 + cobsEncode(payload, TELEMETRY_PAYLOAD_SIZE, output + 1);
+  output[length++] = 0;
+  return length;
+}
+
+TelemetryDecoder::TelemetryDecoder(){
+  bufferLength = 0;
+  overflowed = false;
+  haveSequence = false;
+  lastSequence = 0;
+  memset(&stats, 0, sizeof(stats));
+}
+
+bool TelemetryDecoder::decodeByte(uint8_t byte, TelemetryRecord& record){
+  if(byte != 0){
+    if(bufferLength < sizeof(buffer)){
+      buffer[bufferLength++] = byte;
+    }
+    else{
+      overflowed = true;
+    }
+    return false;
+  }
+
+  //0x00 marks the end of a frame
+  size_t frameLength = bufferLength;
+  bool frameOverflowed = overflowed;
+  bufferLength = 0;
+  overflowed = false;
+
+  //Two delimiters in a row, e.g. when the stream starts
+  if(frameLength == 0){
+    return false;
+  }
+
+  uint8_t payload[TELEMETRY_MAX_FRAME_SIZE];
+  size_t payloadLength = frameOverflowed ? 0 : cobsDecode(buffer, frameLength, payload);
+  if(payloadLength != TELEMETRY_PAYLOAD_SIZE || payload[0] != TELEMETRY_FRAME_TYPE_CONTROL){
+    stats.framingErrors++;
+    return false;
+  }
+
+  uint16_t crc = getUint16(payload + 1 + TELEMETRY_RECORD_SIZE);
+  if(crc != telemetryCrc16(payload, 1 + TELEMETRY_RECORD_SIZE)){
+    stats.crcErrors++;
+    return false;
+  }
+
+  unpackRecord(payload + 1, record);
+  if(haveSequence){
+    stats.recordsMissed += (uint16_t)(record.sequence - lastSequence - 1);
+  }
+  haveSequence = true;
+  lastSequence = record.sequence;
+  stats.framesDecoded++;
+  return true;
+}
+
+TelemetryDecoderStats TelemetryDecoder::getStats() const{
+  return stats;
+}
+
+static bool recordsMatch(const TelemetryRecord& a, const TelemetryRecord& b){
+  return a.timestampUs == b.timestampUs && a.sequence == b.sequence
+    && memcmp(a.axes, b.axes, sizeof(a.axes)) == 0
+    && memcmp(a.setpoint, b.setpoint, sizeof(a.setpoint)) == 0
+    && memcmp(a.appliedDuty, b.appliedDuty, sizeof(a.appliedDuty)) == 0
+    && a.driverStatus == b.driverStatus
+    && a.loopExecutionUs == b.loopExecutionUs && a.loopJitterUs == b.loopJitterUs;
+}
+
+//################## TEST FUNCTIONS #####################
+bool testTelemetryRoundTrip(){
+  TelemetryRecord records[3];
+
+  //All zeros, so every byte needs COBS escaping
+  memset(&records[0], 0, sizeof(TelemetryRecord));
+
+  //Extreme values
+  records[1].timestampUs = 0xFFFFFFFF;
+  records[1].sequence = 1;
+  records[1].axes[0] = -511; records[1].axes[1] = 512; records[1].axes[2] = -32768; records[1].axes[3] = 32767;
+  records[1].setpoint[0] = -10000; records[1].setpoint[1] = 10000;
+  records[1].appliedDuty[0] = 0; records[1].appliedDuty[1] = -1;
+  records[1].driverStatus = 0x0FFF;
+  records[1].loopExecutionUs = 0xFFFF;
+  records[1].loopJitterUs = 0;
+
+  //Typical values
+  records[2].timestampUs = 123456789;
+  records[2].sequence = 2;
+  records[2].axes[0] = 4; records[2].axes[1] = -200; records[2].axes[2] = 0; records[2].axes[3] = 300;
+  records[2].setpoint[0] = -4878; records[2].setpoint[1] = 7317;
+  records[2].appliedDuty[0] = -4800; records[2].appliedDuty[1] = 7300;
+  records[2].driverStatus = 0x0002;
+  records[2].loopExecutionUs = 85;
+  records[2].loopJitterUs = 12;
+
+  //Start with some junk that has no delimiter after it
+  //The leading delimiter of the first frame should throw it away
+  TelemetryDecoder decoder;
+  TelemetryRecord decoded;
+  const uint8_t junk[] = {'E', 'r', 'r', 0x00, 0x05, 0x01};
+  for(size_t i = 0; i < sizeof(junk); i++){
+    if(decoder.decodeByte(junk[i], decoded)){
+      return false;
+    }
+  }
+
+  for(uint8_t i = 0; i < 3; i++){
+    uint8_t frame[TELEMETRY_MAX_FRAME_SIZE];
+    size_t length = encodeTelemetryFrame(records[i], frame);
+    bool complete = false;
+    for(size_t j = 0; j < length; j++){
+      //The only 0x00 bytes in the frame must be the delimiters
+      if(frame[j] == 0 && j != 0 && j != length - 1){
+        return false;
+      }
+      complete = decoder.decodeByte(frame[j], decoded);
+    }
+    if(!complete || !recordsMatch(records[i], decoded)){
+      return false;
+    }
+  }
+
+  //Flipping a bit must be caught by the CRC
+  uint8_t frame[TELEMETRY_MAX_FRAME_SIZE];
+  size_t length = encodeTelemetryFrame(records[2], frame);
+  frame[5] ^= 0x10;
+  bool complete = false;
+  for(size_t j = 0; j < length; j++){
+    complete = decoder.decodeByte(frame[j], decoded);
+  }
+  return !complete && decoder.getStats().framesDecoded == 3;
+}
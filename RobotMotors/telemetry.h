@@ -0,0 +1,88 @@
+#ifndef __TELEMETRY__
+#define __TELEMETRY__
+#include <stdint.h>
+#include <stddef.h>
+
+//This file has no Arduino dependencies so the host decoder can use it too
+
+//Frame layout before encoding: [type][record][CRC16 low][CRC16 high]
+//The frame is then COBS encoded, which removes every 0x00 byte, and wrapped in 0x00 delimiters
+//That lets a reader find the start of the next frame after a dropped or corrupted byte,
+//and the leading delimiter means any text printed between frames cannot corrupt the next one
+#define TELEMETRY_FRAME_TYPE_CONTROL 0x01
+
+#define TELEMETRY_RECORD_SIZE 28
+
+//Type byte + record + 2 CRC bytes
+#define TELEMETRY_PAYLOAD_SIZE (1 + TELEMETRY_RECORD_SIZE + 2)
+
+//COBS adds at most one byte per 254, plus the two 0x00 delimiters
+#define TELEMETRY_MAX_FRAME_SIZE (TELEMETRY_PAYLOAD_SIZE + (TELEMETRY_PAYLOAD_SIZE / 254) + 3)
+
+//One control cycle worth of telemetry
+struct TelemetryRecord {
+  uint32_t timestampUs;
+
+  //Counts up by one every record so the decoder can spot dropped records
+  uint16_t sequence;
+
+  //Raw controller axes: left X, left Y, right X, right Y
+  int16_t axes[4];
+
+  //Setpoint and applied speed of each motor in 0.01% steps (-10000 to 10000)
+  int16_t setpoint[2];
+  int16_t appliedDuty[2];
+
+  //DRV8711 STATUS register
+  uint16_t driverStatus;
+
+  uint16_t loopExecutionUs;
+  uint16_t loopJitterUs;
+};
+
+//CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF)
+uint16_t telemetryCrc16(const uint8_t* data, size_t length);
+
+//COBS encode length bytes into output, returns the encoded length (without a delimiter)
+size_t cobsEncode(const uint8_t* input, size_t length, uint8_t* output);
+
+//COBS decode length bytes into output, returns the decoded length or 0 if the data is not valid COBS
+size_t cobsDecode(const uint8_t* input, size_t length, uint8_t* output);
+
+//Builds a complete frame including the 0x00 delimiters, output must hold TELEMETRY_MAX_FRAME_SIZE bytes
+//Returns the number of bytes to send
+size_t encodeTelemetryFrame(const TelemetryRecord& record, uint8_t* output);
+
+struct TelemetryDecoderStats {
+  uint32_t framesDecoded;
+  uint32_t crcErrors;
+  uint32_t framingErrors;
+
+  //Gaps in the record sequence numbers
+  uint32_t recordsMissed;
+};
+
+//Reassembles frames from a byte stream, feed it one byte at a time
+class TelemetryDecoder {
+  private:
+    uint8_t buffer[TELEMETRY_MAX_FRAME_SIZE];
+    size_t bufferLength;
+    bool overflowed;
+    bool haveSequence;
+    uint16_t lastSequence;
+    TelemetryDecoderStats stats;
+
+  public:
+    TelemetryDecoder();
+
+    //Returns true when byte completes a valid frame, the record is then copied into record
+    bool decodeByte(uint8_t byte, TelemetryRecord& record);
+
+    TelemetryDecoderStats getStats() const;
+};
+
+//Encodes a set of records, including ones with 0x00 bytes and extreme values,
+//and checks they decode back to the same thing. Returns true if they all do
+bool testTelemetryRoundTrip();
+
+#endif
@@ -0,0 +1,89 @@
+#include "platform.h"
+#include "telemetry_stream.h"
+
+TelemetryStream::TelemetryStream() : writeIndex(0), readIndex(0), recordsDropped(0), leftAxes(0), rightAxes(0){
+  decimation = 1;
+  decimationCounter = 0;
+  sequence = 0;
+  running = false;
+}
+
+bool TelemetryStream::begin(uint32_t controlRateHz, uint32_t rateHz, uint8_t core, uint8_t priority){
+  if(rateHz == 0 || rateHz > controlRateHz){
+    Serial.printf("Error: invalid telemetry rate %u Hz\n", rateHz);
+    return false;
+  }
+  decimation = controlRateHz / rateHz;
+  decimationCounter = 0;
+#ifdef ARDUINO
+  running = xTaskCreatePinnedToCore(telemetryTask, "Telemetry", TELEMETRY_TASK_STACK_SIZE, this, priority, nullptr, core) == pdPASS;
+#else
+  //There are no tasks on the host, call flush to send the records
+  (void)core;
+  (void)priority;
+  running = true;
+#endif
+  return running;
+}
+
+void TelemetryStream::setInputAxes(int16_t leftX, int16_t leftY, int16_t rightX, int16_t rightY){
+  leftAxes.store(((uint32_t)(uint16_t)leftX << 16) | (uint16_t)leftY, std::memory_order_relaxed);
+  rightAxes.store(((uint32_t)(uint16_t)rightX << 16) | (uint16_t)rightY, std::memory_order_relaxed);
+}
+
+bool TelemetryStream::shouldSample(){
+  if(!running){
+    return false;
+  }
+  if(++decimationCounter < decimation){
+    return false;
+  }
+  decimationCounter = 0;
+  return true;
+}
+
+void TelemetryStream::publish(TelemetryRecord& record){
+  uint32_t left = leftAxes.load(std::memory_order_relaxed);
+  uint32_t right = rightAxes.load(std::memory_order_relaxed);
+  record.axes[0] = (int16_t)(left >> 16);
+  record.axes[1] = (int16_t)(left & 0xFFFF);
+  record.axes[2] = (int16_t)(right >> 16);
+  record.axes[3] = (int16_t)(right & 0xFFFF);
+  record.sequence = sequence++;
+
+  //Single producer, single consumer ring buffer
+  uint32_t write = writeIndex.load(std::memory_order_relaxed);
+  if(write - readIndex.load(std::memory_order_acquire) >= TELEMETRY_BUFFER_SIZE){
+    recordsDropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  records[write & (TELEMETRY_BUFFER_SIZE - 1)] = record;
+  writeIndex.store(write + 1, std::memory_order_release);
+}
+
+uint32_t TelemetryStream::flush(){
+  uint32_t sent = 0;
+  uint32_t read = readIndex.load(std::memory_order_relaxed);
+  while(read != writeIndex.load(std::memory_order_acquire)){
+    uint8_t frame[TELEMETRY_MAX_FRAME_SIZE];
+    size_t length = encodeTelemetryFrame(records[read & (TELEMETRY_BUFFER_SIZE - 1)], frame);
+    readIndex.store(++read, std::memory_order_release);
+    Serial.write(frame, length);
+    sent++;
+  }
+  return sent;
+}
+
+#ifdef ARDUINO
+void TelemetryStream::telemetryTask(void* parameter){
+  TelemetryStream* stream = (TelemetryStream*)parameter;
+  for(;;){
+    stream->flush();
+    vTaskDelay(pdMS_TO_TICKS(TELEMETRY_TASK_PERIOD_MS));
+  }
+}
+#endif
+
+uint32_t TelemetryStream::getDroppedRecords(){
+  return recordsDropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,62 @@
+#ifndef __TELEMETRY_STREAM__
+#define __TELEMETRY_STREAM__
+#include "platform.h"
+#include <atomic>
+#include "telemetry.h"
+
+//Records sent per second, each frame is 34 bytes so 250 Hz needs about 8.5 KB/s
+//That fits within 115200 baud, raise the baud rate for anything faster
+#define TELEMETRY_RATE_HZ 250
+
+//Number of records waiting to be sent, must be a power of 2
+#define TELEMETRY_BUFFER_SIZE 32
+
+#define TELEMETRY_TASK_CORE 1
+#define TELEMETRY_TASK_PRIORITY 1
+#define TELEMETRY_TASK_STACK_SIZE 4096
+#define TELEMETRY_TASK_PERIOD_MS 5
+
+//Streams TelemetryRecords as binary frames over Serial
+//The control task queues records without waiting and a low priority task encodes and sends them
+class TelemetryStream {
+  private:
+    TelemetryRecord records[TELEMETRY_BUFFER_SIZE];
+    std::atomic<uint32_t> writeIndex;
+    std::atomic<uint32_t> readIndex;
+    std::atomic<uint32_t> recordsDropped;
+
+    //Raw axes packed two to a word so the input task can update them without a lock
+    std::atomic<uint32_t> leftAxes;
+    std::atomic<uint32_t> rightAxes;
+
+    uint32_t decimation;
+    uint32_t decimationCounter;
+    uint16_t sequence;
+    bool running;
+
+#ifdef ARDUINO
+    static void telemetryTask(void* parameter);
+#endif
+
+  public:
+    TelemetryStream();
+
+    //controlRateHz is how often shouldSample is called, rateHz is how many records per second to send
+    bool begin(uint32_t controlRateHz, uint32_t rateHz = TELEMETRY_RATE_HZ, uint8_t core = TELEMETRY_TASK_CORE, uint8_t priority = TELEMETRY_TASK_PRIORITY);
+
+    //Called by the input side whenever new controller values arrive
+    void setInputAxes(int16_t leftX, int16_t leftY, int16_t rightX, int16_t rightY);
+
+    //Called once per control cycle, returns true on the cycles that should be recorded
+    bool shouldSample();
+
+    //Adds the raw axes and a sequence number then queues the record, never blocks
+    void publish(TelemetryRecord& record);
+
+    //Encodes and writes every queued record to Serial, returns how many were sent
+    uint32_t flush();
+
+    uint32_t getDroppedRecords();
+};
+
+#endif
@@ -0,0 +1,439 @@
+//Benchmarks the RobotMotors library on the host against the simulated DRV8711 and PWM backend
+//
+//This is built by the CMakeLists.txt in the root of the repository
+//
+//  ./build/robot_motors_bench                       prints a table
+//  ./build/robot_motors_bench --json results.json   also writes the results as JSON
+//  ./build/robot_motors_bench --min-time-ms 500     runs each benchmark for longer
+//  ./build/robot_motors_bench --self-test           runs the library's self tests instead
+//  ./build/robot_motors_bench --stop-time           prints how long each way of stopping takes instead
+//
+//For each benchmark it reports the time per call, the SPI frames, PWM updates and bytes logged per call
+//SPI frames, PWM updates and logged bytes are exact counts, so a change to either is a real change in bus or log traffic
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <functional>
+#include "robot_motors.h"
+#include "control_scheduler.h"
+#include "drv8711_sim.h"
+#include "event_log.h"
+#include "axis_shaper.h"
+#include "drive_mixer.h"
+#include "telemetry.h"
+#include "motor_sim.h"
+#include "latency_trace.h"
+
+struct BenchResult {
+  std::string name;
+  uint64_t iterations;
+  double nsPerCall;
+  double spiFramesPerCall;
+  double pwmUpdatesPerCall;
+  double logBytesPerCall;
+};
+
+//Everything a benchmark runs against
+struct BenchContext {
+  DRV8711Simulator simulator;
+  Motors motors;
+  ControlScheduler scheduler;
+};
+
+//Chip select of the first extra DRV8711 in the driver scaling benchmarks, the rest follow on from it
+#define BENCH_EXTRA_DRIVER_CS_PIN 15
+
+static BenchContext* context = nullptr;
+static uint32_t minTimeMs = 200;
+static FILE* logSink = nullptr;
+
+typedef std::chrono::steady_clock BenchClock;
+
+//Results are written here so the compiler can't throw the work away
+static volatile int32_t benchSink = 0;
+
+//Stick readings swept across the whole axis range
+static int32_t benchAxis(uint64_t i){
+  return (int32_t)(i % AXIS_TABLE_SIZE) + AXIS_RAW_MIN;
+}
+
+//What the sketch used to do with a stick reading: map() to a float speed, clamp it, then turn it into ticks
+static int32_t floatStickToTicks(int32_t raw, uint32_t periodTicks){
+  float speed = map(raw, -400, 420, -100, 100);
+  if(speed > 100.0f){
+    speed = 100.0f;
+  }
+  else if(speed < -100.0f){
+    speed = -100.0f;
+  }
+  float ticks = speed * periodTicks / 100.0f;
+  return (int32_t)(ticks >= 0.0f ? ticks + 0.5f : ticks - 0.5f);
+}
+
+static AxisShaper benchShaper;
+static DriveMixer benchMixer;
+
+static uint32_t loggedBytes(){
+  LogStats stats = eventLog.getStats();
+  return (stats.recordsLogged + stats.recordsDropped) * sizeof(LogRecord);
+}
+
+//Works out how long it takes to read the clock twice so it can be taken off each measurement
+static double measureTimerOverheadNs(){
+  const int samples = 100000;
+  BenchClock::time_point start = BenchClock::now();
+  for(int i = 0; i < samples; i++){
+    BenchClock::time_point a = BenchClock::now();
+    BenchClock::time_point b = BenchClock::now();
+    (void)a;
+    (void)b;
+  }
+  double total = std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+  return total / samples / 2.0;
+}
+
+static double timerOverheadNs = 0;
+
+//Runs body until at least minTimeMs of it has been timed
+//setup runs before every call but is not timed or counted
+static BenchResult runBenchmark(const char* name, std::function<void(uint64_t)> body, std::function<void(uint64_t)> setup = nullptr){
+  BenchResult result;
+  result.name = name;
+  result.iterations = 0;
+
+  double totalNs = 0;
+  uint64_t totalFrames = 0;
+  uint64_t totalPwmUpdates = 0;
+  uint64_t totalLogBytes = 0;
+
+  while(totalNs < minTimeMs * 1e6 || result.iterations < 100){
+    if(setup){
+      setup(result.iterations);
+    }
+
+    uint32_t framesBefore = drvSpiBus.getTransferCount();
+    uint32_t pwmUpdatesBefore = motorPwm.getUpdateCount();
+    uint32_t logBytesBefore = loggedBytes();
+
+    BenchClock::time_point start = BenchClock::now();
+    body(result.iterations);
+    BenchClock::time_point end = BenchClock::now();
+
+    totalNs += std::chrono::duration<double, std::nano>(end - start).count();
+    totalFrames += drvSpiBus.getTransferCount() - framesBefore;
+    totalPwmUpdates += motorPwm.getUpdateCount() - pwmUpdatesBefore;
+    totalLogBytes += loggedBytes() - logBytesBefore;
+    result.iterations++;
+
+    //Empty the log so it never fills up and starts dropping
+    eventLog.drain();
+  }
+
+  //Take the clock reads off the average, not each sample, so the total only ever grows
+  result.nsPerCall = totalNs / result.iterations - timerOverheadNs;
+  if(result.nsPerCall < 0){
+    result.nsPerCall = 0;
+  }
+  result.spiFramesPerCall = (double)totalFrames / result.iterations;
+  result.pwmUpdatesPerCall = (double)totalPwmUpdates / result.iterations;
+  result.logBytesPerCall = (double)totalLogBytes / result.iterations;
+  return result;
+}
+
+//For calls too short to time one at a time, pure computation with no SPI, PWM or logging
+//Times batches of MICRO_BATCH_SIZE calls so the clock reads don't swamp the result
+#define MICRO_BATCH_SIZE 1024
+
+static BenchResult runMicroBenchmark(const char* name, std::function<void(uint64_t)> body){
+  BenchResult result;
+  result.name = name;
+  result.iterations = 0;
+  result.spiFramesPerCall = 0;
+  result.pwmUpdatesPerCall = 0;
+  result.logBytesPerCall = 0;
+
+  double totalNs = 0;
+  while(totalNs < minTimeMs * 1e6){
+    BenchClock::time_point start = BenchClock::now();
+    for(uint32_t i = 0; i < MICRO_BATCH_SIZE; i++){
+      body(result.iterations + i);
+    }
+    BenchClock::time_point end = BenchClock::now();
+
+    totalNs += std::chrono::duration<double, std::nano>(end - start).count();
+    result.iterations += MICRO_BATCH_SIZE;
+  }
+
+  //The clock is read once per batch, so its cost is spread across the whole batch
+  result.nsPerCall = (totalNs - timerOverheadNs * result.iterations / MICRO_BATCH_SIZE) / result.iterations;
+  return result;
+}
+
+static void printTable(const std::vector<BenchResult>& results){
+  printf("%-36s %12s %12s %12s %12s %12s\n", "benchmark", "iterations", "ns/call", "spi/call", "pwm/call", "logB/call");
+  for(size_t i = 0; i < results.size(); i++){
+    printf("%-36s %12llu %12.1f %12.2f %12.2f %12.2f\n", results[i].name.c_str(), (unsigned long long)results[i].iterations,
+      results[i].nsPerCall, results[i].spiFramesPerCall, results[i].pwmUpdatesPerCall, results[i].logBytesPerCall);
+  }
+}
+
+static bool writeJson(const char* path, const std::vector<BenchResult>& results){
+  FILE* file = fopen(path, "w");
+  if(file == nullptr){
+    fprintf(stderr, "Could not open %s\n", path);
+    return false;
+  }
+  fprintf(file, "{\n  \"timer_overhead_ns\": %.1f,\n  \"benchmarks\": [\n", timerOverheadNs);
+  for(size_t i = 0; i < results.size(); i++){
+    fprintf(file, "    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_call\": %.1f, \"spi_frames_per_call\": %.3f, \"pwm_updates_per_call\": %.3f, \"log_bytes_per_call\": %.3f}%s\n",
+      results[i].name.c_str(), (unsigned long long)results[i].iterations, results[i].nsPerCall,
+      results[i].spiFramesPerCall, results[i].pwmUpdatesPerCall, results[i].logBytesPerCall, (i + 1 < results.size()) ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+  fclose(file);
+  return true;
+}
+
+//One way of stopping the left motor from full speed forward
+struct StopCase {
+  const char* name;
+  BRAKE_MODE brakeMode;
+  BRAKE_POLICY policy;
+  float brakePercent;
+  //0 to stop, or -100 to reverse, in which case the time is until the motor has stopped and reached 1% backward
+  float newSpeed;
+};
+
+//Most of a stop happens in the first few time constants, so give up after this long
+#define STOP_TIMEOUT_US 5000000
+
+//The control step and motor model are stepped together on the host's simulated clock
+#define STOP_STEP_US 1000
+
+//Runs the control step at 1kHz on the simulated clock, with the motor model following along,
+//and prints how long each way of stopping takes and the highest current on the way
+static void printStopTimes(){
+  static const StopCase STOP_CASES[] = {
+    {"coast", NEUTRAL, BRAKE_NEVER, 0.0f, 0.0f},
+    {"brake 25%", AUTO_BRAKE, BRAKE_AT_ZERO, 25.0f, 0.0f},
+    {"brake 50%", AUTO_BRAKE, BRAKE_AT_ZERO, 50.0f, 0.0f},
+    {"brake 100%", AUTO_BRAKE, BRAKE_AT_ZERO, 100.0f, 0.0f},
+    {"reverse, no brake", AUTO_BRAKE, BRAKE_NEVER, 0.0f, -100.0f},
+    {"reverse, brake 100%", AUTO_BRAKE, BRAKE_AT_ZERO_AND_REVERSE, 100.0f, -100.0f}
+  };
+  MotorSimulator motorSimulator(motorPwm);
+  Motors& motors = context->motors;
+
+  //The same ramps as the sketch
+  motors.setSlewRates(400.0f, 800.0f, 600.0f);
+  printf("%-24s %12s %20s\n", "stop", "time (ms)", "peak current (%)");
+  for(size_t i = 0; i < sizeof(STOP_CASES) / sizeof(STOP_CASES[0]); i++){
+    const StopCase& stopCase = STOP_CASES[i];
+    motors.setBrakePolicy(LEFT_MOTOR, stopCase.policy, stopCase.brakePercent);
+
+    //Start at full speed, the first step just restarts the slew timer
+    motors.setMotorSpeed(LEFT_MOTOR, 100.0f);
+    motorSimulator.setSpeed(LEFT_MOTOR, 1.0f);
+    motors.publishSetpoint(SOURCE_CONTROLLER, 100.0f, 0.0f, stopCase.brakeMode);
+    motors.controlStep();
+
+    motors.publishSetpoint(SOURCE_CONTROLLER, stopCase.newSpeed, 0.0f, stopCase.brakeMode);
+    uint32_t elapsedUs = 0;
+    float peakCurrent = 0.0f;
+    bool stopped = false;
+    while(!stopped && elapsedUs < STOP_TIMEOUT_US){
+      motors.controlStep();
+      advanceHostClock(STOP_STEP_US);
+      motorSimulator.step(STOP_STEP_US);
+      elapsedUs += STOP_STEP_US;
+
+      float current = motorSimulator.getCurrent(LEFT_MOTOR);
+      if(current < 0.0f){
+        current = -current;
+      }
+      if(current > peakCurrent){
+        peakCurrent = current;
+      }
+      float speed = motorSimulator.getSpeed(LEFT_MOTOR);
+      stopped = (stopCase.newSpeed < 0.0f) ? (speed <= -0.01f) : (speed < 0.01f);
+    }
+
+    if(stopped){
+      printf("%-24s %12.0f %20.0f\n", stopCase.name, elapsedUs / 1000.0f, peakCurrent * 100.0f);
+    }
+    else{
+      printf("%-24s %12s %20.0f\n", stopCase.name, "did not stop", peakCurrent * 100.0f);
+    }
+  }
+
+  motors.setSlewRates(0.0f, 0.0f, 0.0f);
+  motors.setBrakePolicy(LEFT_MOTOR, BRAKE_NEVER);
+  motors.setMotorSpeed(LEFT_MOTOR, 0.0f);
+}
+
+int main(int argc, char** argv){
+  const char* jsonPath = nullptr;
+  bool stopTime = false;
+  for(int i = 1; i < argc; i++){
+    if(strcmp(argv[i], "--json") == 0 && i + 1 < argc){
+      jsonPath = argv[++i];
+    }
+    else if(strcmp(argv[i], "--min-time-ms") == 0 && i + 1 < argc){
+      minTimeMs = (uint32_t)atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--self-test") == 0){
+      bool shaperPassed = testAxisShaper();
+      bool mixerPassed = testDriveMixer();
+      bool telemetryPassed = testTelemetryRoundTrip();
+      bool latencyPassed = testLatencyHistogram();
+      bool currentCalibrationPassed = testCurrentCalibration();
+      bool restoreOrderPassed = testRegisterRestoreOrder();
+      printf("Axis shaper: %s\n", shaperPassed ? "passed" : "FAILED");
+      printf("Drive mixer: %s\n", mixerPassed ? "passed" : "FAILED");
+      printf("Telemetry round trip: %s\n", telemetryPassed ? "passed" : "FAILED");
+      printf("Latency histogram: %s\n", latencyPassed ? "passed" : "FAILED");
+      printf("Current calibration: %s\n", currentCalibrationPassed ? "passed" : "FAILED");
+      printf("Register restore order: %s\n", restoreOrderPassed ? "passed" : "FAILED");
+      return (shaperPassed && mixerPassed && telemetryPassed && latencyPassed && currentCalibrationPassed && restoreOrderPassed) ? 0 : 1;
+    }
+    else if(strcmp(argv[i], "--stop-time") == 0){
+      stopTime = true;
+    }
+    else{
+      fprintf(stderr, "Usage: %s [--json results.json] [--min-time-ms N] [--self-test] [--stop-time]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  //Keep the library's own printing out of the results
+  logSink = fopen("/dev/null", "w");
+  Serial.setOutput(logSink != nullptr ? logSink : stderr);
+
+  BenchContext benchContext;
+  context = &benchContext;
+  drvSpiBus.attachDevice(DRV8711_CS_PIN, &context->simulator);
+  context->motors.init();
+  context->scheduler.begin(context->motors, CONTROL_RATE_HZ);
+  if(stopTime){
+    printStopTimes();
+    return 0;
+  }
+  timerOverheadNs = measureTimerOverheadNs();
+
+  std::vector<BenchResult> results;
+
+  //Straight after a reset every field differs from the profile
+  results.push_back(runBenchmark("configure_profile_after_reset",
+    [](uint64_t){ drv8711Driver.configureDefaultBrushedMotorProfile(); },
+    [](uint64_t){ context->simulator.powerCycle(); drv8711Driver.resync(); }));
+
+  //Run again with the profile already applied
+  results.push_back(runBenchmark("configure_profile_already_applied",
+    [](uint64_t){ drv8711Driver.configureDefaultBrushedMotorProfile(); }));
+
+  //The control task writes the new limit, so its fault check is run too to count the frames it sends
+  results.push_back(runBenchmark("motors_set_current_limit",
+    [](uint64_t i){ context->motors.setCurrentLimit((i & 1) ? 8.5f : 10.0f); context->motors.checkFaults(); }));
+
+  //The brake mode is written by the control task too
+  results.push_back(runBenchmark("motors_set_brake_mode_toggle",
+    [](uint64_t i){ context->motors.setMotorBrakeMode((i & 1) ? NEUTRAL : AUTO_BRAKE); context->motors.checkFaults(); }));
+
+  results.push_back(runBenchmark("motors_set_brake_mode_unchanged",
+    [](uint64_t){ context->motors.setMotorBrakeMode(AUTO_BRAKE); context->motors.checkFaults(); }));
+
+  results.push_back(runBenchmark("motors_check_faults_healthy",
+    [](uint64_t){ context->motors.checkFaults(); }));
+
+  results.push_back(runBenchmark("motors_set_motor_speed",
+    [](uint64_t i){ context->motors.setMotorSpeed(LEFT_MOTOR, (float)(i % 200) - 100.0f); }));
+
+  //Turning one stick reading into a duty, the old float path against the table
+  AxisCalibration calibration = defaultAxisCalibration();
+  benchShaper.configure(calibration, context->motors.getPwmPeriodTicks(LEFT_MOTOR));
+  results.push_back(runMicroBenchmark("stick_to_ticks_float_map",
+    [](uint64_t i){ benchSink = floatStickToTicks(benchAxis(i), context->motors.getPwmPeriodTicks(LEFT_MOTOR)); }));
+  results.push_back(runMicroBenchmark("stick_to_ticks_axis_shaper",
+    [](uint64_t i){ benchSink = benchShaper.shape(benchAxis(i)); }));
+
+  //Arcade mixing of swept inputs, including ones that saturate
+  benchMixer.configure(1000, 1000, 1000);
+  benchMixer.setMode(MIX_ARCADE);
+  results.push_back(runMicroBenchmark("drive_mixer_arcade",
+    [](uint64_t i){
+      int32_t left;
+      int32_t right;
+      benchMixer.mix((int32_t)(i % 2001) - 1000, (int32_t)((i * 7) % 2001) - 1000, left, right);
+      benchSink = left + right;
+    }));
+
+  //The stick held still, so every cycle asks for the same speeds
+  results.push_back(runBenchmark("loop_iteration_steady",
+    [](uint64_t){
+      context->motors.publishSetpoint(SOURCE_CONTROLLER, 50.0f, -50.0f);
+      context->scheduler.runCycle();
+    }));
+
+  //One loop() iteration: the input side publishes a setpoint and the control task runs a cycle
+  results.push_back(runBenchmark("loop_iteration",
+    [](uint64_t i){
+      float speed = (float)(i % 200) - 100.0f;
+      context->motors.publishSetpoint(SOURCE_CONTROLLER, speed, -speed);
+      context->scheduler.runCycle();
+    }));
+
+  //The same with the slew limiter ramping the motors towards each setpoint
+  //Back to back cycles are only a microsecond or so apart on the PC, too little to ramp at all,
+  //so the clock is moved on by one control period before each one
+  context->motors.setSlewRates(400.0f, 800.0f, 600.0f);
+  results.push_back(runBenchmark("loop_iteration_slewed",
+    [](uint64_t i){
+      float speed = (float)(i % 200) - 100.0f;
+      context->motors.publishSetpoint(SOURCE_CONTROLLER, speed, -speed);
+      context->scheduler.runCycle();
+    },
+    [](uint64_t){ advanceHostClock(1000000 / CONTROL_RATE_HZ); }));
+  context->motors.setSlewRates(0.0f, 0.0f, 0.0f);
+
+  //Fault polling as more DRV8711s share the bus
+  //Batched is checkFaults, which puts every driver's STATUS read into one pass over the bus
+  //Blocking reads each driver's STATUS in turn and on the board waits for every frame
+  //The fault batch the control step left queued is sent by any blocking read, which frees the bus for pollMotors
+  Motors pollMotors(drv8711Driver, motorPwm);
+  drv8711Driver.readStatus();
+  DRV8711Simulator extraSimulators[MOTORS_MAX_DRIVERS - 1];
+  std::vector<DRV8711> extraDrivers;
+  extraDrivers.reserve(MOTORS_MAX_DRIVERS - 1);
+  std::vector<DRV8711*> pollDrivers(1, &drv8711Driver);
+  for(uint8_t driverCount = 1; driverCount <= MOTORS_MAX_DRIVERS; driverCount++){
+    if(driverCount > 1){
+      uint8_t csPin = BENCH_EXTRA_DRIVER_CS_PIN + driverCount - 2;
+      drvSpiBus.attachDevice(csPin, &extraSimulators[driverCount - 2]);
+      extraDrivers.push_back(DRV8711(drvSpiBus, csPin));
+      pollMotors.addDriver(extraDrivers.back());
+      pollDrivers.push_back(&extraDrivers.back());
+    }
+    std::string suffix = "_" + std::to_string(driverCount) + (driverCount == 1 ? "_driver" : "_drivers");
+    results.push_back(runBenchmark(("poll_faults_batched" + suffix).c_str(),
+      [&](uint64_t){ pollMotors.checkFaults(); }));
+    results.push_back(runBenchmark(("poll_faults_blocking" + suffix).c_str(),
+      [&](uint64_t){
+        for(size_t i = 0; i < pollDrivers.size(); i++){
+          benchSink = pollDrivers[i]->readStatus().raw;
+        }
+      }));
+  }
+
+  printTable(results);
+  if(jsonPath != nullptr && !writeJson(jsonPath, results)){
+    return 1;
+  }
+
+  if(logSink != nullptr){
+    fclose(logSink);
+  }
+  return 0;
+}
@@ -0,0 +1,69 @@
+//Decodes a capture of the control board's binary telemetry stream into CSV
+//
+//This is built by the CMakeLists.txt in the root of the repository
+//
+//Capture the serial port and decode it:
+//  stty -F /dev/ttyUSB0 115200 raw
+//  cat /dev/ttyUSB0 > capture.bin
+//  ./build/telemetry_decode capture.bin > capture.csv
+//
+//Run ./build/telemetry_decode --self-test to check the encoder and decoder round trip
+#include <cstdio>
+#include <cstring>
+#include "telemetry.h"
+
+static void printHeader(FILE* output){
+  fprintf(output, "timestamp_us,sequence,axis_lx,axis_ly,axis_rx,axis_ry,"
+    "setpoint_left,setpoint_right,applied_left,applied_right,driver_status,loop_exec_us,loop_jitter_us\n");
+}
+
+static void printRecord(FILE* output, const TelemetryRecord& record){
+  //Speeds are sent in 0.01% steps, print them as percentages
+  fprintf(output, "%u,%u,%d,%d,%d,%d,%.2f,%.2f,%.2f,%.2f,0x%03X,%u,%u\n",
+    (unsigned)record.timestampUs, (unsigned)record.sequence,
+    record.axes[0], record.axes[1], record.axes[2], record.axes[3],
+    record.setpoint[0] / 100.0, record.setpoint[1] / 100.0,
+    record.appliedDuty[0] / 100.0, record.appliedDuty[1] / 100.0,
+    (unsigned)record.driverStatus, (unsigned)record.loopExecutionUs, (unsigned)record.loopJitterUs);
+}
+
+int main(int argc, char** argv){
+  if(argc == 2 && strcmp(argv[1], "--self-test") == 0){
+    bool passed = testTelemetryRoundTrip();
+    printf("Telemetry round trip: %s\n", passed ? "passed" : "FAILED");
+    return passed ? 0 : 1;
+  }
+
+  FILE* input = stdin;
+  if(argc == 2){
+    input = fopen(argv[1], "rb");
+    if(input == nullptr){
+      fprintf(stderr, "Could not open %s\n", argv[1]);
+      return 1;
+    }
+  }
+  else if(argc > 2){
+    fprintf(stderr, "Usage: %s [capture.bin | --self-test]\n", argv[0]);
+    return 1;
+  }
+
+  TelemetryDecoder decoder;
+  TelemetryRecord record;
+  printHeader(stdout);
+
+  int byte;
+  while((byte = fgetc(input)) != EOF){
+    if(decoder.decodeByte((uint8_t)byte, record)){
+      printRecord(stdout, record);
+    }
+  }
+
+  TelemetryDecoderStats stats = decoder.getStats();
+  fprintf(stderr, "Frames: %u, CRC errors: %u, framing errors: %u, records missed: %u\n",
+    (unsigned)stats.framesDecoded, (unsigned)stats.crcErrors, (unsigned)stats.framingErrors, (unsigned)stats.recordsMissed);
+
+  if(input != stdin){
+    fclose(input);
+  }
+  return 0;
+}